@@ -359,3 +359,302 @@ ast_new_field_list(struct ast_field *head, struct ast_field_list *tail)
 error:
     return NULL;
 }
+
+struct ast_exp *
+ast_copy_exp(struct ast_exp *exp)
+{
+    if (exp == NULL) {
+        return NULL;
+    }
+
+    switch (exp->kind) {
+    case ast_varExp:
+        return ast_new_var_exp(exp->pos, exp->u.var);
+
+    case ast_intExp:
+        return ast_int_exp(exp->pos, exp->u.intt);
+
+    case ast_callExp:
+        return ast_new_call_exp(exp->pos, exp->u.call.func,
+                                ast_copy_exp_list(exp->u.call.args));
+
+    case ast_opExp:
+        return ast_new_op_exp(exp->pos, exp->u.op.oper,
+                              ast_copy_exp(exp->u.op.left),
+                              ast_copy_exp(exp->u.op.right));
+    }
+
+    return NULL;
+}
+
+struct ast_exp_list *
+ast_copy_exp_list(struct ast_exp_list *list)
+{
+    if (list == NULL) {
+        return NULL;
+    }
+
+    return ast_new_exp_list(ast_copy_exp(list->head),
+                            ast_copy_exp_list(list->tail));
+}
+
+struct ast_stmt *
+ast_copy_stmt(struct ast_stmt *stmt)
+{
+    if (stmt == NULL) {
+        return NULL;
+    }
+
+    switch (stmt->kind) {
+    case ast_upStmt:
+        return ast_new_up_stmt(stmt->pos);
+
+    case ast_downStmt:
+        return ast_new_down_stmt(stmt->pos);
+
+    case ast_moveStmt:
+        return ast_new_move_stmt(stmt->pos, ast_copy_exp(stmt->u.move.exp1),
+                                 ast_copy_exp(stmt->u.move.exp2));
+
+    case ast_readStmt:
+        return ast_new_read_stmt(stmt->pos, stmt->u.read.var);
+
+    case ast_assignStmt:
+        return ast_new_assign_stmt(stmt->pos, stmt->u.assign.var,
+                                   ast_copy_exp(stmt->u.assign.exp));
+
+    case ast_iftStmt:
+        return ast_new_ift_stmt(stmt->pos, ast_copy_exp(stmt->u.ift.test),
+                                ast_copy_stmt_list(stmt->u.ift.then));
+
+    case ast_ifteStmt:
+        return ast_new_ifte_stmt(stmt->pos, ast_copy_exp(stmt->u.ifte.test),
+                                 ast_copy_stmt_list(stmt->u.ifte.then),
+                                 ast_copy_stmt_list(stmt->u.ifte.elsee));
+
+    case ast_whileStmt:
+        return ast_new_while_stmt(stmt->pos,
+                                  ast_copy_exp(stmt->u.whilee.test),
+                                  ast_copy_stmt_list(stmt->u.whilee.body));
+
+    case ast_returnStmt:
+        return ast_new_return_stmt(stmt->pos,
+                                   ast_copy_exp(stmt->u.returnn.exp));
+
+    case ast_callStmt:
+        return ast_new_call_stmt(stmt->pos, stmt->u.call.func,
+                                 ast_copy_exp_list(stmt->u.call.args));
+
+    case ast_exp_listStmt:
+        return ast_new_exp_list_stmt(stmt->pos,
+                                     ast_copy_exp_list(stmt->u.seq));
+    }
+
+    return NULL;
+}
+
+struct ast_stmt_list *
+ast_copy_stmt_list(struct ast_stmt_list *list)
+{
+    if (list == NULL) {
+        return NULL;
+    }
+
+    return ast_new_stmt_list(ast_copy_stmt(list->head),
+                             ast_copy_stmt_list(list->tail));
+}
+
+struct ast_var_dec_list *
+ast_copy_var_dec_list(struct ast_var_dec_list *list)
+{
+    if (list == NULL) {
+        return NULL;
+    }
+
+    return ast_new_var_dec_list(ast_new_var_dec(list->head->pos,
+                                                list->head->sym,
+                                                ast_copy_exp(list->head->init)),
+                                ast_copy_var_dec_list(list->tail));
+}
+
+void
+ast_free_exp(struct ast_exp *exp)
+{
+    if (exp == NULL) {
+        return;
+    }
+
+    switch (exp->kind) {
+    case ast_callExp:
+        ast_free_exp_list(exp->u.call.args);
+        break;
+
+    case ast_opExp:
+        ast_free_exp(exp->u.op.left);
+        ast_free_exp(exp->u.op.right);
+        break;
+
+    default:
+        break;
+    }
+
+    free(exp);
+}
+
+void
+ast_free_exp_list(struct ast_exp_list *list)
+{
+    while (list != NULL) {
+        struct ast_exp_list *next = list->tail;
+        ast_free_exp(list->head);
+        free(list);
+        list = next;
+    }
+}
+
+void
+ast_free_stmt_list(struct ast_stmt_list *list)
+{
+    while (list != NULL) {
+        struct ast_stmt_list *next = list->tail;
+        struct ast_stmt *stmt = list->head;
+
+        switch (stmt->kind) {
+        case ast_moveStmt:
+            ast_free_exp(stmt->u.move.exp1);
+            ast_free_exp(stmt->u.move.exp2);
+            break;
+
+        case ast_assignStmt:
+            ast_free_exp(stmt->u.assign.exp);
+            break;
+
+        case ast_iftStmt:
+            ast_free_exp(stmt->u.ift.test);
+            ast_free_stmt_list(stmt->u.ift.then);
+            break;
+
+        case ast_ifteStmt:
+            ast_free_exp(stmt->u.ifte.test);
+            ast_free_stmt_list(stmt->u.ifte.then);
+            ast_free_stmt_list(stmt->u.ifte.elsee);
+            break;
+
+        case ast_whileStmt:
+            ast_free_exp(stmt->u.whilee.test);
+            ast_free_stmt_list(stmt->u.whilee.body);
+            break;
+
+        case ast_returnStmt:
+            ast_free_exp(stmt->u.returnn.exp);
+            break;
+
+        case ast_callStmt:
+            ast_free_exp_list(stmt->u.call.args);
+            break;
+
+        case ast_exp_listStmt:
+            ast_free_exp_list(stmt->u.seq);
+            break;
+
+        default:
+            break;
+        }
+
+        free(stmt);
+        free(list);
+        list = next;
+    }
+}
+
+int
+ast_const_value(struct ast_exp *exp, int *value)
+{
+    int             l,
+                    r;
+
+    if (exp == NULL) {
+        return 0;
+    }
+
+    switch (exp->kind) {
+    case ast_intExp:
+        *value = (int16_t) exp->u.intt;
+        return 1;
+
+    case ast_opExp:
+        if (!ast_const_value(exp->u.op.left, &l)) {
+            return 0;
+        }
+
+        if (exp->u.op.oper == ast_negOp) {
+            *value = (int16_t) -l;
+            return 1;
+        }
+
+        if (!ast_const_value(exp->u.op.right, &r)) {
+            return 0;
+        }
+
+        switch (exp->u.op.oper) {
+        case ast_plusOp:
+            *value = (int16_t) (l + r);
+            return 1;
+
+        case ast_minusOp:
+            *value = (int16_t) (l - r);
+            return 1;
+
+        case ast_timesOp:
+            *value = (int16_t) (l * r);
+            return 1;
+
+        default:
+            return 0;
+        }
+
+    default:
+        return 0;
+    }
+}
+
+int
+ast_has_call(struct ast_exp *exp)
+{
+    if (exp == NULL) {
+        return 0;
+    }
+
+    switch (exp->kind) {
+    case ast_callExp:
+        return 1;
+
+    case ast_opExp:
+        return ast_has_call(exp->u.op.left) || ast_has_call(exp->u.op.right);
+
+    default:
+        return 0;
+    }
+}
+
+int
+ast_operand_order(struct ast_exp *exp, struct ast_exp **first,
+                  struct ast_exp **second)
+{
+    *first = exp->u.op.left;
+    *second = exp->u.op.right;
+
+    switch (exp->u.op.oper) {
+    case ast_GT:
+    case ast_GEQ:
+        *first = exp->u.op.right;
+        *second = exp->u.op.left;
+        return exp->u.op.oper == ast_GEQ ? 2 : 1;
+
+    case ast_LEQ:
+        return 2;
+
+    default:
+        return 1;
+    }
+}
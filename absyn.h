@@ -261,4 +261,47 @@ struct ast_field *ast_new_field(YYLTYPE t, struct s_symbol *name);
 struct ast_field_list *ast_new_field_list(struct ast_field *head,
                                           struct ast_field_list *tail);
 
+/**
+ * Deep copies, for the code generator that needs to translate an expression
+ * more than once (translating an expression releases it) and for the
+ * optimiser
+ */
+struct ast_exp *ast_copy_exp(struct ast_exp *exp);
+struct ast_exp_list *ast_copy_exp_list(struct ast_exp_list *list);
+struct ast_stmt *ast_copy_stmt(struct ast_stmt *stmt);
+struct ast_stmt_list *ast_copy_stmt_list(struct ast_stmt_list *list);
+struct ast_var_dec_list *ast_copy_var_dec_list(struct ast_var_dec_list *list);
+
+/**
+ * Releases an expression or statements that are not translated
+ */
+void ast_free_exp(struct ast_exp *exp);
+void ast_free_exp_list(struct ast_exp_list *list);
+void ast_free_stmt_list(struct ast_stmt_list *list);
+
+/**
+ * Folds @exp if it only involves literals. The arithmetic wraps around like
+ * the 16-bit target does.
+ *
+ * @returns 1 and sets @value if @exp is a constant, 0 otherwise
+ */
+int ast_const_value(struct ast_exp *exp, int *value);
+
+/**
+ * @returns 1 if evaluating @exp may have side effects, i.e., it calls a
+ * function
+ */
+int ast_has_call(struct ast_exp *exp);
+
+/**
+ * Stores the operands of @exp in @first and @second in the order the
+ * generated code runs them: semant.c lowers a > b to b < a, and a >= b to
+ * b <= a, which it tests as b < a, then b == a.
+ *
+ * @returns 2 if the code runs them once more when the first test fails, as
+ * it does for <= and >=, 1 otherwise
+ */
+int ast_operand_order(struct ast_exp *exp, struct ast_exp **first,
+                      struct ast_exp **second);
+
 #endif /* end of include guard: AST_H_ */
@@ -0,0 +1,547 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "lockstep.h"
+
+/**
+ * A thread and its machine, reused for all the runs it takes
+ */
+struct batch_worker {
+    struct batch   *batch;
+    // One of them is NULL
+    struct vm      *vm;
+    struct lockstep *ls;
+    pthread_t       thread;
+};
+
+/**
+ * Pen of a run, for the summary. The events are also written to @out, unless
+ * it is NULL.
+ */
+struct tally {
+    struct batch_run *run;
+    FILE           *out;
+    int             pen_down;
+    int             x;
+    int             y;
+};
+
+static void
+tally(void *data, enum vm_pen_event event, int x, int y)
+{
+    struct tally   *t = data;
+
+    ++t->run->events;
+
+    switch (event) {
+    case vm_pen_up:
+        t->pen_down = 0;
+        break;
+
+    case vm_pen_down:
+        t->pen_down = 1;
+        break;
+
+    case vm_pen_move:
+        if (t->pen_down) {
+            t->run->down_distance += hypot((double) (x - t->x),
+                                           (double) (y - t->y));
+        }
+
+        t->x = x;
+        t->y = y;
+        break;
+    }
+
+    if (t->out != NULL) {
+        vm_write_pen(t->out, event, x, y);
+    }
+}
+
+/**
+ * Adds a run named @name that reads the numbers in @text
+ */
+static int
+add_run(struct batch *b, const char *name, const char *text)
+{
+    struct batch_run *run;
+    char           *end;
+    int             capacity = 0;
+
+    if (b->nruns == b->capacity) {
+        b->capacity = b->capacity ? 2 * b->capacity : 64;
+        b->runs = realloc(b->runs, b->capacity * sizeof(*b->runs));
+        check_mem(b->runs);
+    }
+
+    run = &b->runs[b->nruns++];
+    memset(run, 0, sizeof(*run));
+    run->name = strdup(name);
+    check_mem(run->name);
+
+    for (;;) {
+        long            v;
+
+        while (*text == ' ' || *text == '\t' || *text == '\n' ||
+               *text == '\r') {
+            ++text;
+        }
+
+        if (*text == '\0') {
+            break;
+        }
+
+        errno = 0;
+        v = strtol(text, &end, 10);
+        check(end != text && errno == 0 && v >= INT_MIN && v <= INT_MAX,
+              "%s: not a number: %.20s", name, text);
+        text = end;
+
+        if (run->input_size == capacity) {
+            capacity = capacity ? 2 * capacity : 8;
+            run->input = realloc(run->input, capacity * sizeof(*run->input));
+            check_mem(run->input);
+        }
+
+        run->input[run->input_size++] = (int) v;
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * One vector per line, named after the line number. Blank lines are skipped.
+ */
+static int
+load_file(struct batch *b, const char *path)
+{
+    FILE           *f = fopen(path, "r");
+    char           *line = NULL;
+    size_t          size = 0;
+    int             n = 0;
+    int             ret = -1;
+
+    check(f, "Cannot open the file %s", path);
+
+    while (getline(&line, &size, f) != -1) {
+        char            name[32];
+
+        ++n;
+
+        if (strspn(line, " \t\r\n") == strlen(line)) {
+            continue;
+        }
+
+        snprintf(name, sizeof(name), "%d", n);
+        check(add_run(b, name, line) == 0, "Bad input vector in %s", path);
+    }
+
+    check(!ferror(f), "Cannot read the file %s", path);
+    ret = 0;
+
+error:
+    free(line);
+
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    return ret;
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/**
+ * @returns the content of the file @path as a string, or NULL
+ */
+static char    *
+read_text(const char *path)
+{
+    FILE           *f = fopen(path, "r");
+    char           *text = NULL;
+    long            size;
+
+    check(f, "Cannot open the file %s", path);
+    check(fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+          fseek(f, 0, SEEK_SET) == 0, "Cannot read the file %s", path);
+    text = malloc(size + 1);
+    check_mem(text);
+    check(fread(text, 1, size, f) == (size_t) size,
+          "Cannot read the file %s", path);
+    text[size] = '\0';
+    fclose(f);
+    return text;
+
+error:
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    free(text);
+    return NULL;
+}
+
+/**
+ * One vector per .d file, in the order of the file names
+ */
+static int
+load_dir(struct batch *b, const char *path)
+{
+    DIR            *dir = opendir(path);
+    struct dirent  *entry;
+    char          **names = NULL;
+    int             nnames = 0;
+    int             capacity = 0;
+    int             ret = -1;
+
+    check(dir, "Cannot open the directory %s", path);
+
+    while ((entry = readdir(dir)) != NULL) {
+        size_t          len = strlen(entry->d_name);
+
+        if (len < 3 || strcmp(entry->d_name + len - 2, ".d") != 0) {
+            continue;
+        }
+
+        if (nnames == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            names = realloc(names, capacity * sizeof(*names));
+            check_mem(names);
+        }
+
+        names[nnames] = strdup(entry->d_name);
+        check_mem(names[nnames]);
+        ++nnames;
+    }
+
+    qsort(names, nnames, sizeof(*names), compare_names);
+
+    for (int i = 0; i < nnames; ++i) {
+        char           *file = malloc(strlen(path) + strlen(names[i]) + 2);
+        char           *text;
+        int             ok;
+        struct stat     st;
+
+        check_mem(file);
+        sprintf(file, "%s/%s", path, names[i]);
+
+        if (stat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(file);
+            continue;
+        }
+
+        text = read_text(file);
+        free(file);
+        check(text, "Cannot load the input vector %s", names[i]);
+        names[i][strlen(names[i]) - 2] = '\0';
+        ok = add_run(b, names[i], text) == 0;
+        free(text);
+        check(ok, "Bad input vector in %s", path);
+    }
+
+    ret = 0;
+
+error:
+    for (int i = 0; i < nnames; ++i) {
+        free(names[i]);
+    }
+
+    free(names);
+
+    if (dir != NULL) {
+        closedir(dir);
+    }
+
+    return ret;
+}
+
+struct batch   *
+batch_load(const char *path)
+{
+    struct batch   *b = calloc(1, sizeof(*b));
+    struct stat     st;
+
+    check_mem(b);
+    check(stat(path, &st) == 0, "Cannot find %s", path);
+
+    if (S_ISDIR(st.st_mode)) {
+        check(load_dir(b, path) == 0, "Cannot load the directory %s", path);
+    } else {
+        check(load_file(b, path) == 0, "Cannot load the file %s", path);
+    }
+
+    check(b->nruns > 0, "No input vectors in %s", path);
+    return b;
+
+error:
+    batch_free(b);
+    return NULL;
+}
+
+/**
+ * Opens the plot stream of @run, if any, and sets up @t to count its events
+ *
+ * @returns 0, or -1 if the stream cannot be opened
+ */
+static int
+begin_run(struct batch *b, struct batch_run *run, struct tally *t)
+{
+    char           *path = NULL;
+
+    memset(t, 0, sizeof(*t));
+    t->run = run;
+
+    if (b->dir != NULL) {
+        path = malloc(strlen(b->dir) + strlen(run->name) + 6);
+        check_mem(path);
+        sprintf(path, "%s/%s.out", b->dir, run->name);
+        t->out = fopen(path, "w");
+        check(t->out, "Cannot write the plot stream of %s", run->name);
+        free(path);
+    }
+
+    return 0;
+
+error:
+    free(path);
+    run->status = vm_error;
+    return -1;
+}
+
+static void
+end_run(struct batch_run *run, struct tally *t)
+{
+    if (run->status != vm_halted) {
+        log_err("Run %s failed", run->name);
+    }
+
+    if (t->out != NULL && fclose(t->out) != 0) {
+        log_err("Cannot write the plot stream of %s", run->name);
+        run->status = vm_error;
+    }
+}
+
+/**
+ * The only setup between two runs on the same machine is clearing its stack
+ */
+static void
+run_one(struct batch *b, struct vm *vm, struct batch_run *run)
+{
+    struct tally    t;
+
+    if (begin_run(b, run, &t) != 0) {
+        return;
+    }
+
+    memset(vm->stack, 0, sizeof(vm->stack));
+    vm_reset(vm, b->image);
+    vm->input = run->input;
+    vm->input_size = run->input_size;
+    vm->pen = tally;
+    vm->pen_data = &t;
+    run->status = vm_run(vm);
+    run->steps = vm->steps;
+    end_run(run, &t);
+}
+
+/**
+ * Runs @count runs from @first in the lanes of @ls
+ */
+static void
+run_lanes(struct batch *b, struct lockstep *ls, int first, int count)
+{
+    struct tally    t[LOCKSTEP_LANES];
+    int             ok[LOCKSTEP_LANES];
+
+    lockstep_reset(ls, b->image, count);
+
+    for (int l = 0; l < count; ++l) {
+        struct batch_run *run = &b->runs[first + l];
+
+        ok[l] = begin_run(b, run, &t[l]) == 0;
+        ls->input[l] = run->input;
+        ls->input_size[l] = run->input_size;
+        ls->pen[l] = tally;
+        ls->pen_data[l] = &t[l];
+
+        if (!ok[l]) {
+            ls->live &= ~(1U << l);
+        }
+    }
+
+    lockstep_run(ls);
+
+    for (int l = 0; l < count; ++l) {
+        if (ok[l]) {
+            b->runs[first + l].status = ls->status[l];
+            b->runs[first + l].steps = ls->steps[l];
+            end_run(&b->runs[first + l], &t[l]);
+        }
+    }
+}
+
+static void    *
+work(void *data)
+{
+    struct batch_worker *w = data;
+    struct batch   *b = w->batch;
+    int             i;
+
+    if (w->ls != NULL) {
+        while ((i = __atomic_fetch_add(&b->next, LOCKSTEP_LANES,
+                                       __ATOMIC_RELAXED)) < b->nruns) {
+            int             count = b->nruns - i;
+
+            run_lanes(b, w->ls, i, count < LOCKSTEP_LANES ? count :
+                      LOCKSTEP_LANES);
+        }
+
+        return NULL;
+    }
+
+    while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) <
+           b->nruns) {
+        run_one(b, w->vm, &b->runs[i]);
+    }
+
+    return NULL;
+}
+
+int
+batch_run(struct batch *b, const struct vm_image *image, const char *dir,
+          int threads, int lockstep)
+{
+    struct batch_worker *workers = NULL;
+    int             started = 0;
+    int             ret = -1;
+
+    int             units = lockstep ?
+        (b->nruns + LOCKSTEP_LANES - 1) / LOCKSTEP_LANES : b->nruns;
+
+    if (threads > units) {
+        threads = units;
+    }
+
+    b->image = image;
+    b->dir = dir;
+    b->next = 0;
+    workers = calloc(threads, sizeof(*workers));
+    check_mem(workers);
+
+    for (int k = 0; k < threads; ++k) {
+        workers[k].batch = b;
+
+        if (lockstep) {
+            workers[k].ls = lockstep_new();
+            check_mem(workers[k].ls);
+        } else {
+            workers[k].vm = vm_new();
+            check_mem(workers[k].vm);
+        }
+    }
+
+    // The calling thread is worker 0
+    for (started = 1; started < threads; ++started) {
+        check(pthread_create(&workers[started].thread, NULL, work,
+                             &workers[started]) == 0,
+              "Cannot start a batch thread");
+    }
+
+    ret = 0;
+
+error:
+    if (workers != NULL && (workers[0].vm != NULL || workers[0].ls != NULL)) {
+        // The runs the missing threads would have taken are done here
+        work(&workers[0]);
+
+        for (int k = 1; k < started; ++k) {
+            pthread_join(workers[k].thread, NULL);
+        }
+    }
+
+    for (int k = 0; workers != NULL && k < threads; ++k) {
+        vm_free(workers[k].vm);
+        lockstep_free(workers[k].ls);
+    }
+
+    free(workers);
+
+    for (int i = 0; ret == 0 && i < b->nruns; ++i) {
+        if (b->runs[i].status != vm_halted) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+void
+batch_report(const struct batch *b, FILE *out)
+{
+    fprintf(out, "%-20s %8s %14s %10s %14s\n", "run", "status", "steps",
+            "events", "pen-down");
+
+    for (int i = 0; i < b->nruns; ++i) {
+        const struct batch_run *run = &b->runs[i];
+
+        fprintf(out, "%-20s %8s %14lld %10ld %14.1f\n", run->name,
+                run->status == vm_halted ? "halted" : "error", run->steps,
+                run->events, run->down_distance);
+    }
+}
+
+void
+batch_free(struct batch *b)
+{
+    if (b == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < b->nruns; ++i) {
+        free(b->runs[i].name);
+        free(b->runs[i].input);
+    }
+
+    free(b->runs);
+    free(b);
+}
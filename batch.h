@@ -0,0 +1,91 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Batch execution
+ *
+ * Runs one image once per input vector, i.e., per list of values for `read',
+ * on several threads. The vectors come from the lines of a file, or from the
+ * .d files of a directory. The results are kept in the order of the vectors,
+ * whatever the order the runs finish in.
+ */
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <stdio.h>
+
+#include "vm.h"
+
+struct batch_run {
+    // The line number, or the file name without .d
+    char           *name;
+    int            *input;
+    int             input_size;
+    // Results
+    enum vm_status  status;
+    long long       steps;
+    long            events;
+    double          down_distance;
+};
+
+struct batch {
+    struct batch_run *runs;
+    int             nruns;
+    int             capacity;
+    const struct vm_image *image;
+    // Where the plot streams go, unless NULL
+    const char     *dir;
+    // Index of the next run to start
+    int             next;
+};
+
+/**
+ * @returns the input vectors of the lines of the file @path, or of the .d
+ * files in the directory @path, or NULL if they cannot be read
+ */
+struct batch   *batch_load(const char *path);
+
+/**
+ * Runs @image once per input vector of @b with @threads threads, and
+ * writes each plot stream to DIR/NAME.out if @dir is not NULL
+ *
+ * With @lockstep, each thread takes LOCKSTEP_LANES runs at a time and runs
+ * them side by side on a lockstep machine.
+ *
+ * @returns 0 if every run halted, -1 otherwise
+ */
+int             batch_run(struct batch *b, const struct vm_image *image,
+                          const char *dir, int threads, int lockstep);
+
+/**
+ * Writes one line per run to @out, in the order of the input vectors
+ */
+void            batch_report(const struct batch *b, FILE *out);
+
+void            batch_free(struct batch *b);
+
+#endif /* end of include guard: BATCH_H_ */
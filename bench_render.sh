@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+
+# Renders the Koch curve of degree ${1:-7} in a ${2:-16384} pixel square with
+# 1, 2, 4, ... threads, up to the number of CPUs
+
+degree=${1:-7}
+size=${2:-16384}
+cpus=$(getconf _NPROCESSORS_ONLN)
+
+./turtle -O2 tests/default/koch.t -o bench.p &> /dev/null || exit 1
+echo $degree > bench.d
+
+ms() {
+    local start=$(date +%s%N)
+    "$@" || exit 1
+    echo $(( ($(date +%s%N) - start) / 1000000 ))
+}
+
+base=$(ms ./pdplot -i bench.d -o /dev/null bench.p)
+echo "degree $degree, ${size}x${size}, run without rendering: $base ms"
+
+threads=1
+while [ $threads -le $cpus ]
+do
+    t=$(ms ./pdplot -i bench.d -o /dev/null -R bench.ppm -W $size \
+           -j $threads bench.p)
+
+    if [ $threads -eq 1 ]
+    then
+        one=$t
+    fi
+
+    printf "%d thread(s): %d ms, speedup %d.%02d\n" $threads $t \
+           $(( 100 * one / t / 100 )) $(( 100 * one / t % 100 ))
+    threads=$(( threads * 2 ))
+done
+
+rm -f bench.p bench.d bench.ppm
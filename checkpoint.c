@@ -0,0 +1,200 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+
+#define MAGIC "PDPLOTCK"
+
+/**
+ * Fixed part of a checkpoint: magic, version, hash, 9 registers, 3 counters
+ * and the number of stack words
+ */
+#define HEADER_SIZE (8 + 4 + 4 + 9 * 4 + 3 * 8 + 4)
+
+/**
+ * FNV-1a over the words of @image
+ */
+static uint32_t
+image_hash(const struct vm_image *image)
+{
+    uint32_t        h = 2166136261u;
+
+    for (int i = 0; i < image->size; ++i) {
+        h = (h ^ (image->code[i] & 0xFF)) * 16777619u;
+        h = (h ^ (image->code[i] >> 8)) * 16777619u;
+    }
+
+    return h;
+}
+
+static uint8_t *
+put(uint8_t *p, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; ++i) {
+        *p++ = (uint8_t) (v >> (8 * i));
+    }
+
+    return p;
+}
+
+static uint64_t
+get(const uint8_t **p, int bytes)
+{
+    uint64_t        v = 0;
+
+    for (int i = 0; i < bytes; ++i) {
+        v |= (uint64_t) *(*p)++ << (8 * i);
+    }
+
+    return v;
+}
+
+int
+checkpoint_save(const struct vm *vm, long long input_offset,
+                long long output_offset, const char *path)
+{
+    // Past SP, only the words a program stored out of its frames
+    int             n = VM_STACK_SIZE;
+    size_t          size;
+    uint8_t        *buf = NULL,
+                   *p;
+    char           *tmp = NULL;
+    FILE           *f = NULL;
+
+    while (n > vm->sp + 1 && vm->stack[n - 1] == 0) {
+        --n;
+    }
+
+    size = HEADER_SIZE + 2 * (size_t) n;
+    buf = malloc(size);
+    tmp = malloc(strlen(path) + 5);
+    check_mem(buf && tmp);
+    memcpy(buf, MAGIC, 8);
+    p = put(buf + 8, CHECKPOINT_VERSION, 4);
+    p = put(p, image_hash(vm->image), 4);
+    p = put(p, (uint32_t) vm->pc, 4);
+    p = put(p, (uint32_t) vm->sp, 4);
+    p = put(p, (uint32_t) vm->fp, 4);
+    p = put(p, (uint32_t) vm->gp, 4);
+    p = put(p, (uint32_t) vm->zero, 4);
+    p = put(p, (uint32_t) vm->negative, 4);
+    p = put(p, (uint32_t) vm->pen_down, 4);
+    p = put(p, (uint32_t) vm->pen_x, 4);
+    p = put(p, (uint32_t) vm->pen_y, 4);
+    p = put(p, (uint64_t) vm->steps, 8);
+    p = put(p, (uint64_t) input_offset, 8);
+    p = put(p, (uint64_t) output_offset, 8);
+    p = put(p, (uint32_t) n, 4);
+
+    for (int i = 0; i < n; ++i) {
+        p = put(p, (uint16_t) vm->stack[i], 2);
+    }
+
+    sprintf(tmp, "%s.tmp", path);
+    f = fopen(tmp, "wb");
+    check(f, "Cannot open the file %s for writing", tmp);
+    check(fwrite(buf, 1, size, f) == size, "Cannot write the file %s", tmp);
+    check(fclose(f) == 0, "Cannot write the file %s", tmp);
+    f = NULL;
+    check(rename(tmp, path) == 0, "Cannot replace the file %s", path);
+    free(buf);
+    free(tmp);
+    return 0;
+
+error:
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    free(buf);
+    free(tmp);
+    return -1;
+}
+
+int
+checkpoint_load(struct vm *vm, const struct vm_image *image,
+                long long *input_offset, long long *output_offset,
+                const char *path)
+{
+    FILE           *f = fopen(path, "rb");
+    uint8_t         header[HEADER_SIZE];
+    const uint8_t  *p = header + 8;
+    uint32_t        n;
+    uint8_t        *words = NULL;
+
+    check(f, "Cannot open the file %s", path);
+    check(fread(header, 1, HEADER_SIZE, f) == HEADER_SIZE &&
+          memcmp(header, MAGIC, 8) == 0, "%s is not a checkpoint", path);
+    check(get(&p, 4) == CHECKPOINT_VERSION,
+          "%s is from another version of pdplot", path);
+    check(get(&p, 4) == image_hash(image),
+          "%s was taken from another image", path);
+    vm_reset(vm, image);
+    // The file may hold any state, which only the checks make safe to run
+    vm->reached = 0;
+    vm->pc = (int32_t) get(&p, 4);
+    vm->sp = (int32_t) get(&p, 4);
+    vm->fp = (int32_t) get(&p, 4);
+    vm->gp = (int32_t) get(&p, 4);
+    vm->zero = (int32_t) get(&p, 4);
+    vm->negative = (int32_t) get(&p, 4);
+    vm->pen_down = (int32_t) get(&p, 4);
+    vm->pen_x = (int32_t) get(&p, 4);
+    vm->pen_y = (int32_t) get(&p, 4);
+    vm->steps = (long long) get(&p, 8);
+    *input_offset = (long long) get(&p, 8);
+    *output_offset = (long long) get(&p, 8);
+    n = (uint32_t) get(&p, 4);
+    check(n <= VM_STACK_SIZE && vm->sp >= 0 && vm->sp < VM_STACK_SIZE &&
+          vm->pc >= 0 && vm->pc < image->size,
+          "%s is not a valid checkpoint", path);
+    words = malloc(2 * (size_t) n + 1);
+    check_mem(words);
+    check(fread(words, 2, n, f) == n && fgetc(f) == EOF,
+          "%s is not a valid checkpoint", path);
+    memset(vm->stack, 0, sizeof(vm->stack));
+    p = words;
+
+    for (uint32_t i = 0; i < n; ++i) {
+        vm->stack[i] = (int16_t) get(&p, 2);
+    }
+
+    free(words);
+    fclose(f);
+    return 0;
+
+error:
+    free(words);
+
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    return -1;
+}
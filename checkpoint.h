@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Checkpoints
+ *
+ * Saves the state of a machine to a file, and restores it, so that a long
+ * plot can be stopped and resumed later, or elsewhere. A checkpoint holds
+ * the registers, the pen, the number of steps, the offsets reached in the
+ * input and plot stream, and the stack up to its last used word. It only
+ * restores on a machine running the image it was taken from.
+ *
+ * Taking checkpoints costs little, as the machine only stops for one at
+ * its step limit. A resumed run does cost more: nothing proves the state
+ * read back is one the image can reach, so it runs with all the checks.
+ *
+ * All numbers are little-endian:
+ *
+ *     "PDPLOTCK", version (u32), hash of the image (u32),
+ *     pc, sp, fp, gp, zero, negative, pen_down, pen_x, pen_y (i32),
+ *     steps, input offset, output offset (i64),
+ *     number of stack words n (u32), stack[0] to stack[n - 1] (i16)
+ */
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include "vm.h"
+
+#define CHECKPOINT_VERSION 1
+
+/**
+ * Saves @vm to @path, with the offsets of its input and plot stream, -1 if
+ * unknown. The file is replaced only once the new one is complete.
+ *
+ * @returns 0 on success, -1 otherwise
+ */
+int             checkpoint_save(const struct vm *vm, long long input_offset,
+                                long long output_offset, const char *path);
+
+/**
+ * Resets @vm to run @image from the checkpoint @path, and stores the
+ * offsets it was taken at in @input_offset and @output_offset
+ *
+ * As the file may hold any state, @vm then runs with all the checks (see
+ * vm_run()).
+ *
+ * @returns 0 on success, -1 otherwise
+ */
+int             checkpoint_load(struct vm *vm, const struct vm_image *image,
+                                long long *input_offset,
+                                long long *output_offset, const char *path);
+
+#endif /* end of include guard: CHECKPOINT_H_ */
@@ -0,0 +1,369 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "opt.h"
+
+/**
+ * Code growth allowed for function clones, in percent of the size of the
+ * program, and at least CLONE_MIN_BUDGET AST nodes
+ */
+#define CLONE_GROWTH 50
+#define CLONE_MIN_BUDGET 128
+
+/**
+ * Only the first parameters can be specialised
+ */
+#define CLONE_MAX_PARAMS 16
+
+/**
+ * A function specialised for some constant arguments
+ */
+struct clone {
+    struct s_symbol *orig;
+    // Bit i is set if parameter i is the constant values[i]
+    unsigned        mask;
+    int             values[CLONE_MAX_PARAMS];
+    struct s_symbol *name;
+    struct clone   *next;
+};
+
+static struct clone *_clones;
+static int      _clone_budget;
+
+/**
+ * Number of clones created so far, to give them unique names
+ */
+static int      _nclones;
+
+/**
+ * @returns the function @name of @prog, or NULL if there is none
+ */
+static struct ast_fun_dec *find_fun(struct ast_program *prog,
+                                    struct s_symbol *name);
+
+/**
+ * @returns the name of the clone of @fun for the constant parameters in @mask
+ * and @values, or NULL if it exceeds the budget. The clone is created and
+ * appended to @prog if needed.
+ */
+static struct s_symbol *specialise(struct ast_program *prog,
+                                   struct ast_fun_dec *fun, unsigned mask,
+                                   int *values);
+
+/**
+ * Redirects the call to @func with @args to a clone if some of the arguments
+ * are constant
+ */
+static void     clone_call(struct ast_program *prog, struct s_symbol **func,
+                           struct ast_exp_list **args);
+
+/**
+ * Redirects the calls in @exp, @list and the statements nested in it
+ */
+static void     clone_calls_exp(struct ast_program *prog,
+                                struct ast_exp *exp);
+static void     clone_calls_stmt_list(struct ast_program *prog,
+                                      struct ast_stmt_list *list);
+
+static struct ast_fun_dec *
+find_fun(struct ast_program *prog, struct s_symbol *name)
+{
+    struct ast_fun_dec_list *p;
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        if (p->head->name == name) {
+            return p->head;
+        }
+    }
+
+    return NULL;
+}
+
+static struct s_symbol *
+specialise(struct ast_program *prog, struct ast_fun_dec *fun, unsigned mask,
+           int *values)
+{
+    struct clone   *c;
+    struct ast_field_list *params = NULL,
+                   **last_param = &params,
+                   *f;
+    struct ast_var_dec_list *v;
+    struct ast_fun_dec_list **last;
+    int             i;
+    char            name[64];
+
+    for (c = _clones; c != NULL; c = c->next) {
+        if (c->orig != fun->name || c->mask != mask) {
+            continue;
+        }
+
+        for (i = 0; i < CLONE_MAX_PARAMS; ++i) {
+            if ((mask & (1u << i)) && c->values[i] != values[i]) {
+                break;
+            }
+        }
+
+        if (i == CLONE_MAX_PARAMS) {
+            return c->name;
+        }
+    }
+
+    int             size = opt_stmt_list_size(fun->body);
+
+    for (v = fun->var; v; v = v->tail) {
+        size += 1 + opt_exp_size(v->head->init);
+    }
+
+    if (size > _clone_budget) {
+        return NULL;
+    }
+
+    _clone_budget -= size;
+    c = malloc(sizeof(*c));
+    check_mem(c);
+    c->orig = fun->name;
+    c->mask = mask;
+    memcpy(c->values, values, sizeof(c->values));
+    // Identifiers in the source start with a letter, so this cannot clash
+    snprintf(name, sizeof(name), "__%s_%d", s_name(fun->name), ++_nclones);
+    c->name = s_new_symbol(name);
+    c->next = _clones;
+    _clones = c;
+
+    struct ast_var_dec_list *vars = ast_copy_var_dec_list(fun->var);
+    struct ast_stmt_list *body = ast_copy_stmt_list(fun->body);
+
+    for (f = fun->params, i = 0; f; f = f->tail, ++i) {
+        if (i < CLONE_MAX_PARAMS && (mask & (1u << i))) {
+            // It is never assigned, so every read in the body is the value
+            for (v = vars; v; v = v->tail) {
+                opt_subst_exp(v->head->init, f->head->name, values[i]);
+            }
+
+            opt_subst_stmt_list(body, f->head->name, values[i]);
+        } else {
+            *last_param = ast_new_field_list(ast_new_field(f->head->pos,
+                                                           f->head->name),
+                                             NULL);
+            last_param = &(*last_param)->tail;
+        }
+    }
+
+    for (last = &prog->func_def_list; *last; last = &(*last)->tail) {
+        ;
+    }
+
+    *last = ast_new_fundec_list(ast_new_fundec(fun->pos, c->name, params,
+                                               vars, body), NULL);
+    return c->name;
+
+error:
+    panic();
+    return NULL;
+}
+
+static void
+clone_call(struct ast_program *prog, struct s_symbol **func,
+           struct ast_exp_list **args)
+{
+    struct ast_fun_dec *fun = find_fun(prog, *func);
+    struct ast_field_list *f;
+    struct ast_exp_list *a,
+                  **p;
+    int             values[CLONE_MAX_PARAMS] = { 0 };
+    unsigned        mask = 0;
+    int             i;
+
+    if (fun == NULL) {
+        return;
+    }
+
+    for (f = fun->params, a = *args, i = 0; f && a;
+            f = f->tail, a = a->tail, ++i) {
+        if (i < CLONE_MAX_PARAMS && !opt_writes_var(fun->body, f->head->name) &&
+                ast_const_value(a->head, values + i)) {
+            mask |= 1u << i;
+        }
+    }
+
+    // Wrong number of arguments: left to semant.c
+    if (mask == 0 || f != NULL || a != NULL) {
+        return;
+    }
+
+    struct s_symbol *name = specialise(prog, fun, mask, values);
+
+    if (name == NULL) {
+        return;
+    }
+
+    *func = name;
+
+    for (p = args, i = 0; *p != NULL; ++i) {
+        a = *p;
+
+        if (i < CLONE_MAX_PARAMS && (mask & (1u << i))) {
+            *p = a->tail;
+            ast_free_exp(a->head);
+            free(a);
+        } else {
+            p = &a->tail;
+        }
+    }
+}
+
+static void
+clone_calls_exp(struct ast_program *prog, struct ast_exp *exp)
+{
+    struct ast_exp_list *args;
+
+    if (exp == NULL) {
+        return;
+    }
+
+    switch (exp->kind) {
+    case ast_callExp:
+        for (args = exp->u.call.args; args; args = args->tail) {
+            clone_calls_exp(prog, args->head);
+        }
+
+        clone_call(prog, &exp->u.call.func, &exp->u.call.args);
+        break;
+
+    case ast_opExp:
+        clone_calls_exp(prog, exp->u.op.left);
+        clone_calls_exp(prog, exp->u.op.right);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void
+clone_calls_stmt_list(struct ast_program *prog, struct ast_stmt_list *list)
+{
+    struct ast_exp_list *exps;
+
+    for (; list; list = list->tail) {
+        struct ast_stmt *stmt = list->head;
+
+        switch (stmt->kind) {
+        case ast_moveStmt:
+            clone_calls_exp(prog, stmt->u.move.exp1);
+            clone_calls_exp(prog, stmt->u.move.exp2);
+            break;
+
+        case ast_assignStmt:
+            clone_calls_exp(prog, stmt->u.assign.exp);
+            break;
+
+        case ast_iftStmt:
+            clone_calls_exp(prog, stmt->u.ift.test);
+            clone_calls_stmt_list(prog, stmt->u.ift.then);
+            break;
+
+        case ast_ifteStmt:
+            clone_calls_exp(prog, stmt->u.ifte.test);
+            clone_calls_stmt_list(prog, stmt->u.ifte.then);
+            clone_calls_stmt_list(prog, stmt->u.ifte.elsee);
+            break;
+
+        case ast_whileStmt:
+            clone_calls_exp(prog, stmt->u.whilee.test);
+            clone_calls_stmt_list(prog, stmt->u.whilee.body);
+            break;
+
+        case ast_returnStmt:
+            clone_calls_exp(prog, stmt->u.returnn.exp);
+            break;
+
+        case ast_callStmt:
+            for (exps = stmt->u.call.args; exps; exps = exps->tail) {
+                clone_calls_exp(prog, exps->head);
+            }
+
+            clone_call(prog, &stmt->u.call.func, &stmt->u.call.args);
+            break;
+
+        case ast_exp_listStmt:
+            for (exps = stmt->u.seq; exps; exps = exps->tail) {
+                clone_calls_exp(prog, exps->head);
+            }
+
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * The main body goes first, so that the clones it creates are appended to
+ * the functions before they are looked at. Clones are looked at like any other
+ * function, which specialises recursive calls that pass the constants
+ * through.
+ */
+void
+opt_clone(struct ast_program *prog)
+{
+    struct ast_fun_dec_list *p;
+    struct ast_var_dec_list *v;
+
+    _clone_budget = opt_stmt_list_size(prog->body);
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        _clone_budget += opt_stmt_list_size(p->head->body);
+    }
+
+    _clone_budget = _clone_budget * CLONE_GROWTH / 100;
+
+    if (_clone_budget < CLONE_MIN_BUDGET) {
+        _clone_budget = CLONE_MIN_BUDGET;
+    }
+
+    for (v = prog->global_var_def_list; v; v = v->tail) {
+        clone_calls_exp(prog, v->head->init);
+    }
+
+    clone_calls_stmt_list(prog, prog->body);
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        for (v = p->head->var; v; v = v->tail) {
+            clone_calls_exp(prog, v->head->init);
+        }
+
+        clone_calls_stmt_list(prog, p->head->body);
+    }
+
+    while (_clones != NULL) {
+        struct clone   *c = _clones;
+        _clones = c->next;
+        free(c);
+    }
+}
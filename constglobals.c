@@ -0,0 +1,112 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "opt.h"
+
+/**
+ * @returns 1 and sets @value if the global variable @dec is a constant, i.e.,
+ * it is initialised with a constant, it is not declared twice and it is never
+ * assigned or read outside the functions that shadow it
+ */
+static int      const_global(struct ast_program *prog, struct ast_var_dec *dec,
+                             int *value);
+
+static int
+const_global(struct ast_program *prog, struct ast_var_dec *dec, int *value)
+{
+    struct ast_var_dec_list *v;
+    struct ast_fun_dec_list *p;
+
+    if (!ast_const_value(dec->init, value)) {
+        return 0;
+    }
+
+    for (v = prog->global_var_def_list; v; v = v->tail) {
+        if (v->head != dec && v->head->sym == dec->sym) {
+            return 0;
+        }
+    }
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        if (!opt_is_local(p->head, dec->sym) &&
+                opt_writes_var(p->head->body, dec->sym)) {
+            return 0;
+        }
+    }
+
+    return !opt_writes_var(prog->body, dec->sym);
+}
+
+void
+opt_const_globals(struct ast_program *prog)
+{
+    struct ast_var_dec_list **p = &prog->global_var_def_list;
+    struct ast_var_dec_list *v;
+    struct ast_fun_dec_list *f;
+    int             value;
+
+    while (*p != NULL) {
+        struct ast_var_dec_list *node = *p;
+        struct ast_var_dec *dec = node->head;
+
+        if (!const_global(prog, dec, &value)) {
+            p = &node->tail;
+            continue;
+        }
+
+        // Later globals may be initialised with it
+        for (v = node->tail; v; v = v->tail) {
+            opt_subst_exp(v->head->init, dec->sym, value);
+        }
+
+        for (f = prog->func_def_list; f; f = f->tail) {
+            struct ast_field_list *param;
+            int             shadowed = 0;
+
+            for (param = f->head->params; param; param = param->tail) {
+                shadowed |= param->head->name == dec->sym;
+            }
+
+            // A local variable shadows it once declared, i.e., after its
+            // own initialisation
+            for (v = f->head->var; v && !shadowed; v = v->tail) {
+                opt_subst_exp(v->head->init, dec->sym, value);
+                shadowed = v->head->sym == dec->sym;
+            }
+
+            if (!shadowed) {
+                opt_subst_stmt_list(f->head->body, dec->sym, value);
+            }
+        }
+
+        opt_subst_stmt_list(prog->body, dec->sym, value);
+        *p = node->tail;
+        ast_free_exp(dec->init);
+        free(dec);
+        free(node);
+    }
+}
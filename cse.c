@@ -0,0 +1,354 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "opt.h"
+
+/**
+ * Limits of the common subexpression elimination, per straight-line region
+ */
+#define CSE_MAX_TEMPS 32
+
+/**
+ * An expression available in the current region
+ */
+struct cse_use {
+    struct ast_exp **slot;
+    struct cse_use *next;
+};
+
+struct cse_entry {
+    // Where it first appears and in which statement
+    struct ast_exp **first;
+    struct ast_stmt_list *at;
+    // Position of the statement in the region and of the expression in the
+    // statement, subexpressions first
+    int             stmt;
+    int             order;
+    // Number of instructions needed to evaluate it
+    int             cost;
+    // The other places where it appears
+    struct cse_use *uses;
+    int             count;
+    // Set when one of its variables is assigned. It is not available anymore.
+    int             killed;
+    struct cse_entry *next;
+};
+
+static struct cse_entry *_cse;
+static int      _cse_stmt;
+static int      _cse_order;
+
+/**
+ * The function being optimised, NULL in the main body
+ */
+static struct ast_fun_dec *_fun;
+
+/**
+ * Temporaries of the current function, reused from one region to the next
+ */
+static struct s_symbol *_cse_temps[CSE_MAX_TEMPS];
+static int      _cse_ntemps;
+
+/**
+ * @returns 1 if @exp reads a global variable
+ */
+static int      uses_global(struct ast_exp *exp);
+
+/**
+ * @returns the number of instructions evaluating @exp takes
+ */
+static int      exp_cost(struct ast_exp *exp);
+
+/**
+ * Records the expression in @slot and its subexpressions as available, or
+ * as a new use of an available expression
+ */
+static void     cse_scan(struct ast_exp **slot, struct ast_stmt_list *at);
+
+/**
+ * Marks the expressions that read @var as not available. If @var is NULL,
+ * i.e., after a call, marks the ones that read global variables.
+ */
+static void     cse_kill(struct s_symbol *var);
+
+/**
+ * Caches the expressions of the region that are worth it in temporaries and
+ * starts a new region
+ */
+static void     cse_flush(struct ast_var_dec_list **vars);
+
+/**
+ * Local common subexpression elimination in @list and the statements nested
+ * in it
+ */
+static void     cse_stmt_list(struct ast_stmt_list *list,
+                              struct ast_var_dec_list **vars);
+
+static int
+uses_global(struct ast_exp *exp)
+{
+    if (exp == NULL) {
+        return 0;
+    }
+
+    switch (exp->kind) {
+    case ast_varExp:
+        return !opt_is_local(_fun, exp->u.var);
+
+    case ast_opExp:
+        return uses_global(exp->u.op.left) || uses_global(exp->u.op.right);
+
+    default:
+        return 0;
+    }
+}
+
+static int
+exp_cost(struct ast_exp *exp)
+{
+    if (exp == NULL) {
+        return 0;
+    }
+
+    switch (exp->kind) {
+    case ast_opExp:
+        return exp_cost(exp->u.op.left) + exp_cost(exp->u.op.right) + 1;
+
+    default:
+        return 1;
+    }
+}
+
+static void
+cse_scan(struct ast_exp **slot, struct ast_stmt_list *at)
+{
+    struct ast_exp *exp = *slot;
+    struct cse_entry *e;
+
+    if (exp == NULL || exp->kind != ast_opExp) {
+        return;
+    }
+
+    for (e = _cse; e != NULL; e = e->next) {
+        if (!e->killed && opt_same_exp(*e->first, exp)) {
+            struct cse_use *use = malloc(sizeof(*use));
+            check_mem(use);
+            use->slot = slot;
+            use->next = e->uses;
+            e->uses = use;
+            ++e->count;
+            // Its subexpressions are not looked at: it is replaced as a whole
+            return;
+        }
+    }
+
+    cse_scan(&exp->u.op.left, at);
+    cse_scan(&exp->u.op.right, at);
+
+    e = malloc(sizeof(*e));
+    check_mem(e);
+    e->first = slot;
+    e->at = at;
+    e->stmt = _cse_stmt;
+    e->order = _cse_order++;
+    e->cost = exp_cost(exp);
+    e->uses = NULL;
+    e->count = 1;
+    e->killed = 0;
+    e->next = _cse;
+    _cse = e;
+    return;
+
+error:
+    panic();
+}
+
+static void
+cse_kill(struct s_symbol *var)
+{
+    struct cse_entry *e;
+
+    for (e = _cse; e != NULL; e = e->next) {
+        if (var == NULL ? uses_global(*e->first) :
+                opt_uses_var(*e->first, var)) {
+            e->killed = 1;
+        }
+    }
+}
+
+/**
+ * Without caching, an expression that costs c and appears n times takes n * c
+ * instructions. With caching it takes c + 1 (Store) + n (Load) instructions,
+ * plus one to initialise the temporary when the function is entered.
+ */
+static void
+cse_flush(struct ast_var_dec_list **vars)
+{
+    struct cse_entry *e;
+    int             ntemps = 0;
+
+    // _cse is sorted by decreasing (stmt, order), so the temporaries are
+    // inserted before their statement in reverse order, i.e., subexpressions
+    // come first in the end
+    for (e = _cse; e != NULL; e = e->next) {
+        if ((e->count - 1) * (e->cost - 1) <= 3 || ntemps == CSE_MAX_TEMPS) {
+            continue;
+        }
+
+        if (ntemps == _cse_ntemps) {
+            _cse_temps[_cse_ntemps++] = opt_new_temp((*e->first)->pos, vars);
+        }
+
+        struct s_symbol *t = _cse_temps[ntemps++];
+        struct ast_exp *exp = *e->first;
+        struct cse_use *use;
+
+        for (use = e->uses; use != NULL; use = use->next) {
+            struct ast_exp *old = *use->slot;
+            *use->slot = ast_new_var_exp(old->pos, t);
+            ast_free_exp(old);
+        }
+
+        *e->first = ast_new_var_exp(exp->pos, t);
+        // Inserts t = exp before the statement
+        e->at->tail = ast_new_stmt_list(e->at->head, e->at->tail);
+        e->at->head = ast_new_assign_stmt(exp->pos, t, exp);
+    }
+
+    while (_cse != NULL) {
+        e = _cse;
+        _cse = e->next;
+
+        while (e->uses != NULL) {
+            struct cse_use *use = e->uses;
+            e->uses = use->next;
+            free(use);
+        }
+
+        free(e);
+    }
+
+    _cse_stmt = 0;
+    _cse_order = 0;
+}
+
+static void
+cse_stmt_list(struct ast_stmt_list *list, struct ast_var_dec_list **vars)
+{
+    struct ast_exp_list *args;
+    int             calls;
+
+    for (; list; list = list->tail) {
+        struct ast_stmt *stmt = list->head;
+
+        ++_cse_stmt;
+
+        switch (stmt->kind) {
+        case ast_upStmt:
+        case ast_downStmt:
+            break;
+
+        case ast_readStmt:
+            cse_kill(stmt->u.read.var);
+            break;
+
+        case ast_moveStmt:
+            if (ast_has_call(stmt->u.move.exp1) ||
+                    ast_has_call(stmt->u.move.exp2)) {
+                cse_kill(NULL);
+                break;
+            }
+
+            cse_scan(&stmt->u.move.exp1, list);
+            cse_scan(&stmt->u.move.exp2, list);
+            break;
+
+        case ast_assignStmt:
+            if (ast_has_call(stmt->u.assign.exp)) {
+                cse_kill(NULL);
+            } else {
+                cse_scan(&stmt->u.assign.exp, list);
+            }
+
+            cse_kill(stmt->u.assign.var);
+            break;
+
+        case ast_callStmt:
+            calls = 0;
+
+            for (args = stmt->u.call.args; args; args = args->tail) {
+                calls |= ast_has_call(args->head);
+            }
+
+            // The arguments are evaluated before the call
+            for (args = stmt->u.call.args; !calls && args; args = args->tail) {
+                cse_scan(&args->head, list);
+            }
+
+            cse_kill(NULL);
+            break;
+
+        case ast_iftStmt:
+            cse_flush(vars);
+            cse_stmt_list(stmt->u.ift.then, vars);
+            break;
+
+        case ast_ifteStmt:
+            cse_flush(vars);
+            cse_stmt_list(stmt->u.ifte.then, vars);
+            cse_stmt_list(stmt->u.ifte.elsee, vars);
+            break;
+
+        case ast_whileStmt:
+            cse_flush(vars);
+            cse_stmt_list(stmt->u.whilee.body, vars);
+            break;
+
+        default:
+            cse_flush(vars);
+            break;
+        }
+    }
+
+    cse_flush(vars);
+}
+
+void
+opt_cse(struct ast_program *prog)
+{
+    struct ast_fun_dec_list *p;
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        _fun = p->head;
+        _cse_ntemps = 0;
+        cse_stmt_list(p->head->body, &p->head->var);
+    }
+
+    _fun = NULL;
+    _cse_ntemps = 0;
+    cse_stmt_list(prog->body, &prog->global_var_def_list);
+}
@@ -0,0 +1,367 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "opt.h"
+#include "pgo.h"
+
+/**
+ * The division loops that the branch profile does not show to run at least
+ * this many times per entry are left alone, as they are faster than the guard
+ * and the call to the helper. It must be a power of 2 so that 0x8000 /
+ * DIV_THRESHOLD is exact.
+ */
+#define DIV_THRESHOLD 16
+
+/**
+ * The runtime helper for division, NULL until a loop needs it
+ */
+static struct s_symbol *_div;
+
+/**
+ * Where the helper is defined, i.e., the position of the first loop that
+ * needs it
+ */
+static ast_pos  _div_pos;
+
+/**
+ * Recognises the division by repeated subtraction:
+ *
+ *      while (d < n) {
+ *          q = q + 1
+ *          n = n - d
+ *      }
+ *
+ * @returns 1 and sets @n, @q and @d if @stmt is such a loop
+ */
+static int      match_div_loop(struct ast_stmt *stmt, struct s_symbol **n,
+                               struct s_symbol **q, struct ast_exp **d);
+
+/**
+ * Puts a O(log n) shortcut in front of the division loop at the head of
+ * @list if the branch profile shows it to be long
+ */
+static void     rewrite_div_loop(struct ast_stmt_list *list,
+                                 struct ast_var_dec_list **vars);
+
+/**
+ * @returns the definition of the division helper
+ */
+static struct ast_fun_dec *new_div_fun(ast_pos pos);
+
+/**
+ * Finds division loops in @list and the statements nested in it. @vars is
+ * where temporaries are declared.
+ */
+static void     div_loops(struct ast_stmt_list *list,
+                          struct ast_var_dec_list **vars);
+
+static int
+match_div_loop(struct ast_stmt *stmt, struct s_symbol **n,
+               struct s_symbol **q, struct ast_exp **d)
+{
+    struct ast_exp *test;
+    struct ast_stmt_list *body;
+    struct ast_stmt *inc = NULL,
+                   *sub = NULL;
+
+    if (stmt->kind != ast_whileStmt) {
+        return 0;
+    }
+
+    test = stmt->u.whilee.test;
+    body = stmt->u.whilee.body;
+
+    if (test->kind != ast_opExp || test->u.op.oper != ast_LT ||
+            test->u.op.right->kind != ast_varExp) {
+        return 0;
+    }
+
+    *n = test->u.op.right->u.var;
+    *d = test->u.op.left;
+
+    // Exactly two assignments, in any order
+    if (body == NULL || body->tail == NULL || body->tail->tail != NULL ||
+            body->head->kind != ast_assignStmt ||
+            body->tail->head->kind != ast_assignStmt) {
+        return 0;
+    }
+
+    if (body->head->u.assign.var == *n) {
+        sub = body->head;
+        inc = body->tail->head;
+    } else {
+        inc = body->head;
+        sub = body->tail->head;
+    }
+
+    *q = inc->u.assign.var;
+
+    if (sub->u.assign.var != *n || *q == *n) {
+        return 0;
+    }
+
+    // n = n - d
+    struct ast_exp *e = sub->u.assign.exp;
+
+    if (e->kind != ast_opExp || e->u.op.oper != ast_minusOp ||
+            e->u.op.left->kind != ast_varExp ||
+            e->u.op.left->u.var != *n || !opt_same_exp(e->u.op.right, *d)) {
+        return 0;
+    }
+
+    // q = q + 1 or q = 1 + q
+    e = inc->u.assign.exp;
+
+    if (e->kind != ast_opExp || e->u.op.oper != ast_plusOp) {
+        return 0;
+    }
+
+    struct ast_exp *l = e->u.op.left,
+                   *r = e->u.op.right;
+
+    if (!((l->kind == ast_varExp && l->u.var == *q &&
+            r->kind == ast_intExp && r->u.intt == 1) ||
+            (r->kind == ast_varExp && r->u.var == *q &&
+             l->kind == ast_intExp && l->u.intt == 1))) {
+        return 0;
+    }
+
+    // d is evaluated more than once and must not change in the loop
+    return !ast_has_call(*d) && !opt_uses_var(*d, *n) && !opt_uses_var(*d, *q);
+}
+
+/**
+ * The loop is kept as it is, so that the results are the same in all cases,
+ * including the ones that overflow. When 0 < d and 0 <= n, d < n does not
+ * overflow and the loop runs k = (n - 1) / d times if d < n. The loops that
+ * the branch profile shows to be long are thus preceded by:
+ *
+ *      if (d * 16 < n) {
+ *          if (0 < d) {
+ *              if (d < 2048) {
+ *                  if (-1 < n) {
+ *                      t = __div(n - 1, d)
+ *                      q = q + t
+ *                      n = n - t * d
+ *                  }
+ *              }
+ *          }
+ *      }
+ *
+ * after which n <= d and the loop exits at once. The first test may overflow
+ * but it is the one that usually fails, and the others make sure it is right
+ * when all of them hold. The tests of a constant d are done here instead.
+ *
+ * The guard costs about ten steps on every entry, more than the loop saves
+ * if it is short, and there is no telling how long it is without a profile.
+ */
+static void
+rewrite_div_loop(struct ast_stmt_list *list, struct ast_var_dec_list **vars)
+{
+    struct ast_stmt *loop = list->head;
+    ast_pos         pos = loop->pos;
+    struct s_symbol *n,
+                   *q,
+                   *t;
+    struct ast_exp *d;
+    long long       taken,
+                    not_taken;
+    int             value;
+    int             known;
+
+    if (!match_div_loop(loop, &n, &q, &d)) {
+        return;
+    }
+
+    // The branch is taken once per iteration and not taken once per exit
+    if (!pgo_loaded() || !pgo_branch(pos, &taken, &not_taken) ||
+            taken < DIV_THRESHOLD * not_taken) {
+        return;
+    }
+
+    known = ast_const_value(d, &value);
+
+    if (known && (value <= 0 || value >= 0x8000 / DIV_THRESHOLD)) {
+        return;
+    }
+
+    if (_div == NULL) {
+        _div = s_new_symbol("__div");
+        _div_pos = pos;
+    }
+
+    t = opt_new_temp(pos, vars);
+
+    struct ast_stmt_list *fast =
+        ast_new_stmt_list(ast_new_assign_stmt(pos, t,
+            ast_new_call_exp(pos, _div,
+                ast_new_exp_list(ast_new_op_exp(pos, ast_minusOp,
+                                     ast_new_var_exp(pos, n),
+                                     ast_int_exp(pos, 1)),
+                ast_new_exp_list(ast_copy_exp(d), NULL)))),
+        ast_new_stmt_list(ast_new_assign_stmt(pos, q,
+            ast_new_op_exp(pos, ast_plusOp, ast_new_var_exp(pos, q),
+                           ast_new_var_exp(pos, t))),
+        ast_new_stmt_list(ast_new_assign_stmt(pos, n,
+            ast_new_op_exp(pos, ast_minusOp, ast_new_var_exp(pos, n),
+                ast_new_op_exp(pos, ast_timesOp, ast_new_var_exp(pos, t),
+                               ast_copy_exp(d)))),
+        NULL)));
+
+    struct ast_stmt_list *guard =
+        ast_new_stmt_list(ast_new_ift_stmt(pos,
+            ast_new_op_exp(pos, ast_LT,
+                ast_new_op_exp(pos, ast_negOp, ast_int_exp(pos, 1), NULL),
+                ast_new_var_exp(pos, n)),
+            fast), NULL);
+
+    if (!known) {
+        guard = ast_new_stmt_list(ast_new_ift_stmt(pos,
+            ast_new_op_exp(pos, ast_LT, ast_int_exp(pos, 0),
+                           ast_copy_exp(d)),
+            ast_new_stmt_list(ast_new_ift_stmt(pos,
+                ast_new_op_exp(pos, ast_LT, ast_copy_exp(d),
+                               ast_int_exp(pos, 0x8000 / DIV_THRESHOLD)),
+                guard), NULL)), NULL);
+    }
+
+    list->head = ast_new_ift_stmt(pos,
+        ast_new_op_exp(pos, ast_LT,
+            known ? ast_int_exp(pos, value * DIV_THRESHOLD) :
+                    ast_new_op_exp(pos, ast_timesOp, ast_copy_exp(d),
+                                   ast_int_exp(pos, DIV_THRESHOLD)),
+            ast_new_var_exp(pos, n)),
+        guard);
+    list->tail = ast_new_stmt_list(loop, list->tail);
+}
+
+/**
+ * fun __div(m, d)     // m / d, for 0 < d <= m
+ *     var q = 0
+ * {
+ *     if (m - d < d) { return 1 }
+ *     q = 2 * __div(m, d + d)
+ *     if (m - q * d < d) { return q }
+ *     return q + 1
+ * }
+ *
+ * d + d is only computed when it is not greater than m, so nothing overflows
+ * and the recursion is at most 15 calls deep.
+ */
+static struct ast_fun_dec *
+new_div_fun(ast_pos pos)
+{
+    struct s_symbol *m = s_new_symbol("__m");
+    struct s_symbol *d = s_new_symbol("__d");
+    struct s_symbol *q = s_new_symbol("__q");
+
+#define VAR(s) ast_new_var_exp(pos, (s))
+#define INT(i) ast_int_exp(pos, (i))
+#define OP(o, l, r) ast_new_op_exp(pos, (o), (l), (r))
+#define RETURN(e) ast_new_stmt_list(ast_new_return_stmt(pos, (e)), NULL)
+
+    struct ast_stmt_list *body =
+        ast_new_stmt_list(ast_new_ift_stmt(pos,
+            OP(ast_LT, OP(ast_minusOp, VAR(m), VAR(d)), VAR(d)),
+            RETURN(INT(1))),
+        ast_new_stmt_list(ast_new_assign_stmt(pos, q,
+            OP(ast_timesOp, INT(2), ast_new_call_exp(pos, _div,
+                ast_new_exp_list(VAR(m),
+                ast_new_exp_list(OP(ast_plusOp, VAR(d), VAR(d)), NULL))))),
+        ast_new_stmt_list(ast_new_ift_stmt(pos,
+            OP(ast_LT, OP(ast_minusOp, VAR(m), OP(ast_timesOp, VAR(q), VAR(d))),
+               VAR(d)),
+            RETURN(VAR(q))),
+        RETURN(OP(ast_plusOp, VAR(q), INT(1))))));
+
+#undef VAR
+#undef INT
+#undef OP
+#undef RETURN
+
+    return ast_new_fundec(pos, _div,
+                          ast_new_field_list(ast_new_field(pos, m),
+                          ast_new_field_list(ast_new_field(pos, d), NULL)),
+                          ast_new_var_dec_list(ast_new_var_dec(pos, q,
+                                                   ast_int_exp(pos, 0)),
+                                               NULL),
+                          body);
+}
+
+static void
+div_loops(struct ast_stmt_list *list, struct ast_var_dec_list **vars)
+{
+    for (; list; list = list->tail) {
+        struct ast_stmt *stmt = list->head;
+
+        switch (stmt->kind) {
+        case ast_iftStmt:
+            div_loops(stmt->u.ift.then, vars);
+            break;
+
+        case ast_ifteStmt:
+            div_loops(stmt->u.ifte.then, vars);
+            div_loops(stmt->u.ifte.elsee, vars);
+            break;
+
+        case ast_whileStmt:
+            div_loops(stmt->u.whilee.body, vars);
+            // The loop is moved to the next node if it is rewritten, which
+            // is then skipped
+            rewrite_div_loop(list, vars);
+
+            if (list->head != stmt) {
+                list = list->tail;
+            }
+
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+void
+opt_div(struct ast_program *prog)
+{
+    struct ast_fun_dec_list *p;
+    struct ast_fun_dec_list **last = &prog->func_def_list;
+
+    _div = NULL;
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        div_loops(p->head->body, &p->head->var);
+        last = &p->tail;
+    }
+
+    div_loops(prog->body, &prog->global_var_def_list);
+
+    if (_div != NULL) {
+        *last = ast_new_fundec_list(new_div_fun(_div_pos), NULL);
+    }
+}
@@ -0,0 +1,692 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+
+#include "global.h"
+#include "eval.h"
+#include "instruction.h"
+#include "pass.h"
+
+/**
+ * Limits of an evaluation: number of expressions and statements evaluated,
+ * depth of the calls and words of code generated for the plot
+ */
+#define EVAL_STEPS 2000000
+#define EVAL_PURE_STEPS 100000
+#define EVAL_MAX_DEPTH 256
+#define EVAL_MAX_WORDS 16384
+
+/**
+ * Outcome of evaluating statements
+ */
+enum eval_status {
+    eval_fail = -1,
+    eval_ok,
+    eval_return,
+};
+
+struct binding {
+    struct s_symbol *sym;
+    int             value;
+};
+
+/**
+ * Variables of a scope, in the order they are declared
+ */
+struct frame {
+    struct binding *vars;
+    int             count;
+    int             capacity;
+};
+
+enum eval_kind {
+    eval_up,
+    eval_down,
+    eval_move,
+};
+
+struct event {
+    enum eval_kind  kind;
+    int             x;
+    int             y;
+    ast_pos         pos;
+};
+
+static struct ast_program *_prog;
+static struct frame _globals;
+static long     _steps;
+static int      _depth;
+
+/**
+ * In a pure evaluation, plotting, reading and global variables are failures
+ */
+static int      _pure;
+
+static struct event *_events;
+static int      _nevents;
+static int      _events_capacity;
+
+/**
+ * Words of code needed to replay the events
+ */
+static int      _words;
+
+/**
+ * State of the pen after the events, to leave out the redundant ones
+ */
+static int      _pen_down;
+static int      _pen_x;
+static int      _pen_y;
+
+static int      bind(struct frame *f, struct s_symbol *sym, int value);
+
+/**
+ * @returns the variable @sym as seen from @f (NULL in the main body), or NULL
+ * if it is not defined or not allowed
+ */
+static int     *lookup(struct frame *f, struct s_symbol *sym);
+
+static int      record(enum eval_kind kind, int x, int y, ast_pos pos);
+
+static int      eval_exp(struct ast_exp *exp, struct frame *f, int *value);
+
+/**
+ * Evaluates the test of an if statement (@lowered) or of a while statement.
+ * Operators other than == and < are rewritten like semant.c does.
+ */
+static int      eval_test(struct ast_exp *test, struct frame *f, int lowered,
+                          int *holds);
+
+static int      eval_call(struct s_symbol *name, struct ast_exp_list *args,
+                          struct frame *f, int *value);
+
+/**
+ * Calls the function @fun with the values in @args
+ */
+static int      eval_fun(struct ast_fun_dec *fun, int *args, int count,
+                         int *value);
+
+static enum eval_status eval_stmt_list(struct ast_stmt_list *list,
+                                       struct frame *f, int *ret);
+
+static void     reset(struct ast_program *prog, int pure, long steps);
+
+static int
+bind(struct frame *f, struct s_symbol *sym, int value)
+{
+    if (f->count == f->capacity) {
+        f->capacity = f->capacity ? 2 * f->capacity : 8;
+        f->vars = realloc(f->vars, f->capacity * sizeof(*f->vars));
+        check_mem(f->vars);
+    }
+
+    f->vars[f->count].sym = sym;
+    f->vars[f->count].value = value;
+    ++f->count;
+    return 0;
+
+error:
+    return -1;
+}
+
+static int     *
+lookup(struct frame *f, struct s_symbol *sym)
+{
+    int             i;
+
+    if (f != NULL) {
+        for (i = 0; i < f->count; ++i) {
+            if (f->vars[i].sym == sym) {
+                return &f->vars[i].value;
+            }
+        }
+    }
+
+    if (_pure) {
+        return NULL;
+    }
+
+    for (i = 0; i < _globals.count; ++i) {
+        if (_globals.vars[i].sym == sym) {
+            return &_globals.vars[i].value;
+        }
+    }
+
+    return NULL;
+}
+
+static int
+record(enum eval_kind kind, int x, int y, ast_pos pos)
+{
+    if (_pure) {
+        return -1;
+    }
+
+    if (pass_enabled("pen") &&
+            ((kind == eval_up && !_pen_down) ||
+             (kind == eval_down && _pen_down) ||
+             (kind == eval_move && x == _pen_x && y == _pen_y))) {
+        return 0;
+    }
+
+    if (kind == eval_move) {
+        _pen_x = x;
+        _pen_y = y;
+    } else {
+        _pen_down = kind == eval_down;
+    }
+
+    // Loadi x; Loadi y; Move or Up or Down
+    _words += kind == eval_move ? 5 : 1;
+
+    if (_words > EVAL_MAX_WORDS) {
+        return -1;
+    }
+
+    if (_nevents == _events_capacity) {
+        _events_capacity = _events_capacity ? 2 * _events_capacity : 64;
+        _events = realloc(_events, _events_capacity * sizeof(*_events));
+        check_mem(_events);
+    }
+
+    _events[_nevents].kind = kind;
+    _events[_nevents].x = x;
+    _events[_nevents].y = y;
+    _events[_nevents].pos = pos;
+    ++_nevents;
+    return 0;
+
+error:
+    return -1;
+}
+
+static int
+eval_exp(struct ast_exp *exp, struct frame *f, int *value)
+{
+    int             l,
+                    r;
+    int            *p;
+
+    if (++_steps >= 0 || exp == NULL) {
+        return -1;
+    }
+
+    switch (exp->kind) {
+    case ast_varExp:
+        if ((p = lookup(f, exp->u.var)) == NULL) {
+            return -1;
+        }
+
+        *value = *p;
+        return 0;
+
+    case ast_intExp:
+        *value = (int16_t) exp->u.intt;
+        return 0;
+
+    case ast_callExp:
+        return eval_call(exp->u.call.func, exp->u.call.args, f, value);
+
+    case ast_opExp:
+        if (eval_exp(exp->u.op.left, f, &l) != 0) {
+            return -1;
+        }
+
+        if (exp->u.op.oper == ast_negOp) {
+            *value = (int16_t) -l;
+            return 0;
+        }
+
+        if (eval_exp(exp->u.op.right, f, &r) != 0) {
+            return -1;
+        }
+
+        switch (exp->u.op.oper) {
+        case ast_plusOp:
+            *value = (int16_t) (l + r);
+            return 0;
+
+        case ast_minusOp:
+            *value = (int16_t) (l - r);
+            return 0;
+
+        case ast_timesOp:
+            *value = (int16_t) (l * r);
+            return 0;
+
+        default:
+            return -1;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * The machine compares with Sub and Test, so a < b is (a - b) < 0 after the
+ * subtraction wraps around
+ */
+static int
+eval_test(struct ast_exp *test, struct frame *f, int lowered, int *holds)
+{
+    struct ast_exp *left,
+                   *right,
+                   *first,
+                   *second;
+    int             l,
+                    r;
+
+    if (test->kind != ast_opExp || test->u.op.oper < ast_EQ) {
+        return -1;
+    }
+
+    left = test->u.op.left;
+    right = test->u.op.right;
+    ast_operand_order(test, &first, &second);
+
+    if (eval_exp(first, f, first == left ? &l : &r) != 0 ||
+            eval_exp(second, f, second == left ? &l : &r) != 0) {
+        return -1;
+    }
+
+    switch (test->u.op.oper) {
+    case ast_EQ:
+        *holds = (int16_t) (l - r) == 0;
+        return 0;
+
+    case ast_LT:
+        *holds = (int16_t) (l - r) < 0;
+        return 0;
+
+    default:
+        break;
+    }
+
+    // The other operators only exist in if statements. <= and >= evaluate
+    // their operands twice, which only matters if they call functions.
+    if (!lowered || ((test->u.op.oper == ast_LEQ ||
+                      test->u.op.oper == ast_GEQ) &&
+                     (ast_has_call(left) || ast_has_call(right)))) {
+        return -1;
+    }
+
+    switch (test->u.op.oper) {
+    case ast_NEQ:
+        *holds = (int16_t) (l - r) != 0;
+        return 0;
+
+    case ast_GT:
+        *holds = (int16_t) (r - l) < 0;
+        return 0;
+
+    case ast_LEQ:
+        *holds = (int16_t) (l - r) <= 0;
+        return 0;
+
+    case ast_GEQ:
+        *holds = (int16_t) (r - l) <= 0;
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+static int
+eval_call(struct s_symbol *name, struct ast_exp_list *args, struct frame *f,
+          int *value)
+{
+    struct ast_fun_dec_list *p;
+    struct ast_fun_dec *fun = NULL;
+    int             values[256];
+    int             count = 0;
+
+    for (p = _prog->func_def_list; p; p = p->tail) {
+        if (p->head->name == name) {
+            // Defined twice: semant.c rejects the program
+            if (fun != NULL) {
+                return -1;
+            }
+
+            fun = p->head;
+        }
+    }
+
+    if (fun == NULL) {
+        return -1;
+    }
+
+    for (; args; args = args->tail) {
+        if (count == 256 || eval_exp(args->head, f, values + count) != 0) {
+            return -1;
+        }
+
+        ++count;
+    }
+
+    return eval_fun(fun, values, count, value);
+}
+
+static int
+eval_fun(struct ast_fun_dec *fun, int *args, int count, int *value)
+{
+    struct frame    frame = { NULL, 0, 0 };
+    struct ast_field_list *param;
+    struct ast_var_dec_list *v;
+    int             i = 0;
+    int             init;
+    int             status = -1;
+
+    if (_depth >= EVAL_MAX_DEPTH) {
+        return -1;
+    }
+
+    ++_depth;
+
+    for (param = fun->params; param; param = param->tail, ++i) {
+        if (i >= count || lookup(&frame, param->head->name) != NULL ||
+                bind(&frame, param->head->name, args[i]) != 0) {
+            goto out;
+        }
+    }
+
+    if (i != count) {
+        goto out;
+    }
+
+    for (v = fun->var; v; v = v->tail) {
+        // The variable is declared after its initialisation
+        if (eval_exp(v->head->init, &frame, &init) != 0) {
+            goto out;
+        }
+
+        for (i = 0; i < frame.count; ++i) {
+            if (frame.vars[i].sym == v->head->sym) {
+                goto out;
+            }
+        }
+
+        if (bind(&frame, v->head->sym, init) != 0) {
+            goto out;
+        }
+    }
+
+    // The return value is 0 unless a return statement sets it
+    *value = 0;
+
+    if (eval_stmt_list(fun->body, &frame, value) != eval_fail) {
+        status = 0;
+    }
+
+out:
+    --_depth;
+    free(frame.vars);
+    return status;
+}
+
+static enum eval_status
+eval_stmt_list(struct ast_stmt_list *list, struct frame *f, int *ret)
+{
+    int             x,
+                    y,
+                    holds;
+    int            *p;
+    enum eval_status status;
+    struct ast_exp_list *exps;
+
+    for (; list; list = list->tail) {
+        struct ast_stmt *stmt = list->head;
+
+        if (++_steps >= 0) {
+            return eval_fail;
+        }
+
+        switch (stmt->kind) {
+        case ast_upStmt:
+            if (record(eval_up, 0, 0, stmt->pos) != 0) {
+                return eval_fail;
+            }
+
+            break;
+
+        case ast_downStmt:
+            if (record(eval_down, 0, 0, stmt->pos) != 0) {
+                return eval_fail;
+            }
+
+            break;
+
+        case ast_moveStmt:
+            if (eval_exp(stmt->u.move.exp1, f, &x) != 0 ||
+                    eval_exp(stmt->u.move.exp2, f, &y) != 0 ||
+                    record(eval_move, x, y, stmt->pos) != 0) {
+                return eval_fail;
+            }
+
+            break;
+
+        case ast_readStmt:
+            return eval_fail;
+
+        case ast_assignStmt:
+            if (eval_exp(stmt->u.assign.exp, f, &x) != 0 ||
+                    (p = lookup(f, stmt->u.assign.var)) == NULL) {
+                return eval_fail;
+            }
+
+            *p = x;
+            break;
+
+        case ast_iftStmt:
+            if (eval_test(stmt->u.ift.test, f, 1, &holds) != 0) {
+                return eval_fail;
+            }
+
+            if (holds) {
+                status = eval_stmt_list(stmt->u.ift.then, f, ret);
+
+                if (status != eval_ok) {
+                    return status;
+                }
+            }
+
+            break;
+
+        case ast_ifteStmt:
+            if (eval_test(stmt->u.ifte.test, f, 1, &holds) != 0) {
+                return eval_fail;
+            }
+
+            status = eval_stmt_list(holds ? stmt->u.ifte.then :
+                                    stmt->u.ifte.elsee, f, ret);
+
+            if (status != eval_ok) {
+                return status;
+            }
+
+            break;
+
+        case ast_whileStmt:
+            for (;;) {
+                if (eval_test(stmt->u.whilee.test, f, 0, &holds) != 0) {
+                    return eval_fail;
+                }
+
+                if (!holds) {
+                    break;
+                }
+
+                status = eval_stmt_list(stmt->u.whilee.body, f, ret);
+
+                if (status != eval_ok) {
+                    return status;
+                }
+            }
+
+            break;
+
+        case ast_returnStmt:
+            // Only in functions
+            if (f == NULL || eval_exp(stmt->u.returnn.exp, f, ret) != 0) {
+                return eval_fail;
+            }
+
+            return eval_return;
+
+        case ast_callStmt:
+            if (eval_call(stmt->u.call.func, stmt->u.call.args, f, &x) != 0) {
+                return eval_fail;
+            }
+
+            break;
+
+        case ast_exp_listStmt:
+            for (exps = stmt->u.seq; exps; exps = exps->tail) {
+                if (eval_exp(exps->head, f, &x) != 0) {
+                    return eval_fail;
+                }
+            }
+
+            break;
+
+        default:
+            return eval_fail;
+        }
+    }
+
+    return eval_ok;
+}
+
+/**
+ * The step counter counts up from -@steps, so that the evaluation gives up
+ * when it reaches 0
+ */
+static void
+reset(struct ast_program *prog, int pure, long steps)
+{
+    _prog = prog;
+    _pure = pure;
+    _steps = -steps;
+    _depth = 0;
+}
+
+int
+eval_prog(struct ast_program *prog)
+{
+    struct ast_var_dec_list *v;
+    int             value;
+    int             status = -1;
+
+    reset(prog, 0, EVAL_STEPS);
+    _globals.count = 0;
+    _nevents = 0;
+    _words = 1; // Halt
+    // The machine starts with the pen up at (0, 0)
+    _pen_down = 0;
+    _pen_x = 0;
+    _pen_y = 0;
+
+    // The functions are not defined yet when the global variables are
+    // initialised
+    for (v = prog->global_var_def_list; v; v = v->tail) {
+        if (ast_has_call(v->head->init) ||
+                eval_exp(v->head->init, NULL, &value) != 0 ||
+                lookup(NULL, v->head->sym) != NULL ||
+                bind(&_globals, v->head->sym, value) != 0) {
+            goto out;
+        }
+    }
+
+    if (eval_stmt_list(prog->body, NULL, &value) == eval_ok) {
+        status = 0;
+    }
+
+out:
+    free(_globals.vars);
+    _globals.vars = NULL;
+    _globals.count = 0;
+    _globals.capacity = 0;
+    return status;
+}
+
+void
+eval_emit(void)
+{
+    discard_code(0);
+    gen_set_owner("(main)");
+
+    for (int i = 0; i < _nevents; ++i) {
+        gen_set_pos(_events[i].pos);
+
+        switch (_events[i].kind) {
+        case eval_up:
+            gen_Up();
+            break;
+
+        case eval_down:
+            gen_Down();
+            break;
+
+        case eval_move:
+            gen_Loadi(_events[i].x);
+            gen_Loadi(_events[i].y);
+            gen_Move();
+            break;
+        }
+    }
+
+    gen_Halt();
+    free(_events);
+    _events = NULL;
+    _nevents = 0;
+    _events_capacity = 0;
+}
+
+int
+eval_pure_call(struct ast_program *prog, struct s_symbol *name, int *args,
+               int count, int *value)
+{
+    struct ast_fun_dec_list *p;
+    struct ast_fun_dec *fun = NULL;
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        if (p->head->name == name) {
+            if (fun != NULL) {
+                return 0;
+            }
+
+            fun = p->head;
+        }
+    }
+
+    if (fun == NULL) {
+        return 0;
+    }
+
+    reset(prog, 1, EVAL_PURE_STEPS);
+    return eval_fun(fun, args, count, value) == 0;
+}
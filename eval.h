@@ -0,0 +1,63 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Compile-time evaluation
+ *
+ * Runs turtle programs, or parts of them, while compiling. A program that
+ * never reads its input always plots the same thing, so it can be replaced by
+ * the plot itself. Likewise, a call to a pure function with constant
+ * arguments can be replaced by its result.
+ */
+
+#ifndef EVAL_H_
+#define EVAL_H_
+
+#include "absyn.h"
+
+/**
+ * Runs @prog and records what it plots
+ *
+ * @returns 0 on success, -1 if the program reads its input, fails, runs for
+ * too long or plots too much
+ */
+int eval_prog(struct ast_program *prog);
+
+/**
+ * Replaces the generated code with the plot recorded by eval_prog()
+ */
+void eval_emit(void);
+
+/**
+ * Calls the function @name of @prog with the @count values in @args
+ *
+ * @returns 1 and sets @value if the function returns without plotting,
+ * reading, or touching global variables, 0 otherwise
+ */
+int eval_pure_call(struct ast_program *prog, struct s_symbol *name,
+                   int *args, int count, int *value);
+
+#endif /* end of include guard: EVAL_H_ */
@@ -0,0 +1,165 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "eval.h"
+#include "opt.h"
+
+/**
+ * Replaces the calls to pure functions with constant arguments in @exp,
+ * @list or the statements nested in it with their results
+ */
+static void     fold_calls_exp(struct ast_program *prog, struct ast_exp *exp);
+static void     fold_calls_stmt_list(struct ast_program *prog,
+                                     struct ast_stmt_list *list);
+
+static void
+fold_calls_exp(struct ast_program *prog, struct ast_exp *exp)
+{
+    struct ast_exp_list *args;
+    int             values[16];
+    int             count = 0;
+    int             value;
+
+    if (exp == NULL) {
+        return;
+    }
+
+    switch (exp->kind) {
+    case ast_callExp:
+        for (args = exp->u.call.args; args; args = args->tail) {
+            fold_calls_exp(prog, args->head);
+
+            if (count < 16 && args->head->kind == ast_intExp) {
+                values[count] = args->head->u.intt;
+            }
+
+            ++count;
+        }
+
+        for (args = exp->u.call.args; args; args = args->tail) {
+            if (args->head->kind != ast_intExp) {
+                return;
+            }
+        }
+
+        if (count > 16 || !eval_pure_call(prog, exp->u.call.func, values,
+                                          count, &value)) {
+            return;
+        }
+
+        ast_free_exp_list(exp->u.call.args);
+        exp->kind = ast_intExp;
+        exp->u.intt = value;
+        break;
+
+    case ast_opExp:
+        fold_calls_exp(prog, exp->u.op.left);
+        fold_calls_exp(prog, exp->u.op.right);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void
+fold_calls_stmt_list(struct ast_program *prog, struct ast_stmt_list *list)
+{
+    struct ast_exp_list *exps;
+
+    for (; list; list = list->tail) {
+        struct ast_stmt *stmt = list->head;
+
+        switch (stmt->kind) {
+        case ast_moveStmt:
+            fold_calls_exp(prog, stmt->u.move.exp1);
+            fold_calls_exp(prog, stmt->u.move.exp2);
+            break;
+
+        case ast_assignStmt:
+            fold_calls_exp(prog, stmt->u.assign.exp);
+            break;
+
+        case ast_iftStmt:
+            fold_calls_exp(prog, stmt->u.ift.test);
+            fold_calls_stmt_list(prog, stmt->u.ift.then);
+            break;
+
+        case ast_ifteStmt:
+            fold_calls_exp(prog, stmt->u.ifte.test);
+            fold_calls_stmt_list(prog, stmt->u.ifte.then);
+            fold_calls_stmt_list(prog, stmt->u.ifte.elsee);
+            break;
+
+        case ast_whileStmt:
+            fold_calls_exp(prog, stmt->u.whilee.test);
+            fold_calls_stmt_list(prog, stmt->u.whilee.body);
+            break;
+
+        case ast_returnStmt:
+            fold_calls_exp(prog, stmt->u.returnn.exp);
+            break;
+
+        case ast_callStmt:
+            // The result is dropped, so a pure call does nothing
+            for (exps = stmt->u.call.args; exps; exps = exps->tail) {
+                fold_calls_exp(prog, exps->head);
+            }
+
+            break;
+
+        case ast_exp_listStmt:
+            for (exps = stmt->u.seq; exps; exps = exps->tail) {
+                fold_calls_exp(prog, exps->head);
+            }
+
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+void
+opt_fold_calls(struct ast_program *prog)
+{
+    struct ast_var_dec_list *v;
+    struct ast_fun_dec_list *p;
+
+    // Not the initialisations of the global variables: the functions are not
+    // defined yet, so the calls there are errors
+    for (p = prog->func_def_list; p; p = p->tail) {
+        for (v = p->head->var; v; v = v->tail) {
+            fold_calls_exp(prog, v->head->init);
+        }
+
+        fold_calls_stmt_list(prog, p->head->body);
+    }
+
+    fold_calls_stmt_list(prog, prog->body);
+}
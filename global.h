@@ -57,7 +57,10 @@ void panic(void);
 
 extern int sflag; // -S flag
 extern int lflag; // -d flag
+extern int rflag; // -r flag
+extern int oflag; // -O level
 extern FILE *fout; // stderr or an output file
+extern FILE *fmap; // source map file (-m) or NULL
 
 /**
  * The following functions are used to reduce the amount of memory leak. They
@@ -0,0 +1,611 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// For accept4()
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "host.h"
+
+static int
+set_nonblocking(int fd)
+{
+    int             flags = fcntl(fd, F_GETFL);
+
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void
+enqueue(struct host *h, struct host_session *s)
+{
+    if (s->queued) {
+        return;
+    }
+
+    s->queued = 1;
+    s->next = NULL;
+
+    if (h->tail != NULL) {
+        h->tail->next = s;
+    } else {
+        h->head = s;
+    }
+
+    h->tail = s;
+}
+
+static void
+unqueue(struct host *h, struct host_session *s)
+{
+    struct host_session *prev = NULL;
+
+    if (!s->queued) {
+        return;
+    }
+
+    for (struct host_session *q = h->head; q != s; q = q->next) {
+        prev = q;
+    }
+
+    if (prev != NULL) {
+        prev->next = s->next;
+    } else {
+        h->head = s->next;
+    }
+
+    if (h->tail == s) {
+        h->tail = prev;
+    }
+
+    s->queued = 0;
+}
+
+static struct host_session *
+dequeue(struct host *h)
+{
+    struct host_session *s = h->head;
+
+    if (s != NULL) {
+        h->head = s->next;
+
+        if (h->head == NULL) {
+            h->tail = NULL;
+        }
+
+        s->queued = 0;
+    }
+
+    return s;
+}
+
+static int
+finished(const struct host_session *s)
+{
+    return s->status == vm_halted || s->status == vm_error;
+}
+
+static int
+output_pending(const struct host_session *s)
+{
+    return s->out_sent < s->out_len;
+}
+
+/**
+ * Pen callback: appends the event to the plot stream of the session
+ */
+static void
+host_pen(void *data, enum vm_pen_event event, int x, int y)
+{
+    struct host_session *s = data;
+
+    if (s->out_capacity - s->out_len < 32) {
+        size_t          capacity = s->out_capacity ? 2 * s->out_capacity : 4096;
+        char           *out = realloc(s->out, capacity);
+
+        if (out == NULL) {
+            log_err("Out of memory, the plot stream is cut");
+            return;
+        }
+
+        s->out = out;
+        s->out_capacity = capacity;
+    }
+
+    switch (event) {
+    case vm_pen_up:
+        s->out_len += sprintf(s->out + s->out_len, "Up\n");
+        break;
+
+    case vm_pen_down:
+        s->out_len += sprintf(s->out + s->out_len, "Down\n");
+        break;
+
+    case vm_pen_move:
+        s->out_len += sprintf(s->out + s->out_len, "Move %d %d\n", x, y);
+        break;
+    }
+}
+
+static void
+close_session(struct host *h, struct host_session *s)
+{
+    if (s->closed) {
+        return;
+    }
+
+    unqueue(h, s);
+
+    if (s->prev_all != NULL) {
+        s->prev_all->next_all = s->next_all;
+    } else {
+        h->sessions = s->next_all;
+    }
+
+    if (s->next_all != NULL) {
+        s->next_all->prev_all = s->prev_all;
+    }
+
+    close(s->in_fd);
+
+    if (s->out_fd != s->in_fd) {
+        close(s->out_fd);
+    }
+
+    free(s->vm);
+    free(s->input);
+    free(s->out);
+    s->closed = 1;
+    s->next = h->dead;
+    h->dead = s;
+    --h->nsessions;
+}
+
+/**
+ * Watches the descriptors of @s for what it waits for: input while its
+ * machine waits for some, and room for its plot stream
+ */
+static int
+update(struct host *h, struct host_session *s)
+{
+    struct epoll_event ev;
+    int             want_in = !s->eof && s->status == vm_waiting;
+    int             want_out = output_pending(s);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.ptr = &s->watch_in;
+    ev.events = want_in ? EPOLLIN : 0;
+
+    if (s->out_fd == s->in_fd) {
+        ev.events |= want_out ? EPOLLOUT : 0;
+        return epoll_ctl(h->epoll_fd, EPOLL_CTL_MOD, s->in_fd, &ev);
+    }
+
+    check(epoll_ctl(h->epoll_fd, EPOLL_CTL_MOD, s->in_fd, &ev) == 0,
+          "Cannot watch the input of a session");
+    ev.data.ptr = &s->watch_out;
+    ev.events = want_out ? EPOLLOUT : 0;
+    return epoll_ctl(h->epoll_fd, EPOLL_CTL_MOD, s->out_fd, &ev);
+
+error:
+    return -1;
+}
+
+/**
+ * Writes as much of the plot stream of @s as its descriptor takes
+ *
+ * @returns 0, or -1 if it cannot be written at all
+ */
+static int
+flush(struct host_session *s)
+{
+    while (output_pending(s)) {
+        ssize_t         n = write(s->out_fd, s->out + s->out_sent,
+                                  s->out_len - s->out_sent);
+
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+
+        s->out_sent += n;
+    }
+
+    s->out_len = s->out_sent = 0;
+    return 0;
+}
+
+/**
+ * Gives the values in @s->partial to the machine of @s
+ *
+ * @returns 0, or -1 if they are not a number
+ */
+static int
+take_number(struct host_session *s)
+{
+    struct vm      *vm = s->vm;
+    char           *end;
+    long            v;
+
+    if (s->partial_len == 0) {
+        return 0;
+    }
+
+    s->partial[s->partial_len] = '\0';
+    s->partial_len = 0;
+    v = strtol(s->partial, &end, 10);
+    check(*end == '\0' && end != s->partial, "Not a number: %s", s->partial);
+
+    // Reuses the values already read
+    if (vm->input_used > 0) {
+        memmove(s->input, s->input + vm->input_used,
+                (vm->input_size - vm->input_used) * sizeof(*s->input));
+        vm->input_size -= vm->input_used;
+        vm->input_used = 0;
+    }
+
+    if (vm->input_size == s->input_capacity) {
+        int             capacity = s->input_capacity ?
+            2 * s->input_capacity : 16;
+        int            *input = realloc(s->input, capacity * sizeof(*input));
+
+        check_mem(input);
+        s->input = input;
+        s->input_capacity = capacity;
+        vm->input = input;
+    }
+
+    s->input[vm->input_size++] = (int) v;
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * Reads what is available on the input of @s
+ *
+ * @returns 0, or -1 if the input is not made of numbers
+ */
+static int
+receive(struct host_session *s)
+{
+    char            buf[4096];
+    ssize_t         n;
+
+    while ((n = read(s->in_fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; ++i) {
+            char            c = buf[i];
+
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                check(take_number(s) == 0, "Bad input");
+            } else {
+                check(s->partial_len + 1 < (int) sizeof(s->partial),
+                      "Bad input");
+                s->partial[s->partial_len++] = c;
+            }
+        }
+    }
+
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        s->eof = 1;
+        check(take_number(s) == 0, "Bad input");
+    }
+
+    return 0;
+
+error:
+    s->eof = 1;
+    return -1;
+}
+
+/**
+ * Runs the machine of @s for a quantum, then decides what the session waits
+ * for
+ */
+static void
+run_session(struct host *h, struct host_session *s)
+{
+    struct vm      *vm = s->vm;
+
+    vm->step_limit = vm->steps + HOST_QUANTUM;
+    s->status = vm_run(vm);
+
+    if (s->status == vm_waiting && s->eof) {
+        log_err("No more input at %d", vm->pc);
+        s->status = vm_error;
+    }
+
+    if (flush(s) != 0 || (finished(s) && !output_pending(s))) {
+        close_session(h, s);
+        return;
+    }
+
+    if (s->status == vm_running && s->out_len < HOST_OUTPUT_MAX) {
+        enqueue(h, s);
+    }
+
+    if (update(h, s) != 0) {
+        log_err("Cannot watch a session");
+        close_session(h, s);
+    }
+}
+
+static void
+handle(struct host *h, struct host_watch *w, uint32_t events)
+{
+    struct host_session *s = w->session;
+
+    if (s->closed) {
+        return;
+    }
+
+    if (!w->output && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        if (receive(s) != 0) {
+            s->status = vm_error;
+        } else if (s->status == vm_waiting) {
+            enqueue(h, s);
+        }
+    }
+
+    if ((w->output || s->out_fd == s->in_fd) &&
+            (events & (EPOLLOUT | EPOLLERR))) {
+        if (flush(s) != 0) {
+            close_session(h, s);
+            return;
+        }
+
+        if (s->status == vm_running && s->out_len < HOST_OUTPUT_MAX) {
+            enqueue(h, s);
+        }
+    }
+
+    if (finished(s) && !output_pending(s)) {
+        close_session(h, s);
+    } else if (update(h, s) != 0) {
+        log_err("Cannot watch a session");
+        close_session(h, s);
+    }
+}
+
+struct host    *
+host_new(const struct vm_image *image)
+{
+    struct host    *h = calloc(1, sizeof(*h));
+
+    check_mem(h);
+    h->image = image;
+    h->listen_fd = -1;
+    h->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    check(h->epoll_fd >= 0, "Cannot create the epoll instance");
+    return h;
+
+error:
+    free(h);
+    return NULL;
+}
+
+int
+host_listen(struct host *h, const char *path)
+{
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    struct stat     st;
+    int             fd = -1;
+
+    check(strlen(path) < sizeof(addr.sun_path), "%s is too long", path);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // A socket left by an earlier host
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    check(fd >= 0, "Cannot create a socket");
+    check(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+          listen(fd, SOMAXCONN) == 0, "Cannot listen on %s", path);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    check(epoll_ctl(h->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0,
+          "Cannot watch %s", path);
+    h->listen_fd = fd;
+    return 0;
+
+error:
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return -1;
+}
+
+int
+host_add(struct host *h, int in_fd, int out_fd)
+{
+    struct host_session *s = calloc(1, sizeof(*s));
+    struct epoll_event ev;
+    int             added = 0;
+
+    check_mem(s);
+    s->in_fd = in_fd;
+    s->out_fd = out_fd;
+    s->vm = calloc(1, sizeof(*s->vm));
+    check_mem(s->vm);
+    check(set_nonblocking(in_fd) == 0 && set_nonblocking(out_fd) == 0,
+          "Cannot make the session non-blocking");
+    s->watch_in.session = s;
+    s->watch_out.session = s;
+    s->watch_out.output = 1;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.ptr = &s->watch_in;
+    check(epoll_ctl(h->epoll_fd, EPOLL_CTL_ADD, in_fd, &ev) == 0,
+          "Cannot watch the input of a session");
+    added = 1;
+
+    if (out_fd != in_fd) {
+        ev.data.ptr = &s->watch_out;
+        check(epoll_ctl(h->epoll_fd, EPOLL_CTL_ADD, out_fd, &ev) == 0,
+              "Cannot watch the output of a session");
+    }
+
+    vm_reset(s->vm, h->image);
+    s->vm->wait_for_input = 1;
+    s->vm->pen = host_pen;
+    s->vm->pen_data = s;
+    s->status = vm_running;
+    s->next_all = h->sessions;
+
+    if (h->sessions != NULL) {
+        h->sessions->prev_all = s;
+    }
+
+    h->sessions = s;
+    ++h->nsessions;
+    enqueue(h, s);
+    return 0;
+
+error:
+    if (added) {
+        epoll_ctl(h->epoll_fd, EPOLL_CTL_DEL, in_fd, NULL);
+    }
+
+    if (s != NULL) {
+        free(s->vm);
+    }
+
+    free(s);
+    return -1;
+}
+
+static void
+free_dead(struct host *h)
+{
+    while (h->dead != NULL) {
+        struct host_session *s = h->dead;
+
+        h->dead = s->next;
+        free(s);
+    }
+}
+
+/**
+ * Starts a session per pending connection
+ */
+static void
+accept_all(struct host *h)
+{
+    int             fd;
+
+    while ((fd = accept4(h->listen_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (host_add(h, fd, fd) != 0) {
+            close(fd);
+        }
+    }
+}
+
+int
+host_run(struct host *h)
+{
+    struct epoll_event events[64];
+
+    // A client that goes away must not kill the host
+    signal(SIGPIPE, SIG_IGN);
+
+    while (h->nsessions > 0 || h->listen_fd >= 0) {
+        int             n = epoll_wait(h->epoll_fd, events, 64,
+                                       h->head != NULL ? 0 : -1);
+        struct host_session *last;
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        check(n >= 0, "epoll_wait failed");
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == NULL) {
+                accept_all(h);
+            } else {
+                handle(h, events[i].data.ptr, events[i].events);
+            }
+        }
+
+        // One quantum for each session that was runnable before the events
+        // and for those the events woke up
+        last = h->tail;
+
+        while (last != NULL && h->head != NULL) {
+            struct host_session *s = dequeue(h);
+
+            run_session(h, s);
+
+            if (s == last) {
+                break;
+            }
+        }
+
+        free_dead(h);
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+void
+host_free(struct host *h)
+{
+    if (h == NULL) {
+        return;
+    }
+
+    while (h->sessions != NULL) {
+        close_session(h, h->sessions);
+    }
+
+    free_dead(h);
+
+    if (h->listen_fd >= 0) {
+        close(h->listen_fd);
+    }
+
+    close(h->epoll_fd);
+    free(h);
+}
@@ -0,0 +1,143 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Interactive host
+ *
+ * Runs many machines on one thread, one per session. A session reads the
+ * values for `read' from a file descriptor, e.g., a pipe or a socket, as
+ * they arrive, and writes its plot stream to another one, or the same. A
+ * machine that runs out of input waits until its descriptor is readable; an
+ * epoll loop resumes it, and gives each runnable machine HOST_QUANTUM steps
+ * at a time so that none of them holds up the others.
+ *
+ * The stack of a machine is only touched near its ends, so most of its
+ * pages are never mapped.
+ */
+
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <stddef.h>
+
+#include "vm.h"
+
+/**
+ * Steps a machine runs before the next one gets its turn
+ */
+#define HOST_QUANTUM 100000
+
+/**
+ * A machine stops once that much of its plot stream is not written yet, and
+ * goes on when it is
+ */
+#define HOST_OUTPUT_MAX 65536
+
+struct host_session;
+
+/**
+ * What a session waits for on a descriptor. Sessions that read and write the
+ * same descriptor only use their input watch.
+ */
+struct host_watch {
+    struct host_session *session;
+    int             output;
+};
+
+struct host_session {
+    struct vm      *vm;
+    int             in_fd;
+    int             out_fd;
+    // Values read but not taken by Read yet, as vm.input
+    int            *input;
+    int             input_capacity;
+    // The digits of a number cut in two by a read()
+    char            partial[16];
+    int             partial_len;
+    int             eof;
+    enum vm_status  status;
+    // Plot stream not written yet
+    char           *out;
+    size_t          out_len;
+    size_t          out_sent;
+    size_t          out_capacity;
+    struct host_watch watch_in;
+    struct host_watch watch_out;
+    // In the run queue
+    int             queued;
+    struct host_session *next;
+    // All the sessions, and those closed since the last epoll_wait()
+    struct host_session *prev_all;
+    struct host_session *next_all;
+    int             closed;
+};
+
+struct host {
+    const struct vm_image *image;
+    int             epoll_fd;
+    // Unix socket the sessions connect to, or -1
+    int             listen_fd;
+    int             nsessions;
+    struct host_session *sessions;
+    // Sessions that can run, in order
+    struct host_session *head;
+    struct host_session *tail;
+    // Freed once no event of the last epoll_wait() can point to them
+    struct host_session *dead;
+};
+
+/**
+ * @returns a host for the machines that run @image, or NULL
+ */
+struct host    *host_new(const struct vm_image *image);
+
+/**
+ * Listens on the Unix socket @path: each connection is a session that reads
+ * and writes the socket
+ *
+ * @returns 0 on success, -1 otherwise
+ */
+int             host_listen(struct host *h, const char *path);
+
+/**
+ * Starts a session that reads @in_fd and writes @out_fd. They are made
+ * non-blocking and closed with the session.
+ *
+ * @returns 0 on success, -1 otherwise
+ */
+int             host_add(struct host *h, int in_fd, int out_fd);
+
+/**
+ * Runs the sessions until all of them end, and forever if the host listens
+ * on a socket
+ *
+ * @returns 0, or -1 if epoll fails
+ */
+int             host_run(struct host *h);
+
+void            host_free(struct host *h);
+
+#endif /* end of include guard: HOST_H_ */
@@ -33,20 +33,44 @@
  */
 #define INSTRUCTIONS_SIZE (2<<16)
 
+/**
+ * Number of source lines listed by gen_size_report()
+ */
+#define SIZE_REPORT_TOP 10
+
 int             next_code_index = 0;
 
 /**
- * Compact representation of an instruction
+ * We use a static array because it is easier...
+ */
+static struct instruction instructions[INSTRUCTIONS_SIZE];
+
+/**
+ * Source position and owner attached to the next generated instruction
+ */
+static YYLTYPE  cur_pos;
+static int      cur_owner = -1;
+
+/**
+ * Names of the owners (functions) seen so far, indexed by instruction.owner
+ */
+#define OWNERS_SIZE 1024
+static char    *owners[OWNERS_SIZE];
+static int      owner_count = 0;
+
+/**
+ * Mnemonics, indexed by enum I_instruction
  */
-struct instruction {
-    enum I_instruction kind;
-    int             op;
+static const char *I_names[] = {
+    "Halt", "Up", "Down", "Move", "Add", "Sub", "Neg", "Mul", "Test", "Rts",
+    "Load GP", "Load FP", "Store GP", "Store FP", "Read GP", "Read FP",
+    "Jsr", "Jump", "Jeq", "Jlt", "Loadi", "Pop", "Word",
 };
 
 /**
- * We use a static array because it is easier...
+ * Appends an instruction (or an operand word) to the array
  */
-static struct instruction instructions[INSTRUCTIONS_SIZE];
+static void     emit(enum I_instruction kind, int op);
 
 /**
  * @return the _number_ corresponds to @i
@@ -302,194 +326,160 @@ translate_to_binary(void)
     }
 }
 
+static void
+emit(enum I_instruction kind, int op)
+{
+    instructions[next_code_index].kind = kind;
+    instructions[next_code_index].op = op;
+    instructions[next_code_index].pos = cur_pos;
+    instructions[next_code_index].owner = cur_owner;
+    ++next_code_index;
+}
+
 void
 gen_Halt(void)
 {
-    instructions[next_code_index].kind = I_Halt;
-    ++next_code_index;
+    emit(I_Halt, 0);
 }
 
 void
 gen_Up(void)
 {
-    instructions[next_code_index].kind = I_Up;
-    ++next_code_index;
+    emit(I_Up, 0);
 }
 
 void
 gen_Down(void)
 {
-    instructions[next_code_index].kind = I_Down;
-    ++next_code_index;
+    emit(I_Down, 0);
 }
 
 void
 gen_Move(void)
 {
-    instructions[next_code_index].kind = I_Move;
-    ++next_code_index;
+    emit(I_Move, 0);
 }
 
 void
 gen_Add(void)
 {
-    instructions[next_code_index].kind = I_Add;
-    ++next_code_index;
+    emit(I_Add, 0);
 }
 
 void
 gen_Sub(void)
 {
-    instructions[next_code_index].kind = I_Sub;
-    ++next_code_index;
+    emit(I_Sub, 0);
 }
 
 void
 gen_Neg(void)
 {
-    instructions[next_code_index].kind = I_Neg;
-    ++next_code_index;
+    emit(I_Neg, 0);
 }
 
 void
 gen_Mul(void)
 {
-    instructions[next_code_index].kind = I_Mul;
-    ++next_code_index;
+    emit(I_Mul, 0);
 }
 
 void
 gen_Test(void)
 {
-    instructions[next_code_index].kind = I_Test;
-    ++next_code_index;
+    emit(I_Test, 0);
 }
 
 void
 gen_Rts(void)
 {
-    instructions[next_code_index].kind = I_Rts;
-    ++next_code_index;
+    emit(I_Rts, 0);
 }
 
 void
 gen_Load_GP(int offset)
 {
-    instructions[next_code_index].kind = I_Load_GP;
-    instructions[next_code_index].op = offset;
-    ++next_code_index;
+    emit(I_Load_GP, offset);
 }
 
 void
 gen_Load_FP(int offset)
 {
-    instructions[next_code_index].kind = I_Load_FP;
-    instructions[next_code_index].op = offset;
-    ++next_code_index;
+    emit(I_Load_FP, offset);
 }
 
 void
 gen_Store_GP(int offset)
 {
-    instructions[next_code_index].kind = I_Store_GP;
-    instructions[next_code_index].op = offset;
-    ++next_code_index;
+    emit(I_Store_GP, offset);
 }
 
 void
 gen_Store_FP(int offset)
 {
-    instructions[next_code_index].kind = I_Store_FP;
-    instructions[next_code_index].op = offset;
-    ++next_code_index;
+    emit(I_Store_FP, offset);
 }
 
 void
 gen_Read_GP(int offset)
 {
-    instructions[next_code_index].kind = I_Read_GP;
-    instructions[next_code_index].op = offset;
-    ++next_code_index;
+    emit(I_Read_GP, offset);
 }
 
 void
 gen_Read_FP(int offset)
 {
-    instructions[next_code_index].kind = I_Read_FP;
-    instructions[next_code_index].op = offset;
-    ++next_code_index;
+    emit(I_Read_FP, offset);
 }
 
 void
 gen_Jsr(int address)
 {
-    instructions[next_code_index].kind = I_Jsr;
-    instructions[next_code_index].op = address;
-    ++next_code_index;
-    instructions[next_code_index].kind = I_Word;
-    instructions[next_code_index].op = address;
-    ++next_code_index;
+    emit(I_Jsr, address);
+    emit(I_Word, address);
 }
 
 void
 gen_Jump(int address)
 {
-    instructions[next_code_index].kind = I_Jump;
-    instructions[next_code_index].op = address;
-    ++next_code_index;
-    instructions[next_code_index].kind = I_Word;
-    instructions[next_code_index].op = address;
-    ++next_code_index;
+    emit(I_Jump, address);
+    emit(I_Word, address);
 }
 
 void
 gen_Jeq(int address)
 {
-    instructions[next_code_index].kind = I_Jeq;
-    instructions[next_code_index].op = address;
-    ++next_code_index;
-    instructions[next_code_index].kind = I_Word;
-    instructions[next_code_index].op = address;
-    ++next_code_index;
+    emit(I_Jeq, address);
+    emit(I_Word, address);
 }
 
 void
 gen_Jlt(int address)
 {
-    instructions[next_code_index].kind = I_Jlt;
-    instructions[next_code_index].op = address;
-    ++next_code_index;
-    instructions[next_code_index].kind = I_Word;
-    instructions[next_code_index].op = address;
-    ++next_code_index;
+    emit(I_Jlt, address);
+    emit(I_Word, address);
 }
 
 void
 gen_Loadi(int v)
 {
-    instructions[next_code_index].kind = I_Loadi;
-    instructions[next_code_index].op = v;
-    ++next_code_index;
-    instructions[next_code_index].kind = I_Word;
-    instructions[next_code_index].op = v;
-    ++next_code_index;
+    emit(I_Loadi, v);
+    emit(I_Word, v);
 }
 
 void
 gen_Pop(int n)
 {
-    instructions[next_code_index].kind = I_Pop;
-    instructions[next_code_index].op = n;
-    ++next_code_index;
-    instructions[next_code_index].kind = I_Word;
-    instructions[next_code_index].op = n;
-    ++next_code_index;
+    emit(I_Pop, n);
+    emit(I_Word, n);
 }
 
 void
 backpatch(int i, int addr)
 {
-    instructions[i + 1].op = addr;
+    if (i >= 0) {
+        instructions[i + 1].op = addr;
+    }
 }
 
 int
@@ -497,3 +487,219 @@ get_next_code_index(void)
 {
     return next_code_index;
 }
+
+const struct instruction *
+gen_code(void)
+{
+    return instructions;
+}
+
+void
+gen_copy(const struct instruction *i)
+{
+    instructions[next_code_index] = *i;
+    ++next_code_index;
+}
+
+void
+discard_code(int index)
+{
+    if (index >= 0 && index < next_code_index) {
+        next_code_index = index;
+    }
+}
+
+YYLTYPE
+gen_set_pos(YYLTYPE pos)
+{
+    YYLTYPE         old = cur_pos;
+    cur_pos = pos;
+    return old;
+}
+
+void
+gen_set_owner(char *name)
+{
+    if (owner_count == OWNERS_SIZE) {
+        log_err("Too many functions.");
+        panic();
+    }
+
+    // Symbols are released at the end of sem_trans_prog(), keep a copy
+    owners[owner_count] = strdup(name);
+    check_mem(owners[owner_count]);
+    cur_owner = owner_count++;
+    memset(&cur_pos, 0, sizeof(cur_pos));
+    return;
+
+error:
+    panic();
+}
+
+/**
+ * Code size attributed to a (owner, source line) pair
+ */
+struct size_entry {
+    int             owner;
+    int             line;
+    int             words;
+};
+
+static int
+cmp_size_entry(const void *a, const void *b)
+{
+    const struct size_entry *x = a;
+    const struct size_entry *y = b;
+
+    if (x->words != y->words) {
+        return y->words - x->words;
+    }
+
+    return x->line - y->line;
+}
+
+static void
+print_histogram(FILE *out, int owner)
+{
+    int             count[I_Word] = { 0 };
+
+    for (int i = 0; i < next_code_index; ++i) {
+        if (instructions[i].kind != I_Word &&
+                (owner < 0 || instructions[i].owner == owner)) {
+            ++count[instructions[i].kind];
+        }
+    }
+
+    for (int k = 0; k < I_Word; ++k) {
+        if (count[k] != 0) {
+            fprintf(out, " %s:%d", I_names[k], count[k]);
+        }
+    }
+
+    fprintf(out, "\n");
+}
+
+void
+gen_size_report(FILE *out)
+{
+    int             max_line = 0;
+    int             nowners = owner_count + 1; // +1 for `unknown'
+    int             nentries = 0;
+    struct size_entry *entries = NULL;
+
+    for (int i = 0; i < next_code_index; ++i) {
+        if (instructions[i].pos.first_line > max_line) {
+            max_line = instructions[i].pos.first_line;
+        }
+    }
+
+    // words[(owner + 1) * (max_line + 1) + line]
+    int            *words = calloc((size_t) nowners * (max_line + 1),
+                                   sizeof(*words));
+    int            *owner_words = calloc(nowners, sizeof(*owner_words));
+    check_mem(words);
+    check_mem(owner_words);
+
+    for (int i = 0; i < next_code_index; ++i) {
+        int             o = instructions[i].owner + 1;
+        words[o * (max_line + 1) + instructions[i].pos.first_line] += 1;
+        owner_words[o] += 1;
+    }
+
+    fprintf(out, "Code size: %d words (%.1f%% of the 16-bit address space)\n",
+            next_code_index, 100.0 * next_code_index / 0x10000);
+
+    fprintf(out, "\nWords per function:\n");
+
+    for (int o = 0; o < nowners; ++o) {
+        if (owner_words[o] == 0) {
+            continue;
+        }
+
+        fprintf(out, "%7d  %s\n", owner_words[o],
+                o == 0 ? "(unknown)" : owners[o - 1]);
+    }
+
+    for (int o = 0; o < nowners; ++o) {
+        for (int l = 0; l <= max_line; ++l) {
+            if (words[o * (max_line + 1) + l] != 0) {
+                ++nentries;
+            }
+        }
+    }
+
+    entries = malloc((nentries + 1) * sizeof(*entries));
+    check_mem(entries);
+    nentries = 0;
+
+    for (int o = 0; o < nowners; ++o) {
+        for (int l = 0; l <= max_line; ++l) {
+            if (words[o * (max_line + 1) + l] != 0) {
+                entries[nentries].owner = o - 1;
+                entries[nentries].line = l;
+                entries[nentries].words = words[o * (max_line + 1) + l];
+                ++nentries;
+            }
+        }
+    }
+
+    qsort(entries, nentries, sizeof(*entries), cmp_size_entry);
+
+    fprintf(out, "\nTop source lines:\n");
+
+    for (int i = 0; i < nentries && i < SIZE_REPORT_TOP; ++i) {
+        fprintf(out, "%7d  line %d in %s\n", entries[i].words,
+                entries[i].line,
+                entries[i].owner < 0 ? "(unknown)" : owners[entries[i].owner]);
+    }
+
+    fprintf(out, "\nOpcode histogram:\n");
+    fprintf(out, "%-12s", "(all)");
+    print_histogram(out, -1);
+
+    for (int o = 0; o < owner_count; ++o) {
+        fprintf(out, "%-12s", owners[o]);
+        print_histogram(out, o);
+    }
+
+    free(entries);
+    free(owner_words);
+    free(words);
+    return;
+
+error:
+    free(entries);
+    free(owner_words);
+    free(words);
+    panic();
+}
+
+void
+gen_source_map(FILE *out)
+{
+    fprintf(out, "turtle-srcmap 1\n");
+
+    for (int o = 0; o < owner_count; ++o) {
+        fprintf(out, "fun %d %s\n", o, owners[o]);
+    }
+
+    // One line per run of instructions sharing the same position and owner:
+    // <first pc> <count> <line> <column> <owner>
+    for (int i = 0; i < next_code_index;) {
+        int             j = i + 1;
+
+        while (j < next_code_index &&
+                instructions[j].owner == instructions[i].owner &&
+                instructions[j].pos.first_line ==
+                instructions[i].pos.first_line &&
+                instructions[j].pos.first_column ==
+                instructions[i].pos.first_column) {
+            ++j;
+        }
+
+        fprintf(out, "%d %d %d %d %d\n", i, j - i,
+                instructions[i].pos.first_line,
+                instructions[i].pos.first_column, instructions[i].owner);
+        i = j;
+    }
+}
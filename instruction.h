@@ -65,6 +65,21 @@ enum I_instruction {
     I_Word,
 };
 
+/**
+ * Compact representation of an instruction
+ *
+ * Instructions that take an operand are followed by an I_Word that holds it.
+ *
+ * @pos and @owner record where the instruction comes from. They are only used
+ * for reporting and never affect the generated code.
+ */
+struct instruction {
+    enum I_instruction kind;
+    int             op;
+    YYLTYPE         pos;
+    int             owner;
+};
+
 /**
  * Generates instructions
  *
@@ -96,6 +111,8 @@ void gen_Rts_Opt(void);
 
 /**
  * Backpatches/change the target address of the instruction at @i to @addr
+ *
+ * Nothing is done if @i is negative, i.e., there is no jump to backpatch.
  */
 void backpatch(int i, int addr);
 
@@ -104,6 +121,49 @@ void backpatch(int i, int addr);
  */
 int get_next_code_index(void);
 
+/**
+ * Drops the instructions generated from @index onwards
+ */
+void discard_code(int index);
+
+/**
+ * @returns the instructions generated so far, get_next_code_index() of them
+ */
+const struct instruction *gen_code(void);
+
+/**
+ * Appends a copy of @i, keeping its position and owner
+ */
+void gen_copy(const struct instruction *i);
+
+/**
+ * Sets the source position attached to the instructions generated from now on
+ *
+ * @returns the previous position so that the caller can restore it
+ */
+YYLTYPE gen_set_pos(YYLTYPE pos);
+
+/**
+ * Attributes the instructions generated from now on to the function @name
+ *
+ * The source position is reset until the next gen_set_pos().
+ */
+void gen_set_owner(char *name);
+
+/**
+ * Outputs a report that attributes every generated word to its function and
+ * source line, followed by the opcode histograms
+ */
+void gen_size_report(FILE *out);
+
+/**
+ * Outputs the table that maps every pc to its source line, column and function
+ *
+ * Consecutive instructions that share the same position are written as a
+ * single range, so the table stays small.
+ */
+void gen_source_map(FILE *out);
+
 /**
  * Outputs the assembly code
  */
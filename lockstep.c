@@ -0,0 +1,640 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lockstep.h"
+
+#define LANES LOCKSTEP_LANES
+
+#define EACH(l) for (int l = 0; l < LANES; ++l)
+
+/**
+ * Iterates over the lanes in the bit mask @m
+ */
+#define EACH_IN(l, m) for (uint32_t m_ = (m), l; \
+                           m_ != 0 && ((l) = __builtin_ctz(m_), 1); \
+                           m_ &= m_ - 1)
+
+struct lockstep *
+lockstep_new(void)
+{
+    void           *ls = NULL;
+
+    if (posix_memalign(&ls, 64, sizeof(struct lockstep)) != 0) {
+        return NULL;
+    }
+
+    return ls;
+}
+
+void
+lockstep_reset(struct lockstep *ls, const struct vm_image *image, int nlanes)
+{
+    ls->image = image;
+    ls->nlanes = nlanes;
+    ls->live = (uint32_t) ((1ULL << nlanes) - 1);
+    memset(ls->stack, 0, sizeof(ls->stack));
+    memset(&ls->zero, 0, sizeof(ls->zero));
+    memset(&ls->negative, 0, sizeof(ls->negative));
+
+    EACH(l) {
+        ls->pc[l] = 0;
+        ls->sp[l] = 0;
+        ls->fp[l] = 0;
+        ls->steps[l] = 0;
+        ls->status[l] = l < nlanes ? vm_running : vm_halted;
+        ls->pen_down[l] = 0;
+        ls->pen_x[l] = 0;
+        ls->pen_y[l] = 0;
+        ls->input_used[l] = 0;
+    }
+}
+
+void
+lockstep_free(struct lockstep *ls)
+{
+    free(ls);
+}
+
+/**
+ * Stops the lane @l with @status
+ */
+static void
+retire(struct lockstep *ls, int l, enum vm_status status)
+{
+    ls->status[l] = status;
+    ls->live &= ~(1U << l);
+}
+
+/**
+ * Copies the registers of the @group to each of its lanes, with the
+ * @pending instructions they ran together
+ */
+static void
+spill(struct lockstep *ls, uint32_t group, int pc, int sp, int fp,
+      long long pending)
+{
+    EACH_IN(l, group) {
+        ls->pc[l] = pc;
+        ls->sp[l] = sp;
+        ls->fp[l] = fp;
+        ls->steps[l] += pending;
+    }
+}
+
+/**
+ * @returns 1 if the lanes of @group have the same SP and FP, which are then
+ * stored in @sp and @fp
+ */
+static int
+same_frame(const struct lockstep *ls, uint32_t group, int *sp, int *fp)
+{
+    int             first = __builtin_ctz(group);
+
+    EACH_IN(l, group) {
+        if (ls->sp[l] != ls->sp[first] || ls->fp[l] != ls->fp[first]) {
+            return 0;
+        }
+    }
+
+    *sp = ls->sp[first];
+    *fp = ls->fp[first];
+    return 1;
+}
+
+/**
+ * Picks the next group, the live lanes with the lowest PC, which goes to
+ * @pc. The lowest PC of the other live lanes goes to @others.
+ */
+static uint32_t
+regroup(const struct lockstep *ls, int *pc, int *others)
+{
+    uint32_t        group = 0;
+
+    *pc = INT_MAX;
+    *others = INT_MAX;
+
+    EACH_IN(l, ls->live) {
+        if (ls->pc[l] < *pc) {
+            *others = *pc;
+            *pc = ls->pc[l];
+            group = 1U << l;
+        } else if (ls->pc[l] == *pc) {
+            group |= 1U << l;
+        } else if (ls->pc[l] < *others) {
+            *others = ls->pc[l];
+        }
+    }
+
+    return group;
+}
+
+static void
+pen_event(struct lockstep *ls, int l, enum vm_pen_event event)
+{
+    if (ls->pen[l] != NULL) {
+        ls->pen[l] (ls->pen_data[l], event, ls->pen_x[l], ls->pen_y[l]);
+    }
+}
+
+/**
+ * The following macros are only used by run_lane(). Like those of vm_run(),
+ * they jump to `error' if the lane is about to do something illegal.
+ */
+#define PUSH(v) do { \
+                    check(ls->sp[l] + 1 < VM_STACK_SIZE, \
+                          "Lane %d: stack overflow at %d", l, pc); \
+                    ls->stack[++ls->sp[l]][l] = (int16_t) (v); \
+                } while (0)
+
+#define POP(v)  do { \
+                    check(ls->sp[l] > 0, \
+                          "Lane %d: stack underflow at %d", l, pc); \
+                    (v) = ls->stack[ls->sp[l]--][l]; \
+                } while (0)
+
+#define ADDR(a) do { \
+                    (a) = (w & 0x100 ? ls->fp[l] : 0) + (int8_t) (w & 0xFF); \
+                    check((a) > 0 && (a) < VM_STACK_SIZE, \
+                          "Lane %d: bad address %d at %d", l, (a), pc); \
+                } while (0)
+
+/**
+ * Runs the instruction @w at @pc, followed by @operand, on the lane @l alone
+ */
+static void
+run_lane(struct lockstep *ls, int l, int pc, uint16_t w, int operand,
+         int next)
+{
+    int             a,
+                    b,
+                    addr;
+
+    ++ls->steps[l];
+    ls->pc[l] = next;
+
+    switch ((w >> 8) & 0x7E) {
+    case VM_Halt:
+        ls->pc[l] = pc;
+        retire(ls, l, vm_halted);
+        break;
+
+    case VM_Read:
+        ADDR(addr);
+        check(ls->input_used[l] < ls->input_size[l],
+              "Lane %d: no more input at %d", l, pc);
+        ls->stack[addr][l] = (int16_t) ls->input[l][ls->input_used[l]++];
+        break;
+
+    case VM_Store:
+        ADDR(addr);
+        POP(a);
+        ls->stack[addr][l] = (int16_t) a;
+        break;
+
+    case VM_Load:
+        ADDR(addr);
+        PUSH(ls->stack[addr][l]);
+        break;
+
+    case VM_Up:
+        ls->pen_down[l] = 0;
+        pen_event(ls, l, vm_pen_up);
+        break;
+
+    case VM_Down:
+        ls->pen_down[l] = 1;
+        pen_event(ls, l, vm_pen_down);
+        break;
+
+    case VM_Move:
+        POP(b);
+        POP(a);
+        ls->pen_x[l] = a;
+        ls->pen_y[l] = b;
+        pen_event(ls, l, vm_pen_move);
+        break;
+
+    case VM_Add:
+        POP(b);
+        POP(a);
+        PUSH(a + b);
+        break;
+
+    case VM_Sub:
+        POP(b);
+        POP(a);
+        PUSH(a - b);
+        break;
+
+    case VM_Mul:
+        POP(b);
+        POP(a);
+        PUSH(a * b);
+        break;
+
+    case VM_Neg:
+        POP(a);
+        PUSH(-a);
+        break;
+
+    case VM_Test:
+        check(ls->sp[l] > 0, "Lane %d: stack underflow at %d", l, pc);
+        ls->zero[l] = ls->stack[ls->sp[l]][l] == 0 ? -1 : 0;
+        ls->negative[l] = ls->stack[ls->sp[l]][l] < 0 ? -1 : 0;
+        break;
+
+    case VM_Loadi:
+        PUSH(operand);
+        break;
+
+    case VM_Pop:
+        check(ls->sp[l] - operand >= 0, "Lane %d: stack underflow at %d", l,
+              pc);
+        ls->sp[l] -= operand;
+        break;
+
+    case VM_Jsr:
+        PUSH(next);
+        PUSH(ls->fp[l]);
+        ls->fp[l] = ls->sp[l];
+        ls->pc[l] = operand;
+        break;
+
+    case VM_Rts:
+        check(ls->fp[l] > 1, "Lane %d: return from the outmost scope at %d",
+              l, pc);
+        ls->sp[l] = ls->fp[l];
+        POP(a);
+        POP(b);
+        ls->fp[l] = (uint16_t) a;
+        ls->pc[l] = (uint16_t) b;
+        break;
+
+    case VM_Jump:
+        ls->pc[l] = operand;
+        break;
+
+    case VM_Jeq:
+        if (ls->zero[l]) {
+            ls->pc[l] = operand;
+        }
+
+        break;
+
+    case VM_Jlt:
+        if (ls->negative[l]) {
+            ls->pc[l] = operand;
+        }
+
+        break;
+
+    default:
+        sentinel("Lane %d: %d is not an instruction (at %d)", l, w, pc);
+    }
+
+    return;
+
+error:
+    ls->pc[l] = pc;
+    retire(ls, l, vm_error);
+}
+
+#undef PUSH
+#undef POP
+#undef ADDR
+
+/**
+ * The following macros are only used by lockstep_run(), for groups that
+ * share SP and FP
+ */
+#define NEED(n) check(sp >= (n), "Stack underflow at %d", pc)
+
+#define ROOM(n) check(sp + (n) < VM_STACK_SIZE, "Stack overflow at %d", pc)
+
+#define ADDR(a) do { \
+                    (a) = (w & 0x100 ? fp : 0) + (int8_t) (w & 0xFF); \
+                    check((a) > 0 && (a) < VM_STACK_SIZE, \
+                          "Bad address %d at %d", (a), pc); \
+                } while (0)
+
+/**
+ * Sets the row at @a to @v in the lanes of the group
+ */
+#define SET(a, v) (stack[a] = ((v) & mask) | (stack[a] & ~mask))
+
+/**
+ * Arithmetic wraps around, as on the 16-bit target
+ */
+typedef uint16_t urow __attribute__ ((vector_size(2 * LANES)));
+
+#define WRAP(a, op, b) ((lockstep_row) ((urow) (a) op (urow) (b)))
+
+void
+lockstep_run(struct lockstep *ls)
+{
+    const uint16_t *code = ls->image->code;
+    int             size = ls->image->size;
+    lockstep_row   *stack = ls->stack;
+    // The lanes that run the next instruction, as a bit mask and a row
+    uint32_t        group = 0;
+    lockstep_row    mask = { 0 };
+    int             pc = 0;
+    // SP and FP of the group if its lanes share them. A lane alone is run
+    // like a group that does not, without the masks.
+    int             uniform = 0;
+    int             sp = 0,
+                    fp = 0;
+    // Lowest PC of the live lanes outside the group
+    int             others = INT_MAX;
+    // Instructions run by a uniform group since it was formed
+    long long       pending = 0;
+
+    for (;;) {
+        uint16_t        w;
+        int             opcode,
+                        next,
+                        addr;
+        int             operand = 0;
+        uint32_t        taken = 0;
+
+        group &= ls->live;
+
+        // The group carries on until it catches up with other lanes
+        if (group == 0 || pc >= others) {
+            if (group != 0 && uniform) {
+                spill(ls, group, pc, sp, fp, pending);
+            }
+
+            if (ls->live == 0) {
+                return;
+            }
+
+            group = regroup(ls, &pc, &others);
+            uniform = (group & (group - 1)) != 0 &&
+                same_frame(ls, group, &sp, &fp);
+            pending = 0;
+
+            EACH(l) {
+                mask[l] = group >> l & 1 ? -1 : 0;
+            }
+        }
+
+        check(pc >= 0 && pc < size, "Jump out of the program: %d", pc);
+        w = code[pc];
+        opcode = (w >> 8) & 0x7E;
+
+        if (vm_is_two_words(opcode)) {
+            check(pc + 1 < size, "Missing operand at %d", pc);
+            operand = code[pc + 1];
+            next = pc + 2;
+        } else {
+            next = pc + 1;
+        }
+
+        if (!uniform) {
+            EACH_IN(l, group) {
+                run_lane(ls, l, pc, w, operand, next);
+            }
+
+            group &= ls->live;
+
+            if (group == 0) {
+                continue;
+            }
+
+            pc = ls->pc[__builtin_ctz(group)];
+
+            // The group parts if its lanes went different ways
+            EACH_IN(l, group) {
+                if (ls->pc[l] != pc) {
+                    group = 0;
+                }
+            }
+
+            if ((group & (group - 1)) != 0 &&
+                    same_frame(ls, group, &sp, &fp)) {
+                uniform = 1;
+                pending = 0;
+            }
+
+            continue;
+        }
+
+        ++pending;
+
+        switch (opcode) {
+        case VM_Halt:
+            spill(ls, group, pc, sp, fp, pending);
+
+            EACH_IN(l, group) {
+                retire(ls, l, vm_halted);
+            }
+
+            group = 0;
+            continue;
+
+        case VM_Read:
+            ADDR(addr);
+
+            EACH_IN(l, group) {
+                if (ls->input_used[l] < ls->input_size[l]) {
+                    stack[addr][l] =
+                        (int16_t) ls->input[l][ls->input_used[l]++];
+                } else {
+                    log_err("Lane %d: no more input at %d", l, pc);
+                    spill(ls, 1U << l, pc, sp, fp, pending);
+                    retire(ls, l, vm_error);
+                }
+            }
+
+            break;
+
+        case VM_Store:
+            ADDR(addr);
+            NEED(1);
+            SET(addr, stack[sp]);
+            --sp;
+            break;
+
+        case VM_Load:
+            ADDR(addr);
+            ROOM(1);
+            ++sp;
+            SET(sp, stack[addr]);
+            break;
+
+        case VM_Up:
+        case VM_Down:
+            EACH_IN(l, group) {
+                ls->pen_down[l] = opcode == VM_Down;
+                pen_event(ls, l, opcode == VM_Down ? vm_pen_down : vm_pen_up);
+            }
+
+            break;
+
+        case VM_Move:
+            NEED(2);
+
+            EACH_IN(l, group) {
+                ls->pen_x[l] = stack[sp - 1][l];
+                ls->pen_y[l] = stack[sp][l];
+                pen_event(ls, l, vm_pen_move);
+            }
+
+            sp -= 2;
+            break;
+
+        case VM_Add:
+            NEED(2);
+            SET(sp - 1, WRAP(stack[sp - 1], +, stack[sp]));
+            --sp;
+            break;
+
+        case VM_Sub:
+            NEED(2);
+            SET(sp - 1, WRAP(stack[sp - 1], -, stack[sp]));
+            --sp;
+            break;
+
+        case VM_Mul:
+            NEED(2);
+            SET(sp - 1, WRAP(stack[sp - 1], *, stack[sp]));
+            --sp;
+            break;
+
+        case VM_Neg:
+            NEED(1);
+            SET(sp, WRAP((lockstep_row) { 0 }, -, stack[sp]));
+            break;
+
+        case VM_Test:
+            NEED(1);
+            ls->zero = ((stack[sp] == 0) & mask) | (ls->zero & ~mask);
+            ls->negative = ((stack[sp] < 0) & mask) | (ls->negative & ~mask);
+            break;
+
+        case VM_Loadi:
+            ROOM(1);
+            ++sp;
+            SET(sp, (lockstep_row) { 0 } + (int16_t) operand);
+            break;
+
+        case VM_Pop:
+            NEED(operand);
+            sp -= operand;
+            break;
+
+        case VM_Jsr:
+            ROOM(2);
+            SET(sp + 1, (lockstep_row) { 0 } + (int16_t) next);
+            SET(sp + 2, (lockstep_row) { 0 } + (int16_t) fp);
+            sp += 2;
+            fp = sp;
+            next = operand;
+            break;
+
+        case VM_Rts:
+            check(fp > 1, "Return from the outmost scope at %d", pc);
+            addr = fp;
+            sp = addr - 2;
+            next = (uint16_t) stack[addr - 1][__builtin_ctz(group)];
+            fp = (uint16_t) stack[addr][__builtin_ctz(group)];
+
+            EACH_IN(l, group) {
+                taken |= (uint16_t) stack[addr - 1][l] != next ||
+                    (uint16_t) stack[addr][l] != fp;
+            }
+
+            // The group parts if its lanes return to different places
+            if (taken) {
+                EACH_IN(l, group) {
+                    ls->pc[l] = (uint16_t) stack[addr - 1][l];
+                    ls->fp[l] = (uint16_t) stack[addr][l];
+                    ls->sp[l] = sp;
+                    ls->steps[l] += pending;
+                }
+
+                group = 0;
+                continue;
+            }
+
+            break;
+
+        case VM_Jump:
+            next = operand;
+            break;
+
+        case VM_Jeq:
+        case VM_Jlt:
+            EACH_IN(l, group) {
+                if ((opcode == VM_Jeq ? ls->zero : ls->negative)[l]) {
+                    taken |= 1U << l;
+                }
+            }
+
+            if (taken == group) {
+                next = operand;
+            } else if (taken != 0) {
+                // The group parts
+                spill(ls, group, next, sp, fp, pending);
+
+                EACH_IN(l, taken) {
+                    ls->pc[l] = operand;
+                }
+
+                group = 0;
+                continue;
+            }
+
+            break;
+
+        default:
+            sentinel("%d is not an instruction (at %d)", w, pc);
+        }
+
+        pc = next;
+        continue;
+
+error:
+        if (uniform) {
+            spill(ls, group, pc, sp, fp, pending);
+        }
+
+        EACH_IN(l, group) {
+            if (!uniform) {
+                ++ls->steps[l];
+            }
+
+            retire(ls, l, vm_error);
+        }
+
+        group = 0;
+    }
+}
@@ -0,0 +1,112 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Lockstep machine
+ *
+ * Runs up to LOCKSTEP_LANES instances of one image side by side, one per
+ * lane, each with its own input and pen callback. The stack is stored lane
+ * by lane, so that stack[a] holds the word at address a of every lane.
+ *
+ * The lanes at the same instruction form a group, which decodes it once.
+ * While they also share SP and FP, the instruction is applied to whole rows
+ * of the stack, masked to the lanes of the group; otherwise, e.g., at
+ * different depths of a recursion, to each lane in turn. When a conditional
+ * jump or a return splits the group, the lanes with the lowest PC run first,
+ * until they catch up with the others and merge with them. For the
+ * structured code turtle generates, lanes meet again at the end of the if
+ * statement or loop that split them.
+ */
+
+#ifndef LOCKSTEP_H_
+#define LOCKSTEP_H_
+
+#include <stdint.h>
+
+#include "vm.h"
+
+#define LOCKSTEP_LANES 16
+
+/**
+ * A word of every lane. GCC and Clang map operations on rows to SIMD
+ * instructions, and split them if the vector registers are narrower.
+ */
+typedef int16_t lockstep_row __attribute__ ((vector_size(2 * LOCKSTEP_LANES)));
+
+/**
+ * Must be allocated with lockstep_new(), to align the rows
+ */
+struct lockstep {
+    lockstep_row    stack[VM_STACK_SIZE];
+    const struct vm_image *image;
+    // Number of lanes in use, from lane 0
+    int             nlanes;
+    // Lanes that neither halted nor failed, as a bit mask
+    uint32_t        live;
+    // Registers, by lane
+    int             pc[LOCKSTEP_LANES];
+    int             sp[LOCKSTEP_LANES];
+    int             fp[LOCKSTEP_LANES];
+    // Set by Test, -1 for true
+    lockstep_row    zero;
+    lockstep_row    negative;
+    long long       steps[LOCKSTEP_LANES];
+    enum vm_status  status[LOCKSTEP_LANES];
+    // Pen state, input and pen callback, by lane
+    int             pen_down[LOCKSTEP_LANES];
+    int             pen_x[LOCKSTEP_LANES];
+    int             pen_y[LOCKSTEP_LANES];
+    const int      *input[LOCKSTEP_LANES];
+    int             input_size[LOCKSTEP_LANES];
+    int             input_used[LOCKSTEP_LANES];
+    void          (*pen[LOCKSTEP_LANES]) (void *data,
+                                          enum vm_pen_event event, int x,
+                                          int y);
+    void           *pen_data[LOCKSTEP_LANES];
+};
+
+/**
+ * @returns a new lockstep machine, or NULL if out of memory
+ */
+struct lockstep *lockstep_new(void);
+
+/**
+ * Clears the stack and puts @nlanes lanes of @ls in their initial state,
+ * ready to run @image. The input and pen callback of each lane are left as
+ * they are.
+ */
+void            lockstep_reset(struct lockstep *ls,
+                               const struct vm_image *image, int nlanes);
+
+/**
+ * Runs all the lanes of @ls until each of them halts or fails, and sets its
+ * status
+ */
+void            lockstep_run(struct lockstep *ls);
+
+void            lockstep_free(struct lockstep *ls);
+
+#endif /* end of include guard: LOCKSTEP_H_ */
@@ -26,6 +26,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "parser.h"
 #include "lexer.h"
@@ -33,14 +34,19 @@
 #include <unistd.h>
 #include <getopt.h>
 #include "global.h"
+#include "pass.h"
+#include "pgo.h"
 
 /**
  * Please have a look at global.h for more information
  */
 
 FILE           *fout;
+FILE           *fmap = NULL;
 int             sflag = 0;
 int             lflag = 0;
+int             rflag = 0;
+int             oflag = 0;
 
 struct allocated_linked_list_memory {
     void *head;
@@ -82,7 +88,12 @@ print_help(void)
            "Options:\n"
            "-o FILE\t\tFILE\n"
            "-s\t\toutput assembly code\n"
-           "-l\t\tdisplay line numbers\n");
+           "-l\t\tdisplay line numbers\n"
+           "-m FILE\t\twrite the source map to FILE\n"
+           "-P FILE\t\tlay out the code with the branch profile in FILE\n"
+           "-O LEVEL\toptimisation level (0, 1 or 2)\n"
+           "-x PASS\t\tdisable the optimisation PASS (-x list lists them)\n"
+           "-r\t\treport code size per function and source line to stderr\n");
 }
 
 void
@@ -94,6 +105,10 @@ panic(void)
         fclose(fout);
     }
 
+    if (fmap != NULL) {
+        fclose(fmap);
+    }
+
     exit(1);
 }
 
@@ -103,7 +118,7 @@ main(int argc, char *argv[])
     int             c;
     fout = stdout;
 
-    while ((c = getopt(argc, argv, "so:l")) != -1) {
+    while ((c = getopt(argc, argv, "so:lm:rP:O:x:")) != -1) {
         switch (c) {
         case 's':
             debug("Output assembly code only");
@@ -120,6 +135,36 @@ main(int argc, char *argv[])
             lflag = 1;
             break;
 
+        case 'm':
+            fmap = fopen(optarg, "w+");
+            check(fmap, "Cannot open the file %s for writing", optarg);
+            debug("Source map to %s", optarg);
+            break;
+
+        case 'r':
+            rflag = 1;
+            break;
+
+        case 'O':
+            oflag = atoi(optarg);
+            debug("Optimisation level %d", oflag);
+            break;
+
+        case 'x':
+            if (strcmp(optarg, "list") == 0) {
+                pass_list(stdout);
+                return 0;
+            }
+
+            check(pass_disable(optarg) == 0, "Unknown pass %s", optarg);
+            debug("Pass %s disabled", optarg);
+            break;
+
+        case 'P':
+            check(pgo_load(optarg) == 0, "Cannot load the profile %s", optarg);
+            debug("Branch profile from %s", optarg);
+            break;
+
         case 'h':
         default:
             print_help();
@@ -0,0 +1,375 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "opt.h"
+#include "symbol.h"
+
+/**
+ * Number of temporaries introduced so far, to give them unique names
+ */
+static int      _temps;
+
+int
+opt_same_exp(struct ast_exp *a, struct ast_exp *b)
+{
+    if (a == NULL || b == NULL) {
+        return a == b;
+    }
+
+    if (a->kind != b->kind) {
+        return 0;
+    }
+
+    switch (a->kind) {
+    case ast_varExp:
+        return a->u.var == b->u.var;
+
+    case ast_intExp:
+        return a->u.intt == b->u.intt;
+
+    case ast_opExp:
+        return a->u.op.oper == b->u.op.oper &&
+               opt_same_exp(a->u.op.left, b->u.op.left) &&
+               opt_same_exp(a->u.op.right, b->u.op.right);
+
+    default:
+        // Calls may have side effects
+        return 0;
+    }
+}
+
+int
+opt_uses_var(struct ast_exp *exp, struct s_symbol *var)
+{
+    struct ast_exp_list *args;
+
+    if (exp == NULL) {
+        return 0;
+    }
+
+    switch (exp->kind) {
+    case ast_varExp:
+        return exp->u.var == var;
+
+    case ast_callExp:
+        for (args = exp->u.call.args; args; args = args->tail) {
+            if (opt_uses_var(args->head, var)) {
+                return 1;
+            }
+        }
+
+        return 0;
+
+    case ast_opExp:
+        return opt_uses_var(exp->u.op.left, var) ||
+               opt_uses_var(exp->u.op.right, var);
+
+    default:
+        return 0;
+    }
+}
+
+struct s_symbol *
+opt_new_temp(ast_pos pos, struct ast_var_dec_list **vars)
+{
+    char            name[32];
+
+    // Identifiers in the source start with a letter, so this cannot clash
+    snprintf(name, sizeof(name), "__t%d", ++_temps);
+    struct s_symbol *sym = s_new_symbol(name);
+
+    while (*vars != NULL) {
+        vars = &(*vars)->tail;
+    }
+
+    *vars = ast_new_var_dec_list(ast_new_var_dec(pos, sym,
+                                                 ast_int_exp(pos, 0)), NULL);
+    return sym;
+}
+
+int
+opt_is_local(struct ast_fun_dec *fun, struct s_symbol *var)
+{
+    struct ast_field_list *f;
+    struct ast_var_dec_list *v;
+
+    if (fun == NULL) {
+        return 0;
+    }
+
+    for (f = fun->params; f; f = f->tail) {
+        if (f->head->name == var) {
+            return 1;
+        }
+    }
+
+    for (v = fun->var; v; v = v->tail) {
+        if (v->head->sym == var) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int
+opt_writes_var(struct ast_stmt_list *list, struct s_symbol *var)
+{
+    for (; list; list = list->tail) {
+        struct ast_stmt *stmt = list->head;
+
+        switch (stmt->kind) {
+        case ast_readStmt:
+            if (stmt->u.read.var == var) {
+                return 1;
+            }
+
+            break;
+
+        case ast_assignStmt:
+            if (stmt->u.assign.var == var) {
+                return 1;
+            }
+
+            break;
+
+        case ast_iftStmt:
+            if (opt_writes_var(stmt->u.ift.then, var)) {
+                return 1;
+            }
+
+            break;
+
+        case ast_ifteStmt:
+            if (opt_writes_var(stmt->u.ifte.then, var) ||
+                    opt_writes_var(stmt->u.ifte.elsee, var)) {
+                return 1;
+            }
+
+            break;
+
+        case ast_whileStmt:
+            if (opt_writes_var(stmt->u.whilee.body, var)) {
+                return 1;
+            }
+
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+void
+opt_subst_exp(struct ast_exp *exp, struct s_symbol *var, int value)
+{
+    struct ast_exp_list *args;
+
+    if (exp == NULL) {
+        return;
+    }
+
+    switch (exp->kind) {
+    case ast_varExp:
+        if (exp->u.var == var) {
+            exp->kind = ast_intExp;
+            exp->u.intt = value;
+        }
+
+        break;
+
+    case ast_callExp:
+        for (args = exp->u.call.args; args; args = args->tail) {
+            opt_subst_exp(args->head, var, value);
+        }
+
+        break;
+
+    case ast_opExp:
+        opt_subst_exp(exp->u.op.left, var, value);
+        opt_subst_exp(exp->u.op.right, var, value);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void
+opt_subst_stmt_list(struct ast_stmt_list *list, struct s_symbol *var, int value)
+{
+    struct ast_exp_list *exps;
+
+    for (; list; list = list->tail) {
+        struct ast_stmt *stmt = list->head;
+
+        switch (stmt->kind) {
+        case ast_moveStmt:
+            opt_subst_exp(stmt->u.move.exp1, var, value);
+            opt_subst_exp(stmt->u.move.exp2, var, value);
+            break;
+
+        case ast_assignStmt:
+            opt_subst_exp(stmt->u.assign.exp, var, value);
+            break;
+
+        case ast_iftStmt:
+            opt_subst_exp(stmt->u.ift.test, var, value);
+            opt_subst_stmt_list(stmt->u.ift.then, var, value);
+            break;
+
+        case ast_ifteStmt:
+            opt_subst_exp(stmt->u.ifte.test, var, value);
+            opt_subst_stmt_list(stmt->u.ifte.then, var, value);
+            opt_subst_stmt_list(stmt->u.ifte.elsee, var, value);
+            break;
+
+        case ast_whileStmt:
+            opt_subst_exp(stmt->u.whilee.test, var, value);
+            opt_subst_stmt_list(stmt->u.whilee.body, var, value);
+            break;
+
+        case ast_returnStmt:
+            opt_subst_exp(stmt->u.returnn.exp, var, value);
+            break;
+
+        case ast_callStmt:
+            for (exps = stmt->u.call.args; exps; exps = exps->tail) {
+                opt_subst_exp(exps->head, var, value);
+            }
+
+            break;
+
+        case ast_exp_listStmt:
+            for (exps = stmt->u.seq; exps; exps = exps->tail) {
+                opt_subst_exp(exps->head, var, value);
+            }
+
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+int
+opt_exp_size(struct ast_exp *exp)
+{
+    struct ast_exp_list *args;
+    int             size = 1;
+
+    if (exp == NULL) {
+        return 0;
+    }
+
+    switch (exp->kind) {
+    case ast_callExp:
+        for (args = exp->u.call.args; args; args = args->tail) {
+            size += opt_exp_size(args->head);
+        }
+
+        return size;
+
+    case ast_opExp:
+        return size + opt_exp_size(exp->u.op.left) +
+               opt_exp_size(exp->u.op.right);
+
+    default:
+        return size;
+    }
+}
+
+int
+opt_stmt_list_size(struct ast_stmt_list *list)
+{
+    struct ast_exp_list *exps;
+    int             size = 0;
+
+    for (; list; list = list->tail) {
+        struct ast_stmt *stmt = list->head;
+
+        ++size;
+
+        switch (stmt->kind) {
+        case ast_moveStmt:
+            size += opt_exp_size(stmt->u.move.exp1) +
+                    opt_exp_size(stmt->u.move.exp2);
+            break;
+
+        case ast_assignStmt:
+            size += opt_exp_size(stmt->u.assign.exp);
+            break;
+
+        case ast_iftStmt:
+            size += opt_exp_size(stmt->u.ift.test) +
+                    opt_stmt_list_size(stmt->u.ift.then);
+            break;
+
+        case ast_ifteStmt:
+            size += opt_exp_size(stmt->u.ifte.test) +
+                    opt_stmt_list_size(stmt->u.ifte.then) +
+                    opt_stmt_list_size(stmt->u.ifte.elsee);
+            break;
+
+        case ast_whileStmt:
+            size += opt_exp_size(stmt->u.whilee.test) +
+                    opt_stmt_list_size(stmt->u.whilee.body);
+            break;
+
+        case ast_returnStmt:
+            size += opt_exp_size(stmt->u.returnn.exp);
+            break;
+
+        case ast_callStmt:
+            for (exps = stmt->u.call.args; exps; exps = exps->tail) {
+                size += opt_exp_size(exps->head);
+            }
+
+            break;
+
+        case ast_exp_listStmt:
+            for (exps = stmt->u.seq; exps; exps = exps->tail) {
+                size += opt_exp_size(exps->head);
+            }
+
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return size;
+}
+
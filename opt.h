@@ -0,0 +1,123 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * AST-level optimisations
+ *
+ * These passes rewrite the program before sem_trans_prog() translates it.
+ * Each pass lives in its own file, e.g. cse.c, and pass.c runs it from the -O
+ * level it gives. No pass changes what the program plots. This module holds
+ * what the passes share.
+ */
+
+#ifndef OPT_H_
+#define OPT_H_
+
+#include "absyn.h"
+
+/**
+ * @returns 1 if @a and @b are the same pure expression
+ */
+int opt_same_exp(struct ast_exp *a, struct ast_exp *b);
+
+/**
+ * @returns 1 if @exp reads the variable @var
+ */
+int opt_uses_var(struct ast_exp *exp, struct s_symbol *var);
+
+/**
+ * @returns 1 if @list or the statements nested in it assign or read @var
+ */
+int opt_writes_var(struct ast_stmt_list *list, struct s_symbol *var);
+
+/**
+ * @returns 1 if @var is a parameter or a local variable of @fun, which a call
+ * cannot change. @fun is NULL in the main body.
+ */
+int opt_is_local(struct ast_fun_dec *fun, struct s_symbol *var);
+
+/**
+ * Replaces the reads of @var in @exp, @list or the statements nested in it
+ * with @value
+ */
+void opt_subst_exp(struct ast_exp *exp, struct s_symbol *var, int value);
+void opt_subst_stmt_list(struct ast_stmt_list *list, struct s_symbol *var,
+                         int value);
+
+/**
+ * @returns the number of nodes of @exp or @list
+ */
+int opt_exp_size(struct ast_exp *exp);
+int opt_stmt_list_size(struct ast_stmt_list *list);
+
+/**
+ * @returns a new variable initialised to 0, appended to @vars
+ */
+struct s_symbol *opt_new_temp(ast_pos pos, struct ast_var_dec_list **vars);
+
+/**
+ * The passes, in the order pass.c runs them
+ */
+
+/**
+ * Replaces the constant global variables with their values
+ */
+void opt_const_globals(struct ast_program *prog);
+
+/**
+ * Folds the pure calls everywhere in @prog
+ */
+void opt_fold_calls(struct ast_program *prog);
+
+/**
+ * Specialises the functions of @prog for their constant arguments
+ */
+void opt_clone(struct ast_program *prog);
+
+/**
+ * Unrolls the counted loops everywhere in @prog
+ */
+void opt_unroll(struct ast_program *prog);
+
+/**
+ * Puts a shortcut in front of the division loops that the branch profile
+ * shows to be long
+ */
+void opt_div(struct ast_program *prog);
+
+/**
+ * Removes the redundant pen movements in @prog. Function summaries are
+ * computed first, then the states at the entry of each function.
+ */
+void opt_pen(struct ast_program *prog);
+
+/**
+ * Caches the repeated subexpressions of each straight-line region of @prog
+ * in temporaries
+ */
+void opt_cse(struct ast_program *prog);
+
+#endif /* end of include guard: OPT_H_ */
@@ -26,7 +26,10 @@
  */
 
 #include "absyn.h"
+#include "eval.h"
 #include "global.h"
+#include "pass.h"
+#include "postcfg.h"
 #include "semant.h"
 #include "lexer.h"
 %}
@@ -114,8 +117,24 @@ program
     : T_TURTLE T_IDENT var_decls func_decls compound_statement
         {
             $$ = ast_new_program(s_name($2), $3, $4, $5);
+            int folded = pass_enabled("peval") && eval_prog($$) == 0;
+            if (!folded) {
+                pass_run($$);
+            }
+            // Still needed for the semantic checks
             sem_trans_prog($$);
             free($$);
+            if (folded) {
+                eval_emit();
+            } else {
+                postcfg_optimise();
+            }
+            if (rflag) {
+                gen_size_report(stderr);
+            }
+            if (fmap != NULL) {
+                gen_source_map(fmap);
+            }
             if (sflag) {
                 gen_debug();
             } else {
@@ -0,0 +1,128 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "global.h"
+#include "opt.h"
+#include "pass.h"
+
+struct pass {
+    const char     *name;
+    // Lowest -O level the pass runs at
+    int             level;
+    int             disabled;
+    const char     *help;
+    // Rewrites the AST, NULL if the code generator asks pass_enabled()
+    void            (*run)(struct ast_program *prog);
+};
+
+/**
+ * All the passes, in the order they run
+ */
+static struct pass passes[] = {
+    /* AST (opt.c and a file per pass, eval.c) */
+    {"peval", 2, 0, "replace programs that never read with their plot", NULL},
+    {"constglobals", 1, 0, "replace constant global variables with values",
+     opt_const_globals},
+    {"foldcalls", 1, 0, "replace pure calls with constant arguments",
+     opt_fold_calls},
+    {"clone", 2, 0, "specialise functions for constant arguments",
+     opt_clone},
+    {"unroll", 2, 0, "unroll while loops with a constant trip count",
+     opt_unroll},
+    {"div", 2, 0, "replace division loops that -P shows long with a call",
+     opt_div},
+    {"pen", 1, 0, "remove redundant up, down and moveto statements", opt_pen},
+    {"cse", 1, 0, "cache repeated subexpressions in temporaries", opt_cse},
+    /* Code generation (semant.c) */
+    {"rotate", 1, 0, "test while loops at the bottom", NULL},
+    {"cmpzero", 1, 0, "fold constant conditions and test against 0", NULL},
+    {"retslot", 1, 0, "drop unused return slots and dead Rts", NULL},
+    /* Control flow graph of the generated code (postcfg.c) */
+    {"thread", 1, 0, "jump to the final target of a chain of jumps", NULL},
+    {"unreachable", 1, 0, "remove unreachable blocks and functions", NULL},
+    {"peephole", 1, 0, "simplify short instruction sequences", NULL},
+    {"fallthrough", 1, 0, "remove jumps to the next block", NULL},
+};
+
+#define PASS_COUNT ((int) (sizeof(passes) / sizeof(passes[0])))
+
+static struct pass *
+find_pass(const char *name)
+{
+    for (int i = 0; i < PASS_COUNT; ++i) {
+        if (strcmp(passes[i].name, name) == 0) {
+            return passes + i;
+        }
+    }
+
+    return NULL;
+}
+
+int
+pass_enabled(const char *name)
+{
+    struct pass    *p = find_pass(name);
+    check(p, "Unknown pass %s. Please report this to the author.", name);
+    return oflag >= p->level && !p->disabled;
+
+error:
+    return 0;
+}
+
+int
+pass_disable(const char *name)
+{
+    struct pass    *p = find_pass(name);
+
+    if (p == NULL) {
+        return -1;
+    }
+
+    p->disabled = 1;
+    return 0;
+}
+
+void
+pass_run(struct ast_program *prog)
+{
+    for (int i = 0; i < PASS_COUNT; ++i) {
+        if (passes[i].run != NULL && oflag >= passes[i].level &&
+                !passes[i].disabled) {
+            passes[i].run(prog);
+        }
+    }
+}
+
+void
+pass_list(FILE *out)
+{
+    for (int i = 0; i < PASS_COUNT; ++i) {
+        fprintf(out, "%-13s -O%d  %s\n", passes[i].name, passes[i].level,
+                passes[i].help);
+    }
+}
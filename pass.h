@@ -0,0 +1,66 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Pass manager
+ *
+ * Every optimisation has a name and the lowest -O level it runs at. The AST
+ * passes run from the registry through pass_run(), and the code generator
+ * asks pass_enabled() before each of the others, so a single pass can be
+ * switched off with `-x NAME' to measure what it brings.
+ */
+
+#ifndef PASS_H_
+#define PASS_H_
+
+#include <stdio.h>
+
+struct ast_program;
+
+/**
+ * @returns 1 if the pass @name runs at the current -O level and has not been
+ * disabled
+ */
+int pass_enabled(const char *name);
+
+/**
+ * Disables the pass @name
+ *
+ * @returns 0 on success, -1 if there is no such pass
+ */
+int pass_disable(const char *name);
+
+/**
+ * Runs the AST passes that are enabled on @prog, in order
+ */
+void pass_run(struct ast_program *prog);
+
+/**
+ * Lists the passes and the levels they run at
+ */
+void pass_list(FILE *out);
+
+#endif /* end of include guard: PASS_H_ */
@@ -0,0 +1,501 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * PDPlot-2 executor
+ *
+ * Runs a binary image produced by `turtle -o FILE' and writes the plot stream,
+ * or runs it once per input vector of a batch and writes a summary, or serves
+ * interactive sessions on a Unix socket. It also prints the traces it records.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "checkpoint.h"
+#include "dbg.h"
+#include "host.h"
+#include "vm.h"
+#include "profile.h"
+#include "render.h"
+#include "srcmap.h"
+#include "trace.h"
+#include "travel.h"
+#include "vector.h"
+
+static void
+print_help(void)
+{
+    printf("Usage: pdplot [options] image\n"
+           "       pdplot -X FILE [-s STEP] [-n COUNT]\n"
+           "Options:\n"
+           "-i FILE\t\tread the input of `read' from FILE\n"
+           "-o FILE\t\twrite the plot stream to FILE\n"
+           "-m FILE\t\tsource map written by turtle -m\n"
+           "-p FILE\t\twrite the profile to FILE\n"
+           "-f FILE\t\twrite the folded stacks (for flamegraphs) to FILE\n"
+           "-b FILE\t\twrite the branch profile for turtle -P to FILE\n"
+           "-t\t\treorder the strokes to reduce the pen-up travel\n"
+           "-T FILE\t\twrite the pen travel and time estimates to FILE\n"
+           "-R FILE\t\trender the plot to FILE (PNG if it ends with .png, PPM\n"
+           "\t\totherwise)\n"
+           "-W SIZE\t\twidth and height of the rendered image (1024)\n"
+           "-j N\t\trender, or run a batch, with N threads (1, or one\n"
+           "\t\tper CPU for a batch)\n"
+           "-V FILE\t\twrite the plot to FILE as SVG if it ends with .svg,\n"
+           "\t\tas PostScript otherwise\n"
+           "-B PATH\t\trun the image once per line of the file PATH, or per\n"
+           "\t\t.d file in the directory PATH, and write a summary\n"
+           "-O DIR\t\twrite the plot stream of each run of the batch to DIR\n"
+           "-L\t\trun the batch on lockstep machines, 16 runs at a time\n"
+           "-c FILE\t\twrite a checkpoint to FILE every -C steps\n"
+           "-C STEPS\tsteps between two checkpoints (100000000)\n"
+           "-r FILE\t\tresume from the checkpoint FILE, with the same -i and\n"
+           "\t\t-o as when it was taken\n"
+           "-x FILE\t\trecord the trace of the run to FILE\n"
+           "-X FILE\t\tprint the trace FILE, one step per line\n"
+           "-s STEP\t\tfirst step to print (0)\n"
+           "-n COUNT\tnumber of steps to print (all)\n"
+           "-S PATH\t\tserve sessions on the Unix socket PATH: each one reads\n"
+           "\t\tthe input and writes the plot stream through its\n"
+           "\t\tconnection\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    int             c;
+    int             ret = 1;
+    FILE           *in = stdin;
+    FILE           *out = stdout;
+    const char     *out_path = NULL;
+    FILE           *fprofile = NULL;
+    FILE           *ffolded = NULL;
+    FILE           *fbranches = NULL;
+    FILE           *ftravel = NULL;
+    int             tflag = 0;
+    struct travel  *travel = NULL;
+    const char     *render_path = NULL;
+    int             render_size = 1024;
+    // 0 unless given with -j
+    int             threads = 0;
+    struct render  *render = NULL;
+    struct vector  *vector = NULL;
+    const char     *batch_path = NULL;
+    const char     *batch_dir = NULL;
+    int             lflag = 0;
+    struct batch   *batch = NULL;
+    const char     *socket_path = NULL;
+    const char     *checkpoint_path = NULL;
+    const char     *restore_path = NULL;
+    long long       checkpoint_every = 100000000;
+    const char     *trace_path = NULL;
+    const char     *print_path = NULL;
+    long long       print_first = 0,
+                    print_count = -1;
+    struct trace   *trace = NULL;
+    long long       input_offset,
+                    output_offset;
+    enum vm_status  status;
+    struct host    *host = NULL;
+    struct stat     st;
+    // Where the plot stream goes after the optional travel optimiser
+    void          (*pen)(void *data, enum vm_pen_event event, int x, int y);
+    void           *pen_data;
+    struct srcmap  *map = NULL;
+    struct vm_image *image = NULL;
+    struct vm      *vm = NULL;
+    struct profile *profile = NULL;
+
+    while ((c = getopt(argc, argv, "i:o:m:p:f:b:tT:R:W:j:V:B:O:LS:c:C:r:"
+                       "x:X:s:n:h")) != -1) {
+        switch (c) {
+        case 'i':
+            in = fopen(optarg, "r");
+            check(in, "Cannot open the file %s", optarg);
+            break;
+
+        case 'o':
+            out_path = optarg;
+            break;
+
+        case 'm':
+            map = srcmap_load(optarg);
+            check(map, "Cannot load the source map %s", optarg);
+            break;
+
+        case 'p':
+            fprofile = fopen(optarg, "w+");
+            check(fprofile, "Cannot open the file %s for writing", optarg);
+            break;
+
+        case 'f':
+            ffolded = fopen(optarg, "w+");
+            check(ffolded, "Cannot open the file %s for writing", optarg);
+            break;
+
+        case 'b':
+            fbranches = fopen(optarg, "w+");
+            check(fbranches, "Cannot open the file %s for writing", optarg);
+            break;
+
+        case 't':
+            tflag = 1;
+            break;
+
+        case 'T':
+            ftravel = fopen(optarg, "w+");
+            check(ftravel, "Cannot open the file %s for writing", optarg);
+            break;
+
+        case 'R':
+            render_path = optarg;
+            break;
+
+        case 'W':
+            render_size = atoi(optarg);
+            check(render_size > 2 * RENDER_MARGIN &&
+                  render_size <= 0x10000, "Bad image size %s", optarg);
+            break;
+
+        case 'j':
+            threads = atoi(optarg);
+            check(threads > 0 && threads <= 1024,
+                  "Bad number of threads %s", optarg);
+            break;
+
+        case 'V':
+            check(vector == NULL, "Only one vector output is supported");
+            vector = vector_open(optarg);
+            check(vector, "Cannot write the plot to %s", optarg);
+            break;
+
+        case 'B':
+            batch_path = optarg;
+            break;
+
+        case 'O':
+            batch_dir = optarg;
+            check(stat(optarg, &st) == 0 && S_ISDIR(st.st_mode),
+                  "%s is not a directory", optarg);
+            break;
+
+        case 'L':
+            lflag = 1;
+            break;
+
+        case 'S':
+            socket_path = optarg;
+            break;
+
+        case 'c':
+            checkpoint_path = optarg;
+            break;
+
+        case 'C':
+            checkpoint_every = atoll(optarg);
+            check(checkpoint_every > 0, "Bad number of steps %s", optarg);
+            break;
+
+        case 'r':
+            restore_path = optarg;
+            break;
+
+        case 'x':
+            trace_path = optarg;
+            break;
+
+        case 'X':
+            print_path = optarg;
+            break;
+
+        case 's':
+            print_first = atoll(optarg);
+            check(print_first >= 0, "Bad step %s", optarg);
+            break;
+
+        case 'n':
+            print_count = atoll(optarg);
+            check(print_count >= 0, "Bad number of steps %s", optarg);
+            break;
+
+        case 'h':
+        default:
+            print_help();
+            goto error;
+        }
+    }
+
+    if (optind + (print_path == NULL) != argc) {
+        print_help();
+        goto error;
+    }
+
+    // The plot stream is resumed where the checkpoint was taken
+    if (out_path != NULL) {
+        out = fopen(out_path, restore_path != NULL ? "r+" : "w+");
+        check(out, "Cannot open the file %s for writing", out_path);
+    }
+
+    if (print_path != NULL) {
+        if (trace_print(print_path, print_first, print_count, out) == 0) {
+            ret = 0;
+        }
+
+        goto error;
+    }
+
+    check(fbranches == NULL || map != NULL,
+          "The branch profile needs the source map (-m)");
+    image = vm_load_image(argv[optind]);
+    check(image, "Cannot load the image %s", argv[optind]);
+
+    if (socket_path != NULL) {
+        check(batch_path == NULL && in == stdin && out == stdout && !tflag &&
+              ftravel == NULL && render_path == NULL && vector == NULL &&
+              fprofile == NULL && ffolded == NULL && fbranches == NULL &&
+              trace_path == NULL,
+              "-S cannot be used with other options");
+        host = host_new(image);
+        check(host, "Cannot start the host");
+        check(host_listen(host, socket_path) == 0, "Cannot serve on %s",
+              socket_path);
+
+        if (host_run(host) == 0) {
+            ret = 0;
+        }
+
+        goto error;
+    }
+
+    if (batch_path != NULL) {
+        check(in == stdin && !tflag && ftravel == NULL &&
+              render_path == NULL && vector == NULL && fprofile == NULL &&
+              ffolded == NULL && fbranches == NULL && trace_path == NULL,
+              "-B only supports -o, -O, -j and -L");
+        batch = batch_load(batch_path);
+        check(batch, "Cannot load the batch %s", batch_path);
+
+        if (threads == 0) {
+            long            cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = cpus > 0 ? (int) cpus : 1;
+        }
+
+        if (batch_run(batch, image, batch_dir, threads, lflag) == 0) {
+            ret = 0;
+        }
+
+        batch_report(batch, out);
+        goto error;
+    }
+
+    check(batch_dir == NULL && !lflag, "-O and -L need a batch (-B)");
+    vm = vm_new();
+    check_mem(vm);
+    vm_reset(vm, image);
+    vm->in = in;
+
+    // Nothing else may depend on the steps before the checkpoint
+    if (checkpoint_path != NULL || restore_path != NULL) {
+        check(!tflag && ftravel == NULL && render_path == NULL &&
+              vector == NULL && fprofile == NULL && ffolded == NULL &&
+              fbranches == NULL && trace_path == NULL,
+              "-c and -r only support -i, -o, -m and -C");
+        check(out_path != NULL, "-c and -r need the plot stream in a file");
+    }
+
+    if (restore_path != NULL) {
+        check(checkpoint_load(vm, image, &input_offset, &output_offset,
+                              restore_path) == 0,
+              "Cannot resume from %s", restore_path);
+        check(input_offset < 0 || fseek(in, input_offset, SEEK_SET) == 0,
+              "Cannot find where the input was");
+        check(fflush(out) == 0 &&
+              ftruncate(fileno(out), output_offset) == 0 &&
+              fseek(out, output_offset, SEEK_SET) == 0,
+              "Cannot find where the plot stream was");
+    }
+    pen = vm_write_pen;
+    pen_data = out;
+
+    if (render_path != NULL) {
+        render = render_new();
+        check_mem(render);
+        render->forward = pen;
+        render->forward_data = pen_data;
+        pen = render_record;
+        pen_data = render;
+    }
+
+    if (vector != NULL) {
+        vector->forward = pen;
+        vector->forward_data = pen_data;
+        pen = vector_record;
+        pen_data = vector;
+    }
+
+    vm->pen = pen;
+    vm->pen_data = pen_data;
+
+    if (tflag || ftravel != NULL) {
+        travel = travel_new();
+        check_mem(travel);
+        vm->pen = travel_record;
+        vm->pen_data = travel;
+
+        // The stream is passed on once reordered
+        if (!tflag) {
+            travel->forward = pen;
+            travel->forward_data = pen_data;
+        }
+    }
+
+    if (fprofile != NULL || ffolded != NULL || fbranches != NULL) {
+        profile = profile_new();
+        check_mem(profile);
+        vm->profile = profile;
+    }
+
+    if (trace_path != NULL) {
+        trace = trace_new(trace_path, vm);
+        check(trace, "Cannot record the trace to %s", trace_path);
+        vm->trace = trace;
+    }
+
+    // The machine stops at each checkpoint, and checks the step limit only
+    // where it may jump back
+    if (checkpoint_path != NULL) {
+        vm->step_limit = vm->steps + checkpoint_every;
+    }
+
+    while ((status = vm_run(vm)) == vm_running) {
+        check(fflush(out) == 0 &&
+              checkpoint_save(vm, ftell(in), ftell(out),
+                              checkpoint_path) == 0,
+              "Cannot write the checkpoint %s", checkpoint_path);
+        vm->step_limit = vm->steps + checkpoint_every;
+    }
+
+    if (status == vm_halted) {
+        ret = 0;
+    }
+
+    if (trace != NULL) {
+        struct trace   *t = trace;
+        trace = NULL;
+        vm->trace = NULL;
+        check(trace_close(t, vm) == 0,
+              "Cannot record the trace to %s", trace_path);
+    }
+
+    if (travel != NULL) {
+        travel_optimise(travel);
+
+        if (tflag) {
+            travel_replay(travel, pen, pen_data);
+        }
+
+        if (ftravel != NULL) {
+            travel_report(travel, ftravel);
+        }
+    }
+
+    if (render != NULL) {
+        check(render_draw(render, render_size, threads > 0 ? threads : 1)
+              == 0 && render_write(render, render_path) == 0,
+              "Cannot render the plot to %s", render_path);
+    }
+
+    if (profile != NULL) {
+        profile_finish(profile, vm->steps);
+
+        if (fprofile != NULL) {
+            profile_report(profile, image, map, fprofile);
+        }
+
+        if (ffolded != NULL) {
+            profile_folded(profile, map, ffolded);
+        }
+
+        if (fbranches != NULL) {
+            profile_branches(profile, image, map, fbranches);
+        }
+    }
+
+    if (vector != NULL) {
+        struct vector  *v = vector;
+        vector = NULL;
+        check(vector_close(v) == 0, "Cannot write the vector output");
+    }
+
+error:
+    if (vector != NULL) {
+        vector_close(vector);
+    }
+
+    if (trace != NULL) {
+        trace_close(trace, vm);
+    }
+
+    host_free(host);
+    batch_free(batch);
+    travel_free(travel);
+    render_free(render);
+    profile_free(profile);
+    vm_free(vm);
+    free(image);
+    srcmap_free(map);
+
+    if (in != NULL && in != stdin) {
+        fclose(in);
+    }
+
+    if (out != NULL && out != stdout) {
+        fclose(out);
+    }
+
+    if (fprofile != NULL) {
+        fclose(fprofile);
+    }
+
+    if (ffolded != NULL) {
+        fclose(ffolded);
+    }
+
+    if (fbranches != NULL) {
+        fclose(fbranches);
+    }
+
+    if (ftravel != NULL) {
+        fclose(ftravel);
+    }
+
+    return ret;
+}
@@ -0,0 +1,451 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "opt.h"
+
+/**
+ * What is known about the pen at some point, relatively to the entry of the
+ * function for function summaries. pen_none means that the point is never
+ * reached.
+ */
+enum pen_track {
+    pen_none,
+    pen_entry,
+    pen_up,
+    pen_down,
+    pen_at,
+    pen_unknown,
+};
+
+struct pen_state {
+    // pen_none, pen_entry, pen_up, pen_down or pen_unknown
+    enum pen_track  pen;
+    // pen_none, pen_entry, pen_at (x, y) or pen_unknown
+    enum pen_track  pos;
+    int             x;
+    int             y;
+};
+
+/**
+ * Per function: the state on return, and the join of the states at the calls
+ */
+struct pen_fun {
+    struct ast_fun_dec *fun;
+    struct pen_state summary;
+    struct pen_state entry;
+};
+
+static struct pen_fun *_pen_funs;
+static int      _pen_nfuns;
+
+/**
+ * Join of the states at the return statements of the current function
+ */
+static struct pen_state _pen_exit;
+
+/**
+ * Set to delete the redundant statements, or to record the states at calls
+ */
+static int      _pen_rewrite;
+static int      _pen_record;
+static int      _pen_changed;
+
+static struct pen_state pen_join(struct pen_state a, struct pen_state b);
+static int      pen_same(struct pen_state a, struct pen_state b);
+
+/**
+ * @returns @state after a call to a function with @summary
+ */
+static struct pen_state pen_apply(struct pen_state summary,
+                                  struct pen_state state);
+
+static void     pen_call(struct s_symbol *name, struct pen_state *state);
+static void     pen_exp(struct ast_exp *exp, struct pen_state *state);
+static void     pen_exp_list(struct ast_exp_list *list,
+                             struct pen_state *state);
+
+/**
+ * Updates @state with the statements of @list, and deletes the up, down and
+ * moveto statements that do not change it if _pen_rewrite is set
+ */
+static void     pen_stmt_list(struct ast_stmt_list **list,
+                              struct pen_state *state);
+
+/**
+ * @returns the state on return from @f if called in @entry
+ */
+static struct pen_state pen_fun(struct pen_fun *f, struct pen_state entry);
+
+static struct pen_state
+pen_join(struct pen_state a, struct pen_state b)
+{
+    if (a.pen == pen_none) {
+        return b;
+    }
+
+    if (b.pen == pen_none) {
+        return a;
+    }
+
+    if (a.pen != b.pen) {
+        a.pen = pen_unknown;
+    }
+
+    if (a.pos != b.pos ||
+            (a.pos == pen_at && (a.x != b.x || a.y != b.y))) {
+        a.pos = pen_unknown;
+    }
+
+    return a;
+}
+
+static int
+pen_same(struct pen_state a, struct pen_state b)
+{
+    return a.pen == b.pen && a.pos == b.pos &&
+           (a.pos != pen_at || (a.x == b.x && a.y == b.y));
+}
+
+static struct pen_state
+pen_apply(struct pen_state summary, struct pen_state state)
+{
+    if (state.pen == pen_none || summary.pen == pen_none) {
+        state.pen = pen_none;
+        return state;
+    }
+
+    if (summary.pen != pen_entry) {
+        state.pen = summary.pen;
+    }
+
+    if (summary.pos != pen_entry) {
+        state.pos = summary.pos;
+        state.x = summary.x;
+        state.y = summary.y;
+    }
+
+    return state;
+}
+
+static void
+pen_call(struct s_symbol *name, struct pen_state *state)
+{
+    struct pen_fun *f = NULL;
+    int             i;
+
+    for (i = 0; i < _pen_nfuns && f == NULL; ++i) {
+        if (_pen_funs[i].fun->name == name) {
+            f = &_pen_funs[i];
+        }
+    }
+
+    if (f == NULL) {
+        state->pen = pen_unknown;
+        state->pos = pen_unknown;
+        return;
+    }
+
+    if (_pen_record) {
+        struct pen_state entry = pen_join(f->entry, *state);
+
+        if (!pen_same(entry, f->entry)) {
+            f->entry = entry;
+            _pen_changed = 1;
+        }
+    }
+
+    *state = pen_apply(f->summary, *state);
+}
+
+/**
+ * Runs the calls in @exp in the order of the generated code
+ */
+static void
+pen_exp(struct ast_exp *exp, struct pen_state *state)
+{
+    struct ast_exp *first,
+                   *second;
+    struct pen_state again;
+
+    if (exp == NULL) {
+        return;
+    }
+
+    switch (exp->kind) {
+    case ast_callExp:
+        pen_exp_list(exp->u.call.args, state);
+        pen_call(exp->u.call.func, state);
+        break;
+
+    case ast_opExp:
+        if (ast_operand_order(exp, &first, &second) == 1) {
+            pen_exp(first, state);
+            pen_exp(second, state);
+            break;
+        }
+
+        // <= and >= run the operands again unless the first test holds
+        pen_exp(first, state);
+        pen_exp(second, state);
+        again = *state;
+        pen_exp(first, &again);
+        pen_exp(second, &again);
+        *state = pen_join(*state, again);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void
+pen_exp_list(struct ast_exp_list *list, struct pen_state *state)
+{
+    for (; list; list = list->tail) {
+        pen_exp(list->head, state);
+    }
+}
+
+static void
+pen_stmt_list(struct ast_stmt_list **list, struct pen_state *state)
+{
+    struct ast_stmt_list **p = list;
+    struct pen_state then,
+                    in,
+                    body;
+    int             x,
+                    y,
+                    redundant,
+                    rewrite;
+
+    while (*p != NULL) {
+        struct ast_stmt_list *node = *p;
+        struct ast_stmt *stmt = node->head;
+
+        // Dead code
+        if (state->pen == pen_none) {
+            return;
+        }
+
+        redundant = 0;
+
+        switch (stmt->kind) {
+        case ast_upStmt:
+            redundant = state->pen == pen_up;
+            state->pen = pen_up;
+            break;
+
+        case ast_downStmt:
+            redundant = state->pen == pen_down;
+            state->pen = pen_down;
+            break;
+
+        case ast_moveStmt:
+            pen_exp(stmt->u.move.exp1, state);
+            pen_exp(stmt->u.move.exp2, state);
+
+            if (ast_const_value(stmt->u.move.exp1, &x) &&
+                    ast_const_value(stmt->u.move.exp2, &y)) {
+                redundant = state->pos == pen_at &&
+                            state->x == x && state->y == y;
+                state->pos = pen_at;
+                state->x = x;
+                state->y = y;
+            } else {
+                state->pos = pen_unknown;
+            }
+
+            break;
+
+        case ast_assignStmt:
+            pen_exp(stmt->u.assign.exp, state);
+            break;
+
+        case ast_iftStmt:
+            pen_exp(stmt->u.ift.test, state);
+            then = *state;
+            pen_stmt_list(&stmt->u.ift.then, &then);
+            *state = pen_join(*state, then);
+            break;
+
+        case ast_ifteStmt:
+            pen_exp(stmt->u.ifte.test, state);
+            then = *state;
+            pen_stmt_list(&stmt->u.ifte.then, &then);
+            pen_stmt_list(&stmt->u.ifte.elsee, state);
+            *state = pen_join(*state, then);
+            break;
+
+        case ast_whileStmt:
+            // Iterate until the state at the test is stable, without
+            // deleting anything on the way
+            rewrite = _pen_rewrite;
+            _pen_rewrite = 0;
+            in = *state;
+
+            for (;;) {
+                body = in;
+                pen_exp(stmt->u.whilee.test, &body);
+                *state = body;
+                pen_stmt_list(&stmt->u.whilee.body, &body);
+                body = pen_join(in, body);
+
+                if (pen_same(body, in)) {
+                    break;
+                }
+
+                in = body;
+            }
+
+            _pen_rewrite = rewrite;
+
+            if (_pen_rewrite) {
+                body = *state;
+                pen_stmt_list(&stmt->u.whilee.body, &body);
+            }
+
+            break;
+
+        case ast_returnStmt:
+            pen_exp(stmt->u.returnn.exp, state);
+            _pen_exit = pen_join(_pen_exit, *state);
+            state->pen = pen_none;
+            break;
+
+        case ast_callStmt:
+            pen_exp_list(stmt->u.call.args, state);
+            pen_call(stmt->u.call.func, state);
+            break;
+
+        case ast_exp_listStmt:
+            pen_exp_list(stmt->u.seq, state);
+            break;
+
+        default:
+            break;
+        }
+
+        if (_pen_rewrite && redundant) {
+            *p = node->tail;
+            node->tail = NULL;
+            ast_free_stmt_list(node);
+        } else {
+            p = &node->tail;
+        }
+    }
+}
+
+static struct pen_state
+pen_fun(struct pen_fun *f, struct pen_state entry)
+{
+    struct ast_var_dec_list *v;
+
+    for (v = f->fun->var; v; v = v->tail) {
+        pen_exp(v->head->init, &entry);
+    }
+
+    _pen_exit.pen = pen_none;
+    pen_stmt_list(&f->fun->body, &entry);
+    return pen_join(_pen_exit, entry);
+}
+
+void
+opt_pen(struct ast_program *prog)
+{
+    struct ast_fun_dec_list *p;
+    // The machine starts with the pen up at (0, 0)
+    struct pen_state start = { pen_up, pen_at, 0, 0 };
+    struct pen_state relative = { pen_entry, pen_entry, 0, 0 };
+    struct pen_state unknown = { pen_unknown, pen_unknown, 0, 0 };
+    struct pen_state none = { pen_none, pen_none, 0, 0 };
+    struct pen_state state;
+    int             i,
+                    round;
+
+    _pen_nfuns = 0;
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        ++_pen_nfuns;
+    }
+
+    _pen_funs = calloc(_pen_nfuns + 1, sizeof(*_pen_funs));
+    check_mem(_pen_funs);
+
+    for (i = 0, p = prog->func_def_list; p; p = p->tail, ++i) {
+        _pen_funs[i].fun = p->head;
+        _pen_funs[i].summary = unknown;
+        _pen_funs[i].entry = none;
+    }
+
+    // Each round only relies on the summaries of the previous one, so they
+    // are safe to use even if they are not stable yet
+    for (round = 0, _pen_changed = 1; round < 8 && _pen_changed; ++round) {
+        _pen_changed = 0;
+
+        for (i = 0; i < _pen_nfuns; ++i) {
+            state = pen_fun(&_pen_funs[i], relative);
+
+            if (!pen_same(state, _pen_funs[i].summary)) {
+                _pen_funs[i].summary = state;
+                _pen_changed = 1;
+            }
+        }
+    }
+
+    _pen_record = 1;
+
+    do {
+        _pen_changed = 0;
+        state = start;
+        pen_stmt_list(&prog->body, &state);
+
+        for (i = 0; i < _pen_nfuns; ++i) {
+            if (_pen_funs[i].entry.pen != pen_none) {
+                pen_fun(&_pen_funs[i], _pen_funs[i].entry);
+            }
+        }
+    } while (_pen_changed);
+
+    _pen_record = 0;
+    _pen_rewrite = 1;
+    state = start;
+    pen_stmt_list(&prog->body, &state);
+
+    // The functions that are never called are left alone
+    for (i = 0; i < _pen_nfuns; ++i) {
+        if (_pen_funs[i].entry.pen != pen_none) {
+            pen_fun(&_pen_funs[i], _pen_funs[i].entry);
+        }
+    }
+
+    _pen_rewrite = 0;
+
+error:
+    free(_pen_funs);
+    _pen_funs = NULL;
+    _pen_nfuns = 0;
+}
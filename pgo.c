@@ -0,0 +1,139 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "pgo.h"
+
+struct pgo_branch {
+    int             line;
+    int             column;
+    long long       taken;
+    long long       not_taken;
+    struct pgo_branch *next;
+};
+
+struct pgo_fun {
+    char           *name;
+    long long       calls;
+    struct pgo_fun *next;
+};
+
+static int      loaded = 0;
+static struct pgo_branch *_branches;
+static struct pgo_fun *_funs;
+
+int
+pgo_load(const char *path)
+{
+    FILE           *f = fopen(path, "r");
+    char            line[1024];
+    check(f, "Cannot open the file %s", path);
+    check(fgets(line, sizeof(line), f) != NULL &&
+          strcmp(line, "turtle-branch-profile 1\n") == 0,
+          "%s is not a branch profile", path);
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        struct pgo_branch b;
+        char            name[1024];
+        long long       calls;
+
+        if (sscanf(line, "branch %d %d %lld %lld", &b.line, &b.column,
+                   &b.taken, &b.not_taken) == 4) {
+            struct pgo_branch *p;
+
+            // Several branches may come from the same statement
+            for (p = _branches; p != NULL; p = p->next) {
+                if (p->line == b.line && p->column == b.column) {
+                    break;
+                }
+            }
+
+            if (p == NULL) {
+                p = malloc(sizeof(*p));
+                check_mem(p);
+                *p = b;
+                p->next = _branches;
+                _branches = p;
+            } else {
+                p->taken += b.taken;
+                p->not_taken += b.not_taken;
+            }
+        } else if (sscanf(line, "fun %1023s %lld", name, &calls) == 2) {
+            struct pgo_fun *p = malloc(sizeof(*p));
+            check_mem(p);
+            p->name = strdup(name);
+            check_mem(p->name);
+            p->calls = calls;
+            p->next = _funs;
+            _funs = p;
+        } else {
+            sentinel("Cannot parse \"%s\" in %s", line, path);
+        }
+    }
+
+    fclose(f);
+    loaded = 1;
+    return 0;
+
+error:
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    return -1;
+}
+
+int
+pgo_loaded(void)
+{
+    return loaded;
+}
+
+int
+pgo_branch(YYLTYPE pos, long long *taken, long long *not_taken)
+{
+    for (struct pgo_branch *p = _branches; p != NULL; p = p->next) {
+        if (p->line == pos.first_line && p->column == pos.first_column) {
+            *taken = p->taken;
+            *not_taken = p->not_taken;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+long long
+pgo_calls(char *name)
+{
+    for (struct pgo_fun *p = _funs; p != NULL; p = p->next) {
+        if (strcmp(p->name, name) == 0) {
+            return p->calls;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Profile-guided optimisation
+ *
+ * Reads the branch profile written by `pdplot -b FILE' so that the code
+ * generator can lay out the rarely executed code out of line.
+ */
+
+#ifndef PGO_H_
+#define PGO_H_
+
+#include "global.h"
+
+/**
+ * Loads the branch profile in @path
+ *
+ * @returns 0 on success
+ */
+int pgo_load(const char *path);
+
+/**
+ * @returns 1 if a profile is loaded
+ */
+int pgo_loaded(void);
+
+/**
+ * Looks up the counts of the conditional branches generated for the statement
+ * at @pos
+ *
+ * @returns 1 if the statement was executed when the profile was taken
+ */
+int pgo_branch(YYLTYPE pos, long long *taken, long long *not_taken);
+
+/**
+ * @returns the number of times the function @name was called
+ */
+long long pgo_calls(char *name);
+
+#endif /* end of include guard: PGO_H_ */
@@ -0,0 +1,523 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "pass.h"
+#include "postcfg.h"
+
+/**
+ * Longest chain of jumps followed by thread_jumps()
+ */
+#define THREAD_LIMIT 16
+
+/**
+ * @returns 1 if @kind is followed by an operand word
+ */
+static int      has_operand(enum I_instruction kind);
+
+/**
+ * @returns 1 if @kind refers to a block
+ */
+static int      has_target(enum I_instruction kind);
+
+/**
+ * @returns 1 if control never goes past @kind
+ */
+static int      ends_flow(enum I_instruction kind);
+
+static struct postcfg_block *new_block(struct postcfg *g);
+static void     append(struct postcfg_block *b,
+                       const struct postcfg_insn *insn);
+
+/**
+ * Removes the @n instructions of @b from @at
+ */
+static void     drop(struct postcfg_block *b, int at, int n);
+
+/**
+ * The passes
+ */
+static void     thread_jumps(struct postcfg *g);
+static void     remove_unreachable(struct postcfg *g);
+static void     peephole(struct postcfg *g);
+static void     remove_fallthrough_jumps(struct postcfg *g);
+
+static int
+has_operand(enum I_instruction kind)
+{
+    switch (kind) {
+    case I_Jsr:
+    case I_Jump:
+    case I_Jeq:
+    case I_Jlt:
+    case I_Loadi:
+    case I_Pop:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+static int
+has_target(enum I_instruction kind)
+{
+    switch (kind) {
+    case I_Jsr:
+    case I_Jump:
+    case I_Jeq:
+    case I_Jlt:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+static int
+ends_flow(enum I_instruction kind)
+{
+    return kind == I_Jump || kind == I_Rts || kind == I_Halt;
+}
+
+static struct postcfg_block *
+new_block(struct postcfg *g)
+{
+    struct postcfg_block *b = calloc(1, sizeof(*b));
+    check_mem(b);
+    b->id = g->count++;
+    return b;
+
+error:
+    panic();
+    return NULL;
+}
+
+static void
+append(struct postcfg_block *b, const struct postcfg_insn *insn)
+{
+    if (b->count == b->capacity) {
+        b->capacity = b->capacity ? 2 * b->capacity : 8;
+        b->insns = realloc(b->insns, b->capacity * sizeof(*b->insns));
+        check_mem(b->insns);
+    }
+
+    b->insns[b->count++] = *insn;
+    return;
+
+error:
+    panic();
+}
+
+static void
+drop(struct postcfg_block *b, int at, int n)
+{
+    for (int i = at + n; i < b->count; ++i) {
+        b->insns[i - n] = b->insns[i];
+    }
+
+    b->count -= n;
+}
+
+struct postcfg *
+postcfg_build(void)
+{
+    const struct instruction *code = gen_code();
+    int             n = get_next_code_index();
+    struct postcfg *g = calloc(1, sizeof(*g));
+    struct postcfg_block **block_at = calloc(n + 1, sizeof(*block_at));
+    char           *leader = calloc(n + 1, 1);
+    struct postcfg_block *b = NULL,
+                    **last;
+    int             i;
+    check_mem(g);
+    check_mem(block_at);
+    check_mem(leader);
+
+    // Pass 1: find the first instruction of every block
+    leader[0] = 1;
+
+    for (i = 0; i < n; i += has_operand(code[i].kind) ? 2 : 1) {
+        if (has_operand(code[i].kind)) {
+            check(i + 1 < n && code[i + 1].kind == I_Word,
+                  "Missing operand at %d", i);
+        }
+
+        if (has_target(code[i].kind)) {
+            int             addr = code[i + 1].op;
+            check(addr >= 0 && addr <= n, "Jump out of the program at %d", i);
+            leader[addr] = 1;
+        }
+
+        if (ends_flow(code[i].kind) || code[i].kind == I_Jeq ||
+                code[i].kind == I_Jlt) {
+            leader[i + (has_operand(code[i].kind) ? 2 : 1)] = 1;
+        }
+    }
+
+    // Pass 2: create the blocks
+    last = &g->first;
+
+    for (i = 0; i <= n; ++i) {
+        if (leader[i]) {
+            b = new_block(g);
+            block_at[i] = b;
+            *last = b;
+            last = &b->next;
+        }
+    }
+
+    // Pass 3: fill them
+    b = NULL;
+
+    for (i = 0; i < n; i += has_operand(code[i].kind) ? 2 : 1) {
+        struct postcfg_insn insn;
+
+        if (block_at[i] != NULL) {
+            b = block_at[i];
+        }
+
+        check(b != NULL, "No block at %d", i);
+        insn.i = code[i];
+        insn.target = NULL;
+
+        if (has_operand(code[i].kind)) {
+            insn.i.op = code[i + 1].op;
+        }
+
+        if (has_target(code[i].kind)) {
+            insn.target = block_at[insn.i.op];
+        }
+
+        append(b, &insn);
+    }
+
+    for (b = g->first; b; b = b->next) {
+        if (b->count == 0 || !ends_flow(b->insns[b->count - 1].i.kind)) {
+            b->fall = b->next;
+        }
+    }
+
+    free(block_at);
+    free(leader);
+    return g;
+
+error:
+    panic();
+    return NULL;
+}
+
+void
+postcfg_emit(struct postcfg *g)
+{
+    struct postcfg_block *b;
+    struct instruction w;
+    int             addr = 0;
+
+    // Pass 1: addresses. A block that does not fall through to the block that
+    // follows it gets an extra Jump.
+    for (b = g->first; b; b = b->next) {
+        b->addr = addr;
+
+        for (int i = 0; i < b->count; ++i) {
+            addr += has_operand(b->insns[i].i.kind) ? 2 : 1;
+        }
+
+        if (b->fall != NULL && b->fall != b->next) {
+            struct postcfg_insn jump;
+            memset(&jump, 0, sizeof(jump));
+            jump.i.owner = -1;
+
+            if (b->count > 0) {
+                jump.i = b->insns[b->count - 1].i;
+            }
+
+            jump.i.kind = I_Jump;
+            jump.target = b->fall;
+            append(b, &jump);
+            b->fall = NULL;
+            addr += 2;
+        }
+    }
+
+    // Pass 2: instructions
+    discard_code(0);
+
+    for (b = g->first; b; b = b->next) {
+        for (int i = 0; i < b->count; ++i) {
+            struct postcfg_insn *insn = b->insns + i;
+
+            if (insn->target != NULL) {
+                insn->i.op = insn->target->addr;
+            }
+
+            gen_copy(&insn->i);
+
+            if (has_operand(insn->i.kind)) {
+                w = insn->i;
+                w.kind = I_Word;
+                gen_copy(&w);
+            }
+        }
+    }
+}
+
+void
+postcfg_free(struct postcfg *g)
+{
+    while (g->first != NULL) {
+        struct postcfg_block *b = g->first;
+        g->first = b->next;
+        free(b->insns);
+        free(b);
+    }
+
+    free(g);
+}
+
+/**
+ * Jumps to a block that only jumps go to the final target, and jumps to a
+ * block that only returns or halts are replaced by the Rts or the Halt.
+ */
+static void
+thread_jumps(struct postcfg *g)
+{
+    struct postcfg_block *b;
+
+    for (b = g->first; b; b = b->next) {
+        for (int i = 0; i < b->count; ++i) {
+            struct postcfg_insn *insn = b->insns + i;
+
+            if (insn->i.kind != I_Jump && insn->i.kind != I_Jeq &&
+                    insn->i.kind != I_Jlt) {
+                continue;
+            }
+
+            for (int hops = 0; hops < THREAD_LIMIT; ++hops) {
+                struct postcfg_block *t = insn->target;
+
+                if (t->count == 1 && t->insns[0].i.kind == I_Jump &&
+                        t->insns[0].target != t) {
+                    insn->target = t->insns[0].target;
+                } else if (t->count == 0 && t->fall != NULL) {
+                    insn->target = t->fall;
+                } else {
+                    break;
+                }
+            }
+
+            struct postcfg_block *t = insn->target;
+
+            if (insn->i.kind == I_Jump && t->count == 1 &&
+                    (t->insns[0].i.kind == I_Rts ||
+                     t->insns[0].i.kind == I_Halt)) {
+                insn->i.kind = t->insns[0].i.kind;
+                insn->target = NULL;
+            }
+        }
+    }
+}
+
+/**
+ * Removes the blocks that cannot be reached from the first one, including
+ * the functions that are never called
+ */
+static void
+remove_unreachable(struct postcfg *g)
+{
+    struct postcfg_block *b,
+                  **stack,
+                  **p;
+    int             top = 0;
+    stack = malloc(g->count * sizeof(*stack));
+    check_mem(stack);
+
+    for (b = g->first; b; b = b->next) {
+        b->mark = 0;
+    }
+
+    g->first->mark = 1;
+    stack[top++] = g->first;
+
+    while (top > 0) {
+        b = stack[--top];
+
+        if (b->fall != NULL && !b->fall->mark) {
+            b->fall->mark = 1;
+            stack[top++] = b->fall;
+        }
+
+        for (int i = 0; i < b->count; ++i) {
+            struct postcfg_block *t = b->insns[i].target;
+
+            if (t != NULL && !t->mark) {
+                t->mark = 1;
+                stack[top++] = t;
+            }
+        }
+    }
+
+    for (p = &g->first; *p != NULL;) {
+        b = *p;
+
+        if (b->mark) {
+            p = &b->next;
+        } else {
+            *p = b->next;
+            free(b->insns);
+            free(b);
+        }
+    }
+
+    free(stack);
+    return;
+
+error:
+    panic();
+}
+
+/**
+ * Simplifies, until nothing changes, in every block:
+ *
+ *      Pop 0                       (nothing)
+ *      Pop a; Pop b                Pop a+b
+ *      Loadi a; Pop n / Load a; Pop n
+ *                                  Pop n-1
+ *      Loadi 0; Add / Loadi 0; Sub / Loadi 1; Mul / Neg; Neg
+ *                                  (nothing)
+ *      Loadi a; Loadi b; Add       Loadi a+b, and so on for Sub and Mul
+ *      Loadi a; Neg                Loadi -a
+ *
+ * None of the instructions involved sets the flags.
+ */
+static void
+peephole(struct postcfg *g)
+{
+    struct postcfg_block *b;
+    int             changed;
+
+    for (b = g->first; b; b = b->next) {
+        do {
+            changed = 0;
+
+            for (int i = 0; i < b->count; ++i) {
+                struct instruction *x = &b->insns[i].i;
+                struct instruction *y = i + 1 < b->count ?
+                                        &b->insns[i + 1].i : NULL;
+                struct instruction *z = i + 2 < b->count ?
+                                        &b->insns[i + 2].i : NULL;
+
+                if (x->kind == I_Pop && x->op == 0) {
+                    drop(b, i, 1);
+                } else if (y == NULL) {
+                    break;
+                } else if (x->kind == I_Pop && y->kind == I_Pop) {
+                    x->op += y->op;
+                    drop(b, i + 1, 1);
+                } else if ((x->kind == I_Loadi || x->kind == I_Load_GP ||
+                            x->kind == I_Load_FP) &&
+                           y->kind == I_Pop && y->op > 0) {
+                    --y->op;
+                    drop(b, i, 1);
+                } else if ((x->kind == I_Loadi && x->op == 0 &&
+                            (y->kind == I_Add || y->kind == I_Sub)) ||
+                           (x->kind == I_Loadi && x->op == 1 &&
+                            y->kind == I_Mul) ||
+                           (x->kind == I_Neg && y->kind == I_Neg)) {
+                    drop(b, i, 2);
+                } else if (x->kind == I_Loadi && y->kind == I_Neg) {
+                    x->op = (int16_t) -x->op;
+                    drop(b, i + 1, 1);
+                } else if (x->kind == I_Loadi && y->kind == I_Loadi &&
+                           z != NULL && (z->kind == I_Add ||
+                                         z->kind == I_Sub ||
+                                         z->kind == I_Mul)) {
+                    x->op = (int16_t) (z->kind == I_Add ? x->op + y->op :
+                                       z->kind == I_Sub ? x->op - y->op :
+                                       x->op * y->op);
+                    drop(b, i + 1, 2);
+                } else {
+                    continue;
+                }
+
+                changed = 1;
+                break;
+            }
+        } while (changed);
+    }
+}
+
+/**
+ * Removes the Jump at the end of a block that goes to the next block
+ */
+static void
+remove_fallthrough_jumps(struct postcfg *g)
+{
+    struct postcfg_block *b;
+
+    for (b = g->first; b; b = b->next) {
+        struct postcfg_insn *last = b->count ? b->insns + b->count - 1 : NULL;
+
+        if (last != NULL && last->i.kind == I_Jump &&
+                last->target == b->next) {
+            b->fall = b->next;
+            --b->count;
+        }
+    }
+}
+
+void
+postcfg_optimise(void)
+{
+    if (!pass_enabled("thread") && !pass_enabled("unreachable") &&
+            !pass_enabled("peephole") && !pass_enabled("fallthrough")) {
+        return;
+    }
+
+    struct postcfg *g = postcfg_build();
+
+    if (pass_enabled("peephole")) {
+        peephole(g);
+    }
+
+    if (pass_enabled("thread")) {
+        thread_jumps(g);
+    }
+
+    if (pass_enabled("unreachable")) {
+        remove_unreachable(g);
+    }
+
+    if (pass_enabled("fallthrough")) {
+        remove_fallthrough_jumps(g);
+    }
+
+    postcfg_emit(g);
+    postcfg_free(g);
+}
@@ -0,0 +1,91 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Control flow graph of the generated code
+ *
+ * semant.c translates the AST straight to the flat array of instructions in
+ * instruction.c, and backpatches the jumps by index. Once it is done, this
+ * file lifts that array into basic blocks, where jumps and calls refer to
+ * blocks instead of addresses, runs the jump and peephole passes enabled by
+ * the pass manager (see pass.h) and emits the blocks back with the addresses
+ * recomputed. It is not an IR the AST is lowered to: the passes only see the
+ * instructions, not the variables or expressions behind them.
+ */
+
+#ifndef POSTCFG_H_
+#define POSTCFG_H_
+
+#include "instruction.h"
+
+struct postcfg_block;
+
+struct postcfg_insn {
+    // The operand, if any, is in i.op. There is no I_Word.
+    struct instruction i;
+    // Jump, Jeq, Jlt and Jsr: where it goes
+    struct postcfg_block *target;
+};
+
+struct postcfg_block {
+    int             id;
+    struct postcfg_insn *insns;
+    int             count;
+    int             capacity;
+    // The block that follows in the code
+    struct postcfg_block *next;
+    // The block executed next unless the last instruction jumps, i.e., NULL
+    // if the block ends with Jump, Rts or Halt
+    struct postcfg_block *fall;
+    // Scratch space for the passes and the emitter
+    int             mark;
+    int             addr;
+};
+
+struct postcfg {
+    // The program starts with the first block
+    struct postcfg_block *first;
+    int             count;
+};
+
+/**
+ * @returns the control flow graph of the instructions generated so far
+ */
+struct postcfg *postcfg_build(void);
+
+/**
+ * Replaces the instructions generated so far with the ones of @g
+ */
+void            postcfg_emit(struct postcfg *g);
+
+void            postcfg_free(struct postcfg *g);
+
+/**
+ * Runs the enabled passes on the generated instructions
+ */
+void            postcfg_optimise(void);
+
+#endif /* end of include guard: POSTCFG_H_ */
@@ -0,0 +1,398 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbg.h"
+#include "profile.h"
+
+/**
+ * Number of entries listed in each table of profile_report()
+ */
+#define PROFILE_TOP 10
+
+/**
+ * Instructions executed at a source line
+ */
+struct line_count {
+    int             fun;
+    int             line;
+    long long       count;
+};
+
+struct profile *
+profile_new(void)
+{
+    struct profile *p = calloc(1, sizeof(*p));
+    check_mem(p);
+    p->root.entry = -1;
+    p->current = &p->root;
+    return p;
+
+error:
+    return NULL;
+}
+
+void
+profile_call(struct profile *p, int entry, long long steps)
+{
+    struct profile_node *n;
+
+    p->current->self += steps - p->last;
+    p->last = steps;
+
+    for (n = p->current->child; n != NULL; n = n->sibling) {
+        if (n->entry == entry) {
+            break;
+        }
+    }
+
+    if (n == NULL) {
+        n = calloc(1, sizeof(*n));
+        check_mem(n);
+        n->entry = entry;
+        n->parent = p->current;
+        n->sibling = p->current->child;
+        p->current->child = n;
+    }
+
+    p->current = n;
+    ++p->calls[entry];
+
+    // Only the outermost activation of a recursive function counts towards
+    // its inclusive time
+    if (p->active[entry]++ == 0) {
+        p->entered_at[entry] = steps;
+    }
+
+    return;
+
+error:
+    exit(1);
+}
+
+void
+profile_return(struct profile *p, long long steps)
+{
+    struct profile_node *n = p->current;
+
+    n->self += steps - p->last;
+    p->last = steps;
+
+    if (n->parent == NULL) {
+        return;
+    }
+
+    if (--p->active[n->entry] == 0) {
+        p->inclusive[n->entry] += steps - p->entered_at[n->entry];
+    }
+
+    p->current = n->parent;
+}
+
+void
+profile_finish(struct profile *p, long long steps)
+{
+    while (p->current->parent != NULL) {
+        profile_return(p, steps);
+    }
+
+    p->current->self += steps - p->last;
+    p->last = steps;
+}
+
+static const char *
+fun_name(const struct srcmap *map, int entry, char *buf, size_t size)
+{
+    const char     *name = NULL;
+
+    if (entry < 0) {
+        return "(main)";
+    }
+
+    if (map != NULL) {
+        name = srcmap_fun_name(map, entry);
+    }
+
+    if (name == NULL) {
+        snprintf(buf, size, "fun_%d", entry);
+        name = buf;
+    }
+
+    return name;
+}
+
+/**
+ * Adds the self counts in the subtree @n to @exclusive, per entry address
+ */
+static void
+sum_exclusive(const struct profile_node *n, long long *exclusive)
+{
+    for (; n != NULL; n = n->sibling) {
+        if (n->entry >= 0) {
+            exclusive[n->entry] += n->self;
+        }
+
+        sum_exclusive(n->child, exclusive);
+    }
+}
+
+static int
+cmp_line_count_pos(const void *a, const void *b)
+{
+    const struct line_count *x = a;
+    const struct line_count *y = b;
+
+    if (x->fun != y->fun) {
+        return x->fun - y->fun;
+    }
+
+    return x->line - y->line;
+}
+
+static int
+cmp_line_count(const void *a, const void *b)
+{
+    const struct line_count *x = a;
+    const struct line_count *y = b;
+
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+
+    return cmp_line_count_pos(a, b);
+}
+
+static void
+report_lines(struct profile *p, const struct vm_image *image,
+             const struct srcmap *map, FILE *out)
+{
+    struct line_count *lines = malloc((image->size + 1) * sizeof(*lines));
+    int             n = 0;
+    long long       total = 0;
+    check_mem(lines);
+
+    for (int pc = 0; pc < image->size; ++pc) {
+        const struct srcmap_range *r;
+
+        if (p->pc_count[pc] == 0 || (r = srcmap_find(map, pc)) == NULL) {
+            continue;
+        }
+
+        lines[n].fun = r->fun;
+        lines[n].line = r->line;
+        lines[n].count = p->pc_count[pc];
+        total += p->pc_count[pc];
+        ++n;
+    }
+
+    qsort(lines, n, sizeof(*lines), cmp_line_count_pos);
+
+    int             m = 0;
+
+    for (int i = 0; i < n; ++i) {
+        if (m > 0 && cmp_line_count_pos(lines + m - 1, lines + i) == 0) {
+            lines[m - 1].count += lines[i].count;
+        } else {
+            lines[m++] = lines[i];
+        }
+    }
+
+    qsort(lines, m, sizeof(*lines), cmp_line_count);
+    fprintf(out, "\nHottest source lines:\n");
+    fprintf(out, "%14s %6s  %s\n", "count", "%", "line");
+
+    for (int i = 0; i < m && i < PROFILE_TOP; ++i) {
+        fprintf(out, "%14lld %6.2f  %d in %s\n", lines[i].count,
+                total ? 100.0 * lines[i].count / total : 0.0, lines[i].line,
+                lines[i].fun >= 0 && lines[i].fun < map->nfuns ?
+                map->funs[lines[i].fun] : "(unknown)");
+    }
+
+    free(lines);
+    return;
+
+error:
+    exit(1);
+}
+
+void
+profile_report(struct profile *p, const struct vm_image *image,
+               const struct srcmap *map, FILE *out)
+{
+    long long       total = 0;
+    long long       op_count[0x80] = { 0 };
+    long long      *exclusive = calloc(VM_CODE_SIZE, sizeof(*exclusive));
+    char            buf[32];
+    check_mem(exclusive);
+
+    for (int pc = 0; pc < image->size; ++pc) {
+        total += p->pc_count[pc];
+        op_count[(image->code[pc] >> 8) & 0x7E] += p->pc_count[pc];
+    }
+
+    fprintf(out, "Instructions executed: %lld\n", total);
+
+    sum_exclusive(p->root.child, exclusive);
+    fprintf(out, "\nFunctions:\n");
+    fprintf(out, "%10s %14s %14s  %s\n", "calls", "inclusive", "exclusive",
+            "function");
+    fprintf(out, "%10d %14lld %14lld  %s\n", 1, total, p->root.self,
+            fun_name(map, -1, buf, sizeof(buf)));
+
+    for (int entry = 0; entry < VM_CODE_SIZE; ++entry) {
+        if (p->calls[entry] == 0) {
+            continue;
+        }
+
+        fprintf(out, "%10lld %14lld %14lld  %s\n", p->calls[entry],
+                p->inclusive[entry], exclusive[entry],
+                fun_name(map, entry, buf, sizeof(buf)));
+    }
+
+    fprintf(out, "\nOpcodes:\n");
+
+    for (int op = 0; op < 0x80; ++op) {
+        if (op_count[op] != 0) {
+            fprintf(out, "%14lld  %s\n", op_count[op],
+                    vm_opcode_name(op) ? vm_opcode_name(op) : "?");
+        }
+    }
+
+    if (map != NULL) {
+        report_lines(p, image, map, out);
+    }
+
+    free(exclusive);
+    return;
+
+error:
+    exit(1);
+}
+
+/**
+ * Writes the folded stacks of the subtree @n, whose path is @path[0..len)
+ */
+static void
+fold(const struct profile_node *n, const struct srcmap *map, char **path,
+     size_t *cap, size_t len, FILE *out)
+{
+    char            buf[32];
+    const char     *name = fun_name(map, n->entry, buf, sizeof(buf));
+    size_t          need = len + strlen(name) + 2;
+
+    if (need > *cap) {
+        *cap = need * 2;
+        *path = realloc(*path, *cap);
+        check_mem(*path);
+    }
+
+    if (len > 0) {
+        (*path)[len++] = ';';
+    }
+
+    strcpy(*path + len, name);
+    len += strlen(name);
+
+    if (n->self != 0) {
+        fprintf(out, "%s %lld\n", *path, n->self);
+    }
+
+    for (const struct profile_node *c = n->child; c != NULL; c = c->sibling) {
+        fold(c, map, path, cap, len, out);
+    }
+
+    return;
+
+error:
+    exit(1);
+}
+
+void
+profile_folded(struct profile *p, const struct srcmap *map, FILE *out)
+{
+    size_t          cap = 256;
+    char           *path = malloc(cap);
+    check_mem(path);
+    fold(&p->root, map, &path, &cap, 0, out);
+    free(path);
+    return;
+
+error:
+    exit(1);
+}
+
+void
+profile_branches(struct profile *p, const struct vm_image *image,
+                 const struct srcmap *map, FILE *out)
+{
+    fprintf(out, "turtle-branch-profile 1\n");
+
+    for (int pc = 0; pc < image->size; ++pc) {
+        int             op = (image->code[pc] >> 8) & 0x7E;
+        const struct srcmap_range *r;
+
+        if ((op != VM_Jeq && op != VM_Jlt) || p->pc_count[pc] == 0 ||
+                (r = srcmap_find(map, pc)) == NULL) {
+            continue;
+        }
+
+        fprintf(out, "branch %d %d %lld %lld\n", r->line, r->column,
+                p->taken[pc], p->pc_count[pc] - p->taken[pc]);
+    }
+
+    for (int entry = 0; entry < VM_CODE_SIZE; ++entry) {
+        const char     *name;
+
+        if (p->calls[entry] != 0 &&
+                (name = srcmap_fun_name(map, entry)) != NULL) {
+            fprintf(out, "fun %s %lld\n", name, p->calls[entry]);
+        }
+    }
+}
+
+static void
+free_nodes(struct profile_node *n)
+{
+    while (n != NULL) {
+        struct profile_node *next = n->sibling;
+        free_nodes(n->child);
+        free(n);
+        n = next;
+    }
+}
+
+void
+profile_free(struct profile *p)
+{
+    if (p == NULL) {
+        return;
+    }
+
+    free_nodes(p->root.child);
+    free(p);
+}
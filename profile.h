@@ -0,0 +1,149 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Instruction and function level profiler for the virtual machine
+ *
+ * The machine calls profile_count() for every instruction and
+ * profile_call()/profile_return() on Jsr/Rts. Functions are identified by
+ * their entry address, i.e., the target of the Jsr. The calling contexts are
+ * kept in a tree so that the folded stacks can be written for flamegraphs.
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdio.h>
+
+#include "vm.h"
+#include "srcmap.h"
+
+/**
+ * A calling context
+ */
+struct profile_node {
+    // Entry address of the function, -1 for the top level
+    int             entry;
+    // Instructions executed in this context, excluding the callees
+    long long       self;
+    struct profile_node *parent;
+    struct profile_node *child;
+    struct profile_node *sibling;
+};
+
+struct profile {
+    // Executions per pc
+    long long       pc_count[VM_CODE_SIZE];
+    // Taken conditional branches per pc
+    long long       taken[VM_CODE_SIZE];
+    // Per entry address
+    long long       calls[VM_CODE_SIZE];
+    long long       inclusive[VM_CODE_SIZE];
+    long long       entered_at[VM_CODE_SIZE];
+    int             active[VM_CODE_SIZE];
+    struct profile_node root;
+    struct profile_node *current;
+    // Step count at the last call or return
+    long long       last;
+};
+
+/**
+ * @returns a new, empty profile
+ */
+struct profile *profile_new(void);
+
+/**
+ * Records the execution of the instruction at @pc
+ */
+static inline void
+profile_count(struct profile *p, int pc)
+{
+    ++p->pc_count[pc];
+}
+
+/**
+ * Records that the conditional branch at @pc is taken
+ */
+static inline void
+profile_taken(struct profile *p, int pc)
+{
+    ++p->taken[pc];
+}
+
+/**
+ * Records a call to the function at @entry after @steps instructions
+ */
+void            profile_call(struct profile *p, int entry, long long steps);
+
+/**
+ * Records a return after @steps instructions
+ */
+void            profile_return(struct profile *p, long long steps);
+
+/**
+ * Closes the profile of a machine that stopped after @steps instructions
+ */
+void            profile_finish(struct profile *p, long long steps);
+
+/**
+ * Writes the per function, per opcode and per source line counts
+ *
+ * @map may be NULL, in which case functions are named by address and no
+ * source line is reported.
+ */
+void            profile_report(struct profile *p, const struct vm_image *image,
+                               const struct srcmap *map, FILE *out);
+
+/**
+ * Writes the folded stacks, i.e., one `f;g;h count' line per calling context
+ */
+void            profile_folded(struct profile *p, const struct srcmap *map,
+                               FILE *out);
+
+/**
+ * Writes the branch profile read by `turtle -P FILE'
+ *
+ * The format is:
+ *
+ *      turtle-branch-profile 1
+ *      branch <line> <column> <taken> <not taken>
+ *      ...
+ *      fun <name> <calls>
+ *      ...
+ *
+ * Branches are identified by the source position of their statement, which
+ * is looked up in @map.
+ */
+void            profile_branches(struct profile *p,
+                                 const struct vm_image *image,
+                                 const struct srcmap *map, FILE *out);
+
+/**
+ * Releases @p
+ */
+void            profile_free(struct profile *p);
+
+#endif /* end of include guard: PROFILE_H_ */
@@ -0,0 +1,910 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "render.h"
+
+/**
+ * Cohen-Sutherland outcodes
+ */
+#define OUT_LEFT 1
+#define OUT_RIGHT 2
+#define OUT_BOTTOM 4
+#define OUT_TOP 8
+
+/**
+ * Segments clipped and set up at once
+ */
+#define LANES 4
+
+/**
+ * GCC vector types: the operators apply lane by lane, and a comparison gives
+ * -1 in the lanes where it holds, 0 elsewhere
+ */
+typedef float vfloat __attribute__ ((vector_size(4 * LANES)));
+typedef int32_t vint __attribute__ ((vector_size(4 * LANES)));
+
+/**
+ * @a in the lanes set in @mask, @b elsewhere
+ */
+#define SELECT(mask, a, b) ((vfloat) (((vint) (a) & (mask)) | \
+                                      ((vint) (b) & ~(mask))))
+
+/**
+ * Deflate stored blocks hold at most that many bytes
+ */
+#define PNG_BLOCK 65535
+
+#define PIXEL(r, x, y) ((r)->pixels[((((y) / RENDER_TILE) * (r)->tiles + \
+                                      (x) / RENDER_TILE) * RENDER_TILE + \
+                                     (y) % RENDER_TILE) * RENDER_TILE + \
+                                    (x) % RENDER_TILE])
+
+/**
+ * PNG output: the CRC of the current chunk and the state of the zlib stream
+ */
+struct png {
+    FILE           *f;
+    uint32_t        crc;
+    uint32_t        adler_a;
+    uint32_t        adler_b;
+    long            block_left;
+    long            raw_left;
+};
+
+static uint32_t crc_table[256];
+
+/**
+ * The segments that cross a tile
+ */
+struct bin {
+    int            *segs;
+    int             count;
+    int             capacity;
+};
+
+/**
+ * Tiles left to a worker: work[head] to work[tail - 1], packed as
+ * head << 32 | tail so that the owner and the thieves update them with one
+ * compare-and-swap
+ */
+struct worker {
+    uint64_t        range;
+    pthread_t       thread;
+    struct pool    *pool;
+};
+
+struct pool {
+    struct render  *r;
+    struct bin     *bins;
+    // Indices of the tiles to draw
+    int            *work;
+    struct worker  *workers;
+    int             nworkers;
+};
+
+static int
+add_segment(struct render *r, int x0, int y0, int x1, int y1)
+{
+    if (r->count == r->capacity) {
+        r->capacity = r->capacity ? 2 * r->capacity : 256;
+        r->x0 = realloc(r->x0, r->capacity * sizeof(*r->x0));
+        r->y0 = realloc(r->y0, r->capacity * sizeof(*r->y0));
+        r->x1 = realloc(r->x1, r->capacity * sizeof(*r->x1));
+        r->y1 = realloc(r->y1, r->capacity * sizeof(*r->y1));
+        check_mem(r->x0 && r->y0 && r->x1 && r->y1);
+    }
+
+    r->x0[r->count] = x0;
+    r->y0[r->count] = y0;
+    r->x1[r->count] = x1;
+    r->y1[r->count] = y1;
+    ++r->count;
+    return 0;
+
+error:
+    return -1;
+}
+
+static vfloat
+load(const float *a, int i)
+{
+    vfloat          v;
+
+    memcpy(&v, a + i, sizeof(v));
+    return v;
+}
+
+static void
+store(float *a, int i, vfloat v)
+{
+    memcpy(a + i, &v, sizeof(v));
+}
+
+/**
+ * @returns 1 if a lane of @v is not 0
+ */
+static int
+any(vint v)
+{
+    int             acc = 0;
+
+    for (int k = 0; k < LANES; ++k) {
+        acc |= v[k];
+    }
+
+    return acc != 0;
+}
+
+static vint
+outcodes(vfloat x, vfloat y, float max)
+{
+    return ((x < 0) & OUT_LEFT) | ((x > max) & OUT_RIGHT) |
+           ((y < 0) & OUT_BOTTOM) | ((y > max) & OUT_TOP);
+}
+
+/**
+ * Clips the segments @i to @i + LANES - 1 to [0, @max] x [0, @max], and
+ * sets @rejected for the ones nothing is left of. Each pass moves one end of
+ * every segment still crossing the border to the edge Cohen-Sutherland
+ * would pick for it alone, so the result is the same.
+ */
+static void
+clip(struct render *r, int i, float max, uint8_t *rejected)
+{
+    vfloat          x0 = load(r->x0, i),
+                    y0 = load(r->y0, i),
+                    x1 = load(r->x1, i),
+                    y1 = load(r->y1, i);
+    vfloat          zero = { 0 },
+                    high = zero + max;
+    vint            c0 = outcodes(x0, y0, max),
+                    c1 = outcodes(x1, y1, max);
+    // The segments entirely on the outer side of an edge, and the others that
+    // still cross the border
+    vint            out = (c0 & c1) != 0;
+    vint            live = ((c0 | c1) != 0) & ~out;
+
+    while (any(live)) {
+        // The end to move and the edge to move it to
+        vint            first = c0 != 0;
+        vint            c = (c0 & first) | (c1 & ~first);
+        vint            up = (c & OUT_TOP) != 0;
+        vint            horizontal = up | ((c & OUT_BOTTOM) != 0);
+        vint            right = ~horizontal & ((c & OUT_RIGHT) != 0);
+        vfloat          ey = SELECT(up, high, zero),
+                        ex = SELECT(right, high, zero);
+        vfloat          x = SELECT(horizontal,
+                                   x0 + (x1 - x0) * (ey - y0) / (y1 - y0), ex),
+                        y = SELECT(horizontal, ey,
+                                   y0 + (y1 - y0) * (ex - x0) / (x1 - x0));
+        vint            m0 = live & first,
+                        m1 = live & ~first;
+
+        x0 = SELECT(m0, x, x0);
+        y0 = SELECT(m0, y, y0);
+        x1 = SELECT(m1, x, x1);
+        y1 = SELECT(m1, y, y1);
+        c0 = (outcodes(x0, y0, max) & m0) | (c0 & ~m0);
+        c1 = (outcodes(x1, y1, max) & m1) | (c1 & ~m1);
+        out |= (c0 & c1) != 0;
+        live = ((c0 | c1) != 0) & ~out;
+    }
+
+    store(r->x0, i, x0);
+    store(r->y0, i, y0);
+    store(r->x1, i, x1);
+    store(r->y1, i, y1);
+
+    for (int k = 0; k < LANES; ++k) {
+        rejected[i + k] = out[k] != 0;
+    }
+}
+
+/**
+ * Sets up the digital differential analyser of the segments @i to
+ * @i + LANES - 1: one pixel per step along the major axis
+ */
+static void
+set_up(struct render *r, int i)
+{
+    vfloat          x0 = load(r->x0, i),
+                    y0 = load(r->y0, i);
+    vfloat          dx = load(r->x1, i) - x0,
+                    dy = load(r->y1, i) - y0;
+    vfloat          adx = (vfloat) ((vint) dx & 0x7FFFFFFF),
+                    ady = (vfloat) ((vint) dy & 0x7FFFFFFF);
+    vint            steps = __builtin_convertvector(SELECT(adx > ady, adx, ady),
+                                                    vint) + 1;
+    vfloat          fsteps = __builtin_convertvector(steps, vfloat);
+
+    store(r->sx, i, dx / fsteps);
+    store(r->sy, i, dy / fsteps);
+    memcpy(r->steps + i, &steps, sizeof(steps));
+}
+
+static void
+draw_line(struct render *r, int i)
+{
+    float           x0 = r->x0[i],
+                    y0 = r->y0[i],
+                    sx = r->sx[i],
+                    sy = r->sy[i];
+
+    for (int k = 0; k <= r->steps[i]; ++k) {
+        int             x = (int) (x0 + sx * k + 0.5f);
+        int             y = (int) (y0 + sy * k + 0.5f);
+        PIXEL(r, x, y) = 1;
+    }
+}
+
+/**
+ * Narrows [@lo, @hi] to the steps of a DDA from @p with step @s that may
+ * land in the pixels [@a, @b]. One step of slack covers rounding.
+ */
+static void
+narrow(float p, float s, int a, int b, int *lo, int *hi)
+{
+    float           t1,
+                    t2;
+
+    if (s == 0) {
+        int             q = (int) (p + 0.5f);
+
+        if (q < a || q > b) {
+            *hi = *lo - 1;
+        }
+
+        return;
+    }
+
+    t1 = (a - 0.5f - p) / s;
+    t2 = (b + 0.5f - p) / s;
+
+    if (s < 0) {
+        float           t = t1;
+        t1 = t2;
+        t2 = t;
+    }
+
+    if (t1 - 1 > *lo) {
+        *lo = (int) floorf(t1) - 1;
+    }
+
+    if (t2 + 1 < *hi) {
+        *hi = (int) ceilf(t2) + 1;
+    }
+}
+
+/**
+ * Draws the pixels of the segment @i that fall in the tile (@tx, @ty), the
+ * same ones draw_line() would
+ */
+static void
+draw_line_in_tile(struct render *r, int i, int tx, int ty)
+{
+    float           x0 = r->x0[i],
+                    y0 = r->y0[i],
+                    sx = r->sx[i],
+                    sy = r->sy[i];
+    int             ax = tx * RENDER_TILE,
+                    ay = ty * RENDER_TILE;
+    int             bx = ax + RENDER_TILE - 1,
+                    by = ay + RENDER_TILE - 1;
+    int             lo = 0,
+                    hi = r->steps[i];
+
+    narrow(x0, sx, ax, bx, &lo, &hi);
+    narrow(y0, sy, ay, by, &lo, &hi);
+
+    for (int k = lo; k <= hi; ++k) {
+        int             x = (int) (x0 + sx * k + 0.5f);
+        int             y = (int) (y0 + sy * k + 0.5f);
+
+        if (x >= ax && x <= bx && y >= ay && y <= by) {
+            PIXEL(r, x, y) = 1;
+        }
+    }
+}
+
+static int
+add_to_bin(struct bin *b, int seg)
+{
+    if (b->count == b->capacity) {
+        b->capacity = b->capacity ? 2 * b->capacity : 16;
+        b->segs = realloc(b->segs, b->capacity * sizeof(*b->segs));
+        check_mem(b->segs);
+    }
+
+    b->segs[b->count++] = seg;
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * Adds the segment @i to the bins of the tiles it crosses: for each column
+ * of tiles, the rows between the ends of the part of the segment in it
+ */
+static int
+bin_segment(struct render *r, struct bin *bins, int i)
+{
+    float           x0 = r->x0[i],
+                    y0 = r->y0[i],
+                    sx = r->sx[i],
+                    sy = r->sy[i];
+    int             first = (int) ((x0 < r->x1[i] ? x0 : r->x1[i]) + 0.5f);
+    int             last = (int) ((x0 < r->x1[i] ? r->x1[i] : x0) + 0.5f);
+
+    for (int tx = first / RENDER_TILE; tx <= last / RENDER_TILE; ++tx) {
+        int             lo = 0,
+                        hi = r->steps[i];
+        int             ya,
+                        yb;
+
+        narrow(x0, sx, tx * RENDER_TILE, tx * RENDER_TILE + RENDER_TILE - 1,
+               &lo, &hi);
+
+        if (lo > hi) {
+            continue;
+        }
+
+        ya = (int) (y0 + sy * lo + 0.5f);
+        yb = (int) (y0 + sy * hi + 0.5f);
+
+        if (ya > yb) {
+            int             t = ya;
+            ya = yb;
+            yb = t;
+        }
+
+        ya = ya < 0 ? 0 : ya;
+        yb = yb > r->size - 1 ? r->size - 1 : yb;
+
+        for (int ty = ya / RENDER_TILE; ty <= yb / RENDER_TILE; ++ty) {
+            if (add_to_bin(&bins[ty * r->tiles + tx], i) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @returns the next tile of @w, or -1 if it has none left
+ */
+static int
+take(struct worker *w)
+{
+    uint64_t        range = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        uint32_t        head = range >> 32,
+                        tail = (uint32_t) range;
+
+        if (head >= tail) {
+            return -1;
+        }
+
+        if (__atomic_compare_exchange_n(&w->range, &range,
+                                        (uint64_t) (head + 1) << 32 | tail,
+                                        0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            return w->pool->work[head];
+        }
+    }
+}
+
+/**
+ * Moves the last half of the tiles of another worker to @w
+ *
+ * @returns 0 if every worker ran out of tiles
+ */
+static int
+steal(struct worker *w)
+{
+    struct pool    *pool = w->pool;
+    int             self = w - pool->workers;
+
+    for (int k = 1; k < pool->nworkers; ++k) {
+        struct worker  *victim = &pool->workers[(self + k) % pool->nworkers];
+        uint64_t        range = __atomic_load_n(&victim->range,
+                                                __ATOMIC_ACQUIRE);
+
+        for (;;) {
+            uint32_t        head = range >> 32,
+                            tail = (uint32_t) range;
+            uint32_t        half = (tail - head + 1) / 2;
+
+            if (head >= tail) {
+                break;
+            }
+
+            if (__atomic_compare_exchange_n(&victim->range, &range,
+                                            (uint64_t) head << 32 |
+                                            (tail - half), 0,
+                                            __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&w->range,
+                                 (uint64_t) (tail - half) << 32 | tail,
+                                 __ATOMIC_RELEASE);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Each tile is drawn by a single worker, so the framebuffer needs no lock
+ */
+static void    *
+work(void *data)
+{
+    struct worker  *w = data;
+    struct pool    *pool = w->pool;
+
+    do {
+        int             tile;
+
+        while ((tile = take(w)) >= 0) {
+            struct bin     *b = &pool->bins[tile];
+            int             tx = tile % pool->r->tiles,
+                            ty = tile / pool->r->tiles;
+
+            for (int k = 0; k < b->count; ++k) {
+                draw_line_in_tile(pool->r, b->segs[k], tx, ty);
+            }
+        }
+    } while (steal(w));
+
+    return NULL;
+}
+
+/**
+ * Draws the segments that are not @rejected with @threads threads
+ */
+static int
+draw_parallel(struct render *r, const uint8_t *rejected, int threads)
+{
+    int             ntiles = r->tiles * r->tiles;
+    int             nwork = 0;
+    int             started = 0;
+    int             ret = -1;
+    struct pool     pool = { r, NULL, NULL, NULL, threads };
+
+    pool.bins = calloc(ntiles, sizeof(*pool.bins));
+    pool.work = malloc(ntiles * sizeof(*pool.work));
+    pool.workers = calloc(threads, sizeof(*pool.workers));
+    check_mem(pool.bins && pool.work && pool.workers);
+
+    for (int i = 0; i < r->count; ++i) {
+        if (!rejected[i]) {
+            check(bin_segment(r, pool.bins, i) == 0, "Cannot bin the lines");
+        }
+    }
+
+    for (int t = 0; t < ntiles; ++t) {
+        if (pool.bins[t].count > 0) {
+            pool.work[nwork++] = t;
+        }
+    }
+
+    for (int k = 0; k < threads; ++k) {
+        uint32_t        head = (uint64_t) nwork * k / threads,
+                        tail = (uint64_t) nwork * (k + 1) / threads;
+        pool.workers[k].range = (uint64_t) head << 32 | tail;
+        pool.workers[k].pool = &pool;
+    }
+
+    // The calling thread is worker 0. If a thread cannot start, the others
+    // steal its tiles, so the image is drawn all the same.
+    for (started = 1; started < threads; ++started) {
+        if (pthread_create(&pool.workers[started].thread, NULL, work,
+                           &pool.workers[started]) != 0) {
+            debug("Rendering with %d threads out of %d", started, threads);
+            break;
+        }
+    }
+
+    work(&pool.workers[0]);
+
+    for (int k = 1; k < started; ++k) {
+        pthread_join(pool.workers[k].thread, NULL);
+    }
+
+    ret = 0;
+
+error:
+
+    for (int t = 0; pool.bins != NULL && t < ntiles; ++t) {
+        free(pool.bins[t].segs);
+    }
+
+    free(pool.bins);
+    free(pool.work);
+    free(pool.workers);
+    return ret;
+}
+
+/**
+ * Copies the row @y of the image to @row, 0 for ink and 255 for paper
+ */
+static void
+get_row(const struct render *r, int y, uint8_t *row)
+{
+    const uint8_t  *tile = &PIXEL(r, 0, y);
+
+    for (int x = 0; x < r->size; x += RENDER_TILE) {
+        int             n = r->size - x < RENDER_TILE ? r->size - x :
+                            RENDER_TILE;
+
+        for (int i = 0; i < n; ++i) {
+            row[x + i] = tile[i] ? 0 : 255;
+        }
+
+        tile += RENDER_TILE * RENDER_TILE;
+    }
+}
+
+static void
+png_put(struct png *p, const void *data, size_t len)
+{
+    const uint8_t  *b = data;
+
+    fwrite(data, 1, len, p->f);
+
+    for (size_t i = 0; i < len; ++i) {
+        p->crc = crc_table[(p->crc ^ b[i]) & 0xFF] ^ (p->crc >> 8);
+    }
+}
+
+static void
+png_put32(struct png *p, uint32_t v)
+{
+    uint8_t         b[4] = { v >> 24, v >> 16, v >> 8, v };
+    png_put(p, b, 4);
+}
+
+static void
+png_begin_chunk(struct png *p, const char *type, uint32_t len)
+{
+    uint8_t         b[4] = { len >> 24, len >> 16, len >> 8, len };
+    fwrite(b, 1, 4, p->f);
+    p->crc = 0xFFFFFFFF;
+    png_put(p, type, 4);
+}
+
+static void
+png_end_chunk(struct png *p)
+{
+    uint32_t        crc = p->crc ^ 0xFFFFFFFF;
+    uint8_t         b[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+    fwrite(b, 1, 4, p->f);
+}
+
+/**
+ * Appends @len bytes of image data to the zlib stream, in stored blocks
+ */
+static void
+png_deflate(struct png *p, const uint8_t *data, long len)
+{
+    while (len > 0) {
+        long            n;
+
+        if (p->block_left == 0) {
+            n = p->raw_left < PNG_BLOCK ? p->raw_left : PNG_BLOCK;
+            uint8_t         header[5] = {
+                p->raw_left <= PNG_BLOCK, n, n >> 8, ~n, ~n >> 8
+            };
+            png_put(p, header, 5);
+            p->block_left = n;
+        }
+
+        n = len < p->block_left ? len : p->block_left;
+        png_put(p, data, n);
+
+        // The sums cannot overflow within 5552 bytes
+        for (long i = 0; i < n; i += 5552) {
+            for (long k = i; k < n && k < i + 5552; ++k) {
+                p->adler_a += data[k];
+                p->adler_b += p->adler_a;
+            }
+
+            p->adler_a %= 65521;
+            p->adler_b %= 65521;
+        }
+
+        p->block_left -= n;
+        p->raw_left -= n;
+        data += n;
+        len -= n;
+    }
+}
+
+static int
+write_png(const struct render *r, FILE *f)
+{
+    static const uint8_t signature[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+    };
+    struct png      p = { f, 0, 1, 0, 0, 0 };
+    long            raw = (long) r->size * (r->size + 1);
+    long            blocks = (raw + PNG_BLOCK - 1) / PNG_BLOCK;
+    uint8_t        *row = malloc(r->size + 1);
+    uint8_t         ihdr[5] = { 8, 0, 0, 0, 0 };
+    check_mem(row);
+
+    if (crc_table[1] == 0) {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t        c = n;
+
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+
+            crc_table[n] = c;
+        }
+    }
+
+    fwrite(signature, 1, sizeof(signature), f);
+    // 8-bit greyscale
+    png_begin_chunk(&p, "IHDR", 13);
+    png_put32(&p, r->size);
+    png_put32(&p, r->size);
+    png_put(&p, ihdr, sizeof(ihdr));
+    png_end_chunk(&p);
+
+    png_begin_chunk(&p, "IDAT", 2 + 5 * blocks + raw + 4);
+    png_put(&p, "\x78\x01", 2);
+    p.raw_left = raw;
+    // No filter
+    row[0] = 0;
+
+    for (int y = 0; y < r->size; ++y) {
+        get_row(r, y, row + 1);
+        png_deflate(&p, row, r->size + 1);
+    }
+
+    png_put32(&p, (p.adler_b << 16) | p.adler_a);
+    png_end_chunk(&p);
+    png_begin_chunk(&p, "IEND", 0);
+    png_end_chunk(&p);
+    free(row);
+    return 0;
+
+error:
+    return -1;
+}
+
+static int
+write_ppm(const struct render *r, FILE *f)
+{
+    uint8_t        *row = malloc(3 * r->size);
+    check_mem(row);
+    fprintf(f, "P6\n%d %d\n255\n", r->size, r->size);
+
+    for (int y = 0; y < r->size; ++y) {
+        // Expanded in place, from the end
+        get_row(r, y, row);
+
+        for (int x = r->size - 1; x >= 0; --x) {
+            row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = row[x];
+        }
+
+        fwrite(row, 1, 3 * r->size, f);
+    }
+
+    free(row);
+    return 0;
+
+error:
+    return -1;
+}
+
+struct render  *
+render_new(void)
+{
+    struct render  *r = calloc(1, sizeof(*r));
+    check_mem(r);
+    return r;
+
+error:
+    return NULL;
+}
+
+void
+render_record(void *data, enum vm_pen_event event, int x, int y)
+{
+    struct render  *r = data;
+
+    if (r->forward != NULL) {
+        r->forward(r->forward_data, event, x, y);
+    }
+
+    switch (event) {
+    case vm_pen_up:
+        r->pen_down = 0;
+        break;
+
+    case vm_pen_down:
+        if (!r->pen_down) {
+            add_segment(r, r->x, r->y, r->x, r->y);
+        }
+
+        r->pen_down = 1;
+        break;
+
+    case vm_pen_move:
+        if (r->pen_down && (x != r->x || y != r->y)) {
+            add_segment(r, r->x, r->y, x, y);
+        }
+
+        r->x = x;
+        r->y = y;
+        break;
+    }
+}
+
+int
+render_draw(struct render *r, int size, int threads)
+{
+    float           min_x = 0,
+                    min_y = 0,
+                    max_x = 0,
+                    max_y = 0;
+    float           scale,
+                    off_x,
+                    off_y,
+                    max = size - 1;
+    uint8_t        *rejected = NULL;
+    int             n = r->count,
+                    blocks = (n + LANES - 1) / LANES * LANES;
+
+    check(size > 2 * RENDER_MARGIN, "The image is too small");
+    free(r->pixels);
+    r->size = size;
+    r->tiles = (size + RENDER_TILE - 1) / RENDER_TILE;
+    r->pixels = calloc((size_t) r->tiles * r->tiles,
+                       RENDER_TILE * RENDER_TILE);
+    check_mem(r->pixels);
+
+    if (n == 0) {
+        return 0;
+    }
+
+    min_x = max_x = r->x0[0];
+    min_y = max_y = r->y0[0];
+
+    for (int i = 0; i < n; ++i) {
+        min_x = r->x0[i] < min_x ? r->x0[i] : min_x;
+        min_x = r->x1[i] < min_x ? r->x1[i] : min_x;
+        max_x = r->x0[i] > max_x ? r->x0[i] : max_x;
+        max_x = r->x1[i] > max_x ? r->x1[i] : max_x;
+        min_y = r->y0[i] < min_y ? r->y0[i] : min_y;
+        min_y = r->y1[i] < min_y ? r->y1[i] : min_y;
+        max_y = r->y0[i] > max_y ? r->y0[i] : max_y;
+        max_y = r->y1[i] > max_y ? r->y1[i] : max_y;
+    }
+
+    // Keep the aspect ratio, centre the drawing and put y upwards
+    scale = max_x - min_x > max_y - min_y ? max_x - min_x : max_y - min_y;
+    scale = scale > 0 ? (size - 1 - 2 * RENDER_MARGIN) / scale : 1;
+    off_x = (max - (max_x - min_x) * scale) / 2 - min_x * scale;
+    off_y = (max - (max_y - min_y) * scale) / 2 - min_y * scale;
+
+    for (int i = 0; i < n; ++i) {
+        r->x0[i] = r->x0[i] * scale + off_x;
+        r->x1[i] = r->x1[i] * scale + off_x;
+        r->y0[i] = max - (r->y0[i] * scale + off_y);
+        r->y1[i] = max - (r->y1[i] * scale + off_y);
+    }
+
+    // Pad the last block with dots at the origin. The capacity is a power of
+    // 2 of at least 256, so there is room for them.
+    for (int i = n; i < blocks; ++i) {
+        r->x0[i] = r->y0[i] = r->x1[i] = r->y1[i] = 0;
+    }
+
+    rejected = malloc(blocks);
+    r->sx = realloc(r->sx, blocks * sizeof(*r->sx));
+    r->sy = realloc(r->sy, blocks * sizeof(*r->sy));
+    r->steps = realloc(r->steps, blocks * sizeof(*r->steps));
+    check_mem(rejected && r->sx && r->sy && r->steps);
+
+    for (int i = 0; i < blocks; i += LANES) {
+        clip(r, i, max, rejected);
+        set_up(r, i);
+    }
+
+    if (threads <= 1) {
+        for (int i = 0; i < n; ++i) {
+            if (!rejected[i]) {
+                draw_line(r, i);
+            }
+        }
+    } else if (draw_parallel(r, rejected, threads) != 0) {
+        goto error;
+    }
+
+    free(rejected);
+    return 0;
+
+error:
+    free(rejected);
+    return -1;
+}
+
+int
+render_write(const struct render *r, const char *path)
+{
+    size_t          len = strlen(path);
+    FILE           *f = fopen(path, "wb");
+    int             ret;
+    check(f, "Cannot open the file %s for writing", path);
+
+    if (len > 4 && strcmp(path + len - 4, ".png") == 0) {
+        ret = write_png(r, f);
+    } else {
+        ret = write_ppm(r, f);
+    }
+
+    check(ret == 0 && !ferror(f), "Cannot write the image %s", path);
+    fclose(f);
+    return 0;
+
+error:
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    return -1;
+}
+
+void
+render_free(struct render *r)
+{
+    if (r == NULL) {
+        return;
+    }
+
+    free(r->x0);
+    free(r->y0);
+    free(r->x1);
+    free(r->y1);
+    free(r->sx);
+    free(r->sy);
+    free(r->steps);
+    free(r->pixels);
+    free(r);
+}
@@ -0,0 +1,118 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Rasteriser for plot streams
+ *
+ * Collects the lines drawn by a machine and renders them, scaled to fit, into
+ * a square image written as PPM or PNG. The segments are kept as separate
+ * coordinate arrays, which the clipping and the set-up of the lines load
+ * four at a time into GCC vector types. The framebuffer is split in tiles
+ * so that short lines touch few cache lines.
+ */
+
+#ifndef RENDER_H_
+#define RENDER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vm.h"
+
+/**
+ * Side of a tile in pixels, a power of 2
+ */
+#define RENDER_TILE 64
+
+/**
+ * Free space around the drawing, in pixels
+ */
+#define RENDER_MARGIN 8
+
+struct render {
+    // Segments in plot coordinates, then in pixels once scaled. A dot is a
+    // segment of length 0.
+    float          *x0;
+    float          *y0;
+    float          *x1;
+    float          *y1;
+    int             count;
+    int             capacity;
+    // Set-up of each segment once clipped: number of steps along the major
+    // axis and the move in x and y at each
+    int            *steps;
+    float          *sx;
+    float          *sy;
+    // State of the pen while recording
+    int             pen_down;
+    int             x;
+    int             y;
+    // Called with every recorded event, unless NULL
+    void          (*forward)(void *data, enum vm_pen_event event, int x,
+                             int y);
+    void           *forward_data;
+    // 0 for no ink, 1 for ink; tile by tile
+    uint8_t        *pixels;
+    int             size;
+    int             tiles;
+};
+
+/**
+ * @returns a new, empty renderer
+ */
+struct render  *render_new(void);
+
+/**
+ * Pen callback that records an event in the struct render * in @data
+ */
+void            render_record(void *data, enum vm_pen_event event, int x,
+                              int y);
+
+/**
+ * Draws the recorded segments in a @size x @size image
+ *
+ * With more than one of @threads, the segments are first sorted into bins,
+ * one per tile, then the tiles are shared by the threads. A thread that has
+ * drawn its tiles takes half of the tiles left to another one.
+ *
+ * @returns 0 on success, -1 otherwise
+ */
+int             render_draw(struct render *r, int size, int threads);
+
+/**
+ * Writes the image of @r to @path, as PNG if @path ends with `.png' and as
+ * binary PPM otherwise
+ *
+ * @returns 0 on success, -1 otherwise
+ */
+int             render_write(const struct render *r, const char *path);
+
+/**
+ * Releases @r
+ */
+void            render_free(struct render *r);
+
+#endif /* end of include guard: RENDER_H_ */
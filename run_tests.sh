@@ -1,5 +1,7 @@
 #!/usr/bin/env bash
 
+status=0
+
 for i in tests/default/*.t
 do
     ./turtle $i -s -l -o out.p &> /dev/null
@@ -11,6 +13,182 @@ do
         echo $i " passed"
     else
         echo $i " failed"
+        status=1
     fi
     rm -f out.p out.asm
 done
+
+# Programs run at every -O level, and at -O2 with the branch profile of a run
+# at -O0, with the input in the .d file if any, must write the plot stream in
+# the .out file. From -O1 up it is the one in the .opt.out file if any, as the
+# pen pass leaves out what does not change the plot.
+for i in tests/run/*.t
+do
+    d=${i/.t/.d}
+    [ -f $d ] || d=/dev/null
+    ./turtle $i -m out.map -o out.p &> /dev/null
+    ./pdplot -i $d -m out.map -b out.br -o /dev/null out.p &> /dev/null
+
+    for o in -O0 -O1 -O2 "-O2 -P out.br"
+    do
+        ./turtle $i $o -o out.p &> /dev/null
+        ./pdplot -i $d -o out.plot out.p &> /dev/null
+        e=${i/.t/.out}
+
+        if [ "$o" != -O0 ] && [ -f ${i/.t/.opt.out} ]
+        then
+            e=${i/.t/.opt.out}
+        fi
+
+        cmp -s out.plot $e
+
+        if [ $? -eq 0 ]
+        then
+            echo $i $o " passed"
+        else
+            echo $i $o " failed"
+            status=1
+        fi
+        rm -f out.p out.plot
+    done
+    rm -f out.map out.br
+done
+
+# Compares out.EXT with the file given after the extension EXT, or else with
+# tests/pdplot/plot.EXT
+expect()
+{
+    e=${2:-tests/pdplot/plot.$1}
+    cmp -s out.$1 $e
+
+    if [ $? -eq 0 ]
+    then
+        echo $e " passed"
+    else
+        echo $e " failed"
+        status=1
+    fi
+    rm -f out.$1
+}
+
+# The code-size report and the source map of turtle on tests/run/clone.t
+./turtle tests/run/clone.t -r -m out.map -o out.p 2> out.size > /dev/null
+expect size tests/run/clone.size
+expect map tests/run/clone.map
+
+# Each mode of pdplot, run on tests/pdplot/plot.t with the input in plot.d,
+# must write what the file of the same extension in tests/pdplot holds
+in=tests/pdplot/plot.d
+./turtle tests/pdplot/plot.t -m out.map -o out.p &> /dev/null
+
+./pdplot -i $in -m out.map -p out.prof -f out.folded -o /dev/null out.p \
+    &> /dev/null
+expect prof
+expect folded
+
+./pdplot -i $in -m out.map -b out.br -o /dev/null out.p &> /dev/null
+expect br
+
+./pdplot -i $in -t -T out.travel -o out.reordered out.p &> /dev/null
+expect travel
+expect reordered
+
+./pdplot -i $in -R out.ppm -W 48 -o /dev/null out.p &> /dev/null
+expect ppm
+
+# On tiles drawn by 3 threads
+./pdplot -i $in -R out.1.ppm -W 300 -o /dev/null out.p &> /dev/null
+./pdplot -i $in -R out.ppm -W 300 -j 3 -o /dev/null out.p &> /dev/null
+expect ppm out.1.ppm
+rm -f out.1.ppm
+
+./pdplot -i $in -V out.svg -o /dev/null out.p &> /dev/null
+expect svg
+./pdplot -i $in -V out.ps -o /dev/null out.p &> /dev/null
+expect ps
+
+# A run per line of plot.runs, the third of which reads what plot.d holds
+mkdir -p out.runs
+./pdplot -B tests/pdplot/plot.runs -O out.runs -j 2 -o out.summary out.p \
+    &> /dev/null
+expect summary
+./pdplot -i $in -o out.out out.p &> /dev/null
+expect out out.runs/3.out
+rm -rf out.runs
+
+# On the lockstep machine, and with a run that fails in the middle
+./pdplot -B tests/pdplot/plot.runs -L -o out.summary out.p &> /dev/null
+expect summary
+./pdplot -B tests/pdplot/plot.lanes -o out.1.summary out.p &> /dev/null
+./pdplot -B tests/pdplot/plot.lanes -L -o out.summary out.p &> /dev/null
+expect summary out.1.summary
+rm -f out.1.summary
+
+# Two sessions at once, each reading plot.d through its connection
+./pdplot -S out.sock out.p &> /dev/null &
+server=$!
+
+for k in $(seq 50)
+do
+    [ -S out.sock ] && break
+    sleep 0.1
+done
+
+clients=
+for k in 1 2
+do
+    perl -MIO::Socket::UNIX -e '
+        $s = IO::Socket::UNIX->new(Peer => shift) or exit 1;
+        print $s $_ while <STDIN>;
+        shutdown($s, 1);
+        print while <$s>' out.sock < $in > out.session$k &
+    clients="$clients $!"
+done
+
+wait $clients
+kill $server
+wait $server
+./pdplot -i $in -o out.1.out out.p &> /dev/null
+expect session1 out.1.out
+expect session2 out.1.out
+rm -f out.sock out.1.out
+
+# With a checkpoint every 100 steps, and resumed from the last one over the
+# plot stream of a run killed after it
+./pdplot -i $in -o out.1.out out.p &> /dev/null
+./pdplot -i $in -c out.ck -C 100 -o out.out out.p &> /dev/null
+cp out.out out.resumed
+echo Up >> out.resumed
+expect out out.1.out
+./pdplot -i $in -r out.ck -o out.resumed out.p &> /dev/null
+expect resumed out.1.out
+rm -f out.ck out.1.out
+
+# Traced, printed whole, and printed from a step in the last of its blocks
+./pdplot -i $in -o out.1.out out.p &> /dev/null
+./pdplot -i $in -x out.x -o out.out out.p &> /dev/null
+expect out out.1.out
+./pdplot -X out.x -o out.trace &> /dev/null
+expect trace
+./pdplot -i tests/pdplot/plot.long -x out.x -o /dev/null out.p &> /dev/null
+./pdplot -X out.x -s 400000 -n 8 -o out.window &> /dev/null
+expect window
+rm -f out.x out.1.out
+
+# Hand-written images. The verifier rejects all but overflow.p: a word that
+# does not decode, a callee reading FP-2 while its caller has pushed nothing,
+# writes to the old FP and the return address of a frame, and a write to a
+# global above the height of the program at the call. They run with the
+# checks, which report the bad address read by the recursion most end with,
+# rather than the guard page. overflow.p runs unchecked into the guard page.
+# Errors are compared without their location in the source.
+for i in decode args oldfp retaddr global overflow
+do
+    ./pdplot -o out.out tests/pdplot/$i.p 2>&1 > /dev/null |
+        sed 's/^\[ERROR\] ([^)]*) //' > out.err
+    expect out tests/pdplot/$i.out
+    expect err tests/pdplot/$i.err
+done
+
+rm -f out.p out.map
+exit $status
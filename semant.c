@@ -28,6 +28,8 @@
 #include "semant.h"
 #include "table.h"
 #include "env.h"
+#include "pgo.h"
+#include "pass.h"
 
 #include "instruction.h"
 
@@ -47,6 +49,47 @@ struct patch {
 
 static struct patch *_patches;
 
+/**
+ * Code that the profile says is rarely executed. It is generated out of line,
+ * after the end of the current function (or the main body).
+ */
+struct cold_block {
+    ast_pos         pos;
+    struct ast_stmt_list *body;
+    // The branch that jumps to the block
+    int             j_from;
+    // Where the block jumps back to
+    int             l_back;
+    struct cold_block *next;
+};
+
+static struct cold_block *_cold_blocks;
+static struct cold_block **_cold_blocks_tail = &_cold_blocks;
+
+/**
+ * Queues @body to be generated out of line
+ */
+static void     defer_cold_block(ast_pos pos, struct ast_stmt_list *body,
+                                 int j_from, int l_back);
+
+/**
+ * Generates all the queued cold blocks
+ */
+static void     trans_cold_blocks(void);
+
+/**
+ * @returns 1 if the profile says that the conditional branch of the statement
+ * at @pos is mostly taken, -1 if it is mostly not taken and 0 if there is no
+ * profile for it
+ */
+static int      branch_bias(ast_pos pos);
+
+/**
+ * @returns @list with the functions that were never called in the profile
+ * moved to the end
+ */
+static struct ast_fun_dec_list *move_cold_funcs_last(struct ast_fun_dec_list *list);
+
 /**
  * Link all function calls
  */
@@ -58,6 +101,45 @@ static void     link_func_calls(void);
  */
 static int      retOffset;
 
+/**
+ * The function being translated, NULL in the main body
+ */
+static struct s_symbol *_cur_fun;
+
+/**
+ * What the program does with a function. This is worked out before any code
+ * is generated, because calls may be translated before the function itself.
+ */
+struct fun_usage {
+    struct s_symbol *name;
+    // The function has a return statement
+    int             returns;
+    // The function is called in an expression, i.e., its value is used
+    int             value_used;
+    struct fun_usage *next;
+};
+
+static struct fun_usage *_usages;
+
+/**
+ * Fills _usages for all the functions of @prog
+ */
+static void     analyse_usages(struct ast_program *prog);
+static void     analyse_usages_stmt_list(struct ast_stmt_list *list,
+                                         struct fun_usage *fun);
+static void     analyse_usages_exp(struct ast_exp *exp);
+static struct fun_usage *find_usage(struct s_symbol *name);
+
+/**
+ * @returns 1 if calls to the function @name must push a slot for the return
+ * value
+ *
+ * From -O1, the slot is only pushed for functions that return a value that
+ * is used somewhere. Other functions do not store their return value.
+ */
+static int      needs_ret_slot(struct s_symbol *name);
+
+
 /**
  * @return the number of elements in a linked list
  */
@@ -129,6 +211,238 @@ link_func_calls(void)
     }
 }
 
+static void
+defer_cold_block(ast_pos pos, struct ast_stmt_list *body, int j_from,
+                 int l_back)
+{
+    struct cold_block *b = malloc(sizeof(*b));
+    check_mem(b);
+    b->pos = pos;
+    b->body = body;
+    b->j_from = j_from;
+    b->l_back = l_back;
+    b->next = NULL;
+    *_cold_blocks_tail = b;
+    _cold_blocks_tail = &b->next;
+    return;
+
+error:
+    panic();
+}
+
+static void
+trans_cold_blocks(void)
+{
+    // Cold blocks may queue more cold blocks
+    while (_cold_blocks != NULL) {
+        struct cold_block *b = _cold_blocks;
+        _cold_blocks = b->next;
+
+        if (_cold_blocks == NULL) {
+            _cold_blocks_tail = &_cold_blocks;
+        }
+
+        YYLTYPE         saved = gen_set_pos(b->pos);
+        backpatch(b->j_from, get_next_code_index());
+        trans_stmt_list(b->body);
+        gen_set_pos(b->pos);
+        gen_Jump(b->l_back);
+        gen_set_pos(saved);
+        free(b);
+    }
+}
+
+static int
+branch_bias(ast_pos pos)
+{
+    long long       taken,
+                    not_taken;
+
+    if (!pgo_loaded() || !pgo_branch(pos, &taken, &not_taken)) {
+        return 0;
+    }
+
+    return taken >= not_taken ? 1 : -1;
+}
+
+static struct ast_fun_dec_list *
+move_cold_funcs_last(struct ast_fun_dec_list *list)
+{
+    struct ast_fun_dec_list *hot = NULL,
+            **hot_tail = &hot;
+    struct ast_fun_dec_list *cold = NULL,
+            **cold_tail = &cold;
+
+    while (list != NULL) {
+        struct ast_fun_dec_list *next = list->tail;
+
+        if (pgo_calls(s_name(list->head->name)) > 0) {
+            *hot_tail = list;
+            hot_tail = &list->tail;
+        } else {
+            *cold_tail = list;
+            cold_tail = &list->tail;
+        }
+
+        list = next;
+    }
+
+    *cold_tail = NULL;
+    *hot_tail = cold;
+    return hot;
+}
+
+static struct fun_usage *
+find_usage(struct s_symbol *name)
+{
+    struct fun_usage *u;
+
+    for (u = _usages; u != NULL; u = u->next) {
+        if (u->name == name) {
+            break;
+        }
+    }
+
+    return u;
+}
+
+static void
+analyse_usages_exp(struct ast_exp *exp)
+{
+    struct ast_exp_list *args;
+    struct fun_usage *u;
+
+    if (exp == NULL) {
+        return;
+    }
+
+    switch (exp->kind) {
+    case ast_callExp:
+        if ((u = find_usage(exp->u.call.func)) != NULL) {
+            u->value_used = 1;
+        }
+
+        for (args = exp->u.call.args; args; args = args->tail) {
+            analyse_usages_exp(args->head);
+        }
+
+        break;
+
+    case ast_opExp:
+        analyse_usages_exp(exp->u.op.left);
+        analyse_usages_exp(exp->u.op.right);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void
+analyse_usages_stmt_list(struct ast_stmt_list *list, struct fun_usage *fun)
+{
+    struct ast_exp_list *exps;
+
+    for (; list; list = list->tail) {
+        struct ast_stmt *stmt = list->head;
+
+        switch (stmt->kind) {
+        case ast_moveStmt:
+            analyse_usages_exp(stmt->u.move.exp1);
+            analyse_usages_exp(stmt->u.move.exp2);
+            break;
+
+        case ast_assignStmt:
+            analyse_usages_exp(stmt->u.assign.exp);
+            break;
+
+        case ast_iftStmt:
+            analyse_usages_exp(stmt->u.ift.test);
+            analyse_usages_stmt_list(stmt->u.ift.then, fun);
+            break;
+
+        case ast_ifteStmt:
+            analyse_usages_exp(stmt->u.ifte.test);
+            analyse_usages_stmt_list(stmt->u.ifte.then, fun);
+            analyse_usages_stmt_list(stmt->u.ifte.elsee, fun);
+            break;
+
+        case ast_whileStmt:
+            analyse_usages_exp(stmt->u.whilee.test);
+            analyse_usages_stmt_list(stmt->u.whilee.body, fun);
+            break;
+
+        case ast_returnStmt:
+            if (fun != NULL) {
+                fun->returns = 1;
+            }
+
+            analyse_usages_exp(stmt->u.returnn.exp);
+            break;
+
+        case ast_callStmt:
+            for (exps = stmt->u.call.args; exps; exps = exps->tail) {
+                analyse_usages_exp(exps->head);
+            }
+
+            break;
+
+        case ast_exp_listStmt:
+            for (exps = stmt->u.seq; exps; exps = exps->tail) {
+                analyse_usages_exp(exps->head);
+            }
+
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+static void
+analyse_usages(struct ast_program *prog)
+{
+    struct ast_fun_dec_list *p;
+    struct ast_var_dec_list *v;
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        struct fun_usage *u = malloc(sizeof(*u));
+        check_mem(u);
+        u->name = p->head->name;
+        u->returns = 0;
+        u->value_used = 0;
+        u->next = _usages;
+        _usages = u;
+    }
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        for (v = p->head->var; v; v = v->tail) {
+            analyse_usages_exp(v->head->init);
+        }
+
+        analyse_usages_stmt_list(p->head->body, find_usage(p->head->name));
+    }
+
+    analyse_usages_stmt_list(prog->body, NULL);
+    return;
+
+error:
+    panic();
+}
+
+static int
+needs_ret_slot(struct s_symbol *name)
+{
+    struct fun_usage *u = find_usage(name);
+
+    if (!pass_enabled("retslot") || u == NULL) {
+        return 1;
+    }
+
+    return u->returns && u->value_used;
+}
+
 static int
 count_expList(struct ast_exp_list *list)
 {
@@ -176,6 +490,7 @@ trans_global_vardecList(struct ast_var_dec_list *list)
             panic();
         }
 
+        gen_set_pos(dec->pos);
         trans_exp(dec->init);
         s_insert(_venv, dec->sym,
                 env_new_var(dec->sym, env_global, offset));
@@ -228,6 +543,7 @@ trans_local_vardecList(struct ast_var_dec_list *list)
             }
         }
 
+        gen_set_pos(dec->pos);
         trans_exp(dec->init);
         s_insert(_venv, dec->sym, env_new_var(dec->sym, env_local, offset));
         free(dec);
@@ -269,6 +585,14 @@ trans_func_def_list(struct ast_fun_dec_list *list)
                             count_fieldList(p->head->params)));
     }
 
+    /**
+     * The profile (if any) says which functions are never called. Generate
+     * them after the others so that the hot code stays together.
+     */
+    if (pgo_loaded()) {
+        list = move_cold_funcs_last(list);
+    }
+
     /**
      * Pass 3: parse the function body and fill the address in the symbol table
      */
@@ -315,9 +639,30 @@ trans_func_def_list(struct ast_fun_dec_list *list)
 
         int             addr = get_next_code_index();
         env_set_addr(_fenv, p->head->name, addr);
+        gen_set_owner(s_name(p->head->name));
+        gen_set_pos(p->head->pos);
+        _cur_fun = p->head->name;
         trans_local_vardecList(p->head->var);
+
+        // From -O1, the Rts is not generated when the body ends with a
+        // return statement, as it cannot be reached
+        struct ast_stmt_list *last = p->head->body;
+
+        while (last != NULL && last->tail != NULL) {
+            last = last->tail;
+        }
+
+        int             ends_with_return = last != NULL &&
+                                           last->head->kind == ast_returnStmt;
         trans_stmt_list(p->head->body);
-        gen_Rts(); // Generate the Rts instruction nevertheless
+        gen_set_pos(p->head->pos);
+
+        if (!pass_enabled("retslot") || !ends_with_return) {
+            gen_Rts(); // Generate the Rts instruction nevertheless
+        }
+
+        trans_cold_blocks();
+        _cur_fun = NULL;
         FREE_LIST(p->head->params);
         free(p->head);
         s_leave_scope(_venv);
@@ -446,8 +791,10 @@ transform_iftStmt(struct ast_stmt *stmt)
 
     case ast_LEQ:
         test1 = ast_new_op_exp(stmt->pos, ast_LT, left, right);
-        test2 = ast_new_op_exp(stmt->pos, ast_EQ, left, right);
-        return ast_new_ifte_stmt(stmt->pos, test1, then, ast_new_stmt_list(ast_new_ifte_stmt(stmt->pos, test2, then, NULL), NULL));
+        // Translating a tree releases it, so the second test gets its own
+        test2 = ast_new_op_exp(stmt->pos, ast_EQ, ast_copy_exp(left),
+                               ast_copy_exp(right));
+        return ast_new_ifte_stmt(stmt->pos, test1, then, ast_new_stmt_list(ast_new_ifte_stmt(stmt->pos, test2, ast_copy_stmt_list(then), NULL), NULL));
 
     case ast_GEQ:
         stmt->u.ift.test = ast_new_op_exp(stmt->pos, ast_LEQ, right, left);
@@ -464,61 +811,87 @@ error:
 }
 
 /**
- * Translate If statement
+ * Sets up the test @test of the statement @stmt and generates the conditional
+ * jump that is taken if the condition holds. @test must be a == or <
+ * comparison. Its operands are released but @test itself is not.
  *
- * The structure is a bit like:
+ * From -O1, constant operands are folded and comparisons against zero test
+ * the other operand directly:
  *
- * test:
- *      ... (Set up the test)
- *      goto label `then' if the condition holds
- *      goto label `end'
- * then:
- *      ...
- * end:
- *      ...
+ *      e == 0      e; Test; Pop 1; Jeq
+ *      e < 0       e; Test; Pop 1; Jlt
+ *      0 < e       e; Neg; Test; Pop 1; Jlt
+ *
+ * A condition between two constants becomes a Jump if it always holds and
+ * generates nothing if it never does.
+ *
+ * @returns the index of the conditional jump, to be backpatched, or -1 if
+ * there is no jump
  */
-static void
-trans_ast_iftStmt(struct ast_stmt *stmt)
+static int
+trans_cond_jump(struct ast_stmt *stmt, struct ast_exp *test)
 {
-    assert(stmt && stmt->kind == ast_iftStmt);
-
-    if (stmt->u.ift.test->kind != ast_opExp ||
-            stmt->u.ift.test->u.op.oper < ast_EQ) {
+    struct ast_exp *left = test->u.op.left;
+    struct ast_exp *right = test->u.op.right;
+    int             l,
+                    r;
+    int             l_const = pass_enabled("cmpzero") &&
+                              ast_const_value(left, &l);
+    int             r_const = pass_enabled("cmpzero") &&
+                              ast_const_value(right, &r);
+
+    if (test->u.op.oper != ast_EQ && test->u.op.oper != ast_LT) {
         log_err("Unknown comparison. Please report this to the author.");
         lyyerror(stmt->pos, "Unknown comparison. Please report this to the author.");
         panic();
     }
 
-    struct ast_stmt *s = transform_iftStmt(stmt);
-    if (s != stmt) {
-        trans_stmt(s);
-        return;
-    }
+    if (l_const && r_const) {
+        int             d = (int16_t) (l - r);
+        ast_free_exp(left);
+        ast_free_exp(right);
 
-    struct ast_exp *left = stmt->u.ift.test->u.op.left;
-    struct ast_exp *right = stmt->u.ift.test->u.op.right;
+        if (test->u.op.oper == ast_EQ ? d == 0 : d < 0) {
+            int j = get_next_code_index();
+            gen_Jump(0);
+            return j;
+        }
 
-    switch (stmt->u.ift.test->u.op.oper) {
-    case ast_EQ:
-    case ast_LT:
+        return -1;
+    } else if (r_const && r == 0) {
         trans_exp(left);
+        ast_free_exp(right);
+    } else if (l_const && l == 0) {
         trans_exp(right);
-        break;
+        ast_free_exp(left);
 
-    default:
-        log_err("Unknown comparison. Please report this to the author.");
-        lyyerror(stmt->pos, "Unknown comparison. Please report this to the author.");
-        panic();
+        if (test->u.op.oper == ast_LT) {
+            // 0 - e and -e wrap around the same way
+            gen_Neg();
+        }
+    } else {
+        if (l_const) {
+            gen_Loadi(l);
+            ast_free_exp(left);
+        } else {
+            trans_exp(left);
+        }
+
+        if (r_const) {
+            gen_Loadi(r);
+            ast_free_exp(right);
+        } else {
+            trans_exp(right);
+        }
+
+        gen_Sub();
     }
 
-    gen_Sub();
     gen_Test();
     gen_Pop(1);
-    // j_then is the index of the next instruction, i.e., Jeq or Jlt. It is to
-    // be backpatched with l_then.
-    int j_then = get_next_code_index();
+    int j = get_next_code_index();
 
-    switch (stmt->u.ift.test->u.op.oper) {
+    switch (test->u.op.oper) {
     case ast_EQ:
         gen_Jeq(0);
         break;
@@ -534,6 +907,61 @@ trans_ast_iftStmt(struct ast_stmt *stmt)
         break;
     }
 
+    return j;
+}
+
+/**
+ * Translate If statement
+ *
+ * The structure is a bit like:
+ *
+ * test:
+ *      ... (Set up the test)
+ *      goto label `then' if the condition holds
+ *      goto label `end'
+ * then:
+ *      ...
+ * end:
+ *      ...
+ */
+static void
+trans_ast_iftStmt(struct ast_stmt *stmt)
+{
+    assert(stmt && stmt->kind == ast_iftStmt);
+
+    if (stmt->u.ift.test->kind != ast_opExp ||
+            stmt->u.ift.test->u.op.oper < ast_EQ) {
+        log_err("Unknown comparison. Please report this to the author.");
+        lyyerror(stmt->pos, "Unknown comparison. Please report this to the author.");
+        panic();
+    }
+
+    struct ast_stmt *s = transform_iftStmt(stmt);
+    if (s != stmt) {
+        trans_stmt(s);
+        return;
+    }
+
+    // j_then is the index of the Jeq or Jlt. It is to be backpatched with
+    // l_then.
+    int j_then = trans_cond_jump(stmt, stmt->u.ift.test);
+
+    if (branch_bias(stmt->pos) < 0) {
+        // The `then' part is rarely executed, so it is moved out of line and
+        // the common case falls through:
+        //
+        //      goto label `then' if the condition holds
+        // end:
+        //      ...
+        // then: (after the end of the function)
+        //      ...
+        //      goto label `end'
+        defer_cold_block(stmt->pos, stmt->u.ift.then, j_then,
+                         get_next_code_index());
+        free(stmt->u.ift.test);
+        return;
+    }
+
     // j_then is the index of the next instruction, i.e., Jump. It is to be
     // backpatched with l_end.
     int j_end = get_next_code_index();
@@ -579,8 +1007,10 @@ transform_ifteStmt(struct ast_stmt *stmt)
 
     case ast_LEQ:
         test1 = ast_new_op_exp(stmt->pos, ast_LT, left, right);
-        test2 = ast_new_op_exp(stmt->pos, ast_EQ, left, right);
-        return ast_new_ifte_stmt(stmt->pos, test1, then, ast_new_stmt_list(ast_new_ifte_stmt(stmt->pos, test2, then, elsee), NULL));
+        // Translating a tree releases it, so the second test gets its own
+        test2 = ast_new_op_exp(stmt->pos, ast_EQ, ast_copy_exp(left),
+                               ast_copy_exp(right));
+        return ast_new_ifte_stmt(stmt->pos, test1, then, ast_new_stmt_list(ast_new_ifte_stmt(stmt->pos, test2, ast_copy_stmt_list(then), elsee), NULL));
 
     case ast_GEQ:
         stmt->u.ifte.test = ast_new_op_exp(stmt->pos, ast_LEQ, right, left);
@@ -632,40 +1062,38 @@ trans_ast_ifteStmt(struct ast_stmt *stmt)
         panic();
     }
 
-    switch (stmt->u.ifte.test->u.op.oper) {
-    case ast_EQ:
-    case ast_LT:
-        trans_exp(stmt->u.ifte.test->u.op.left);
-        trans_exp(stmt->u.ifte.test->u.op.right);
-        break;
-
-    default:
-        log_err("Unknown comparison. Please report this to the author.");
-        lyyerror(stmt->pos, "Unknown comparison. Please report this to the author.");
-        log_err("Not supported");
-        panic();
-    }
+    int j_then = trans_cond_jump(stmt, stmt->u.ifte.test);
 
-    gen_Sub();
-    gen_Test();
-    gen_Pop(1);
-    int j_then = get_next_code_index();
+    int bias = branch_bias(stmt->pos);
 
-    switch (stmt->u.ifte.test->u.op.oper) {
-    case ast_EQ:
-        gen_Jeq(0);
-        break;
-
-    case ast_LT:
-        gen_Jlt(0);
-        break;
-
-    default:
-        log_err("Unknown comparison. Please report this to the author.");
-        lyyerror(stmt->pos, "Unknown comparison. Please report this to the author.");
-        log_err("Not supported");
-        panic();
-        break;
+    if (bias < 0) {
+        // The `else' part is the common case. It falls through and the `then'
+        // part is moved out of line (see trans_ast_iftStmt).
+        trans_stmt_list(stmt->u.ifte.elsee);
+        defer_cold_block(stmt->pos, stmt->u.ifte.then, j_then,
+                         get_next_code_index());
+        free(stmt->u.ifte.test);
+        return;
+    } else if (bias > 0) {
+        // The `then' part is the common case. It is reached by the
+        // conditional branch alone, the `else' part needs another jump:
+        //
+        //      goto label `then' if the condition holds
+        //      ... (else)
+        //      goto label `end'
+        // then:
+        //      ...
+        // end:
+        trans_stmt_list(stmt->u.ifte.elsee);
+        int j_end = get_next_code_index();
+        gen_Jump(0);
+        int l_then = get_next_code_index();
+        trans_stmt_list(stmt->u.ifte.then);
+        int l_end = get_next_code_index();
+        backpatch(j_then, l_then);
+        backpatch(j_end, l_end);
+        free(stmt->u.ifte.test);
+        return;
     }
 
     int j_else = get_next_code_index();
@@ -683,6 +1111,47 @@ trans_ast_ifteStmt(struct ast_stmt *stmt)
     free(stmt->u.ifte.test);
 }
 
+/**
+ * Translate a rotated while statement
+ *
+ * The test is done once before the loop and then at the bottom of the body,
+ * so every iteration takes a single branch:
+ *
+ * guard:
+ *      ... (Set up test)
+ *      goto label `body' if the condition holds
+ *      goto end
+ * body:
+ *      ...
+ * test:
+ *      ... (Set up test)
+ *      goto label `body' if the condition holds
+ * end:
+ *      ...
+ */
+static void
+trans_rotated_whileStmt(struct ast_stmt *stmt)
+{
+    struct ast_exp *guard = ast_copy_exp(stmt->u.whilee.test);
+    check_mem(guard);
+    int j_guard = trans_cond_jump(stmt, guard);
+    free(guard);
+    int j_end = get_next_code_index();
+    gen_Jump(0);
+    int l_begin = get_next_code_index();
+    trans_stmt_list(stmt->u.whilee.body);
+    int j_begin = trans_cond_jump(stmt, stmt->u.whilee.test);
+    int l_end = get_next_code_index();
+    backpatch(j_guard, l_begin);
+    backpatch(j_end, l_end);
+    backpatch(j_begin, l_begin);
+    free(stmt->u.whilee.test);
+    return;
+
+error:
+    panic();
+}
+
 /**
  * Translate while statement
  *
@@ -697,6 +1166,8 @@ trans_ast_ifteStmt(struct ast_stmt *stmt)
  *      goto label `test'
  * end:
  *      ...
+ *
+ * From -O1, loops are rotated instead (see trans_rotated_whileStmt).
  */
 static void
 trans_ast_whileStmt(struct ast_stmt *stmt)
@@ -711,41 +1182,22 @@ trans_ast_whileStmt(struct ast_stmt *stmt)
         panic();
     }
 
-    int l_test = get_next_code_index();
-
-    switch (stmt->u.whilee.test->u.op.oper) {
-    case ast_EQ:
-    case ast_LT:
-        trans_exp(stmt->u.whilee.test->u.op.left);
-        trans_exp(stmt->u.whilee.test->u.op.right);
-        break;
+    int bias = branch_bias(stmt->pos);
 
-    default:
-        log_err("Unknown comparison. Please report this to the author.");
-        lyyerror(stmt->pos, "Unknown comparison. Please report this to the author.");
-        panic();
-        break;
+    if (pass_enabled("rotate") && bias >= 0) {
+        trans_rotated_whileStmt(stmt);
+        return;
     }
 
-    gen_Sub();
-    gen_Test();
-    gen_Pop(1);
-    int j_begin = get_next_code_index();
-
-    switch (stmt->u.whilee.test->u.op.oper) {
-    case ast_EQ:
-        gen_Jeq(0);
-        break;
-
-    case ast_LT:
-        gen_Jlt(0);
-        break;
+    int l_test = get_next_code_index();
+    int j_begin = trans_cond_jump(stmt, stmt->u.whilee.test);
 
-    default:
-        log_err("Unknown comparison. Please report this to the author.");
-        lyyerror(stmt->pos, "Unknown comparison. Please report this to the author.");
-        panic();
-        break;
+    if (bias < 0) {
+        // The body is rarely executed, so it is moved out of line (see
+        // trans_ast_iftStmt) and leaving the loop falls through
+        defer_cold_block(stmt->pos, stmt->u.whilee.body, j_begin, l_test);
+        free(stmt->u.whilee.test);
+        return;
     }
 
     int j_end = get_next_code_index();
@@ -772,9 +1224,22 @@ trans_ast_returnStmt(struct ast_stmt *stmt)
         panic();
     }
 
-    trans_exp(stmt->u.returnn.exp);
-    assert(retOffset < 0);
-    gen_Store_FP(retOffset);
+    if (needs_ret_slot(_cur_fun)) {
+        trans_exp(stmt->u.returnn.exp);
+        assert(retOffset < 0);
+        gen_Store_FP(retOffset);
+    } else if (ast_has_call(stmt->u.returnn.exp)) {
+        // Nobody uses the value, but the calls must still be made
+        trans_exp(stmt->u.returnn.exp);
+        gen_Pop(1);
+    } else {
+        // The expression is not evaluated at all. It is still checked.
+        struct ast_exp *exp = stmt->u.returnn.exp;
+        int             index = get_next_code_index();
+        trans_exp(exp);
+        discard_code(index);
+    }
+
     gen_Rts();
 }
 
@@ -801,7 +1266,12 @@ trans_ast_callStmt(struct ast_stmt *stmt)
         panic();
     }
 
-    gen_Loadi(0);
+    int             slot = needs_ret_slot(stmt->u.call.func);
+
+    if (slot) {
+        gen_Loadi(0);
+    }
+
     trans_exp_list(stmt->u.call.args);
 
     if (p->index != 0) {
@@ -818,9 +1288,11 @@ trans_ast_callStmt(struct ast_stmt *stmt)
     }
 
 #ifdef SANITY
-    gen_Pop(p->u.func.count_params + 1);
+    gen_Pop(p->u.func.count_params + slot);
 #else
-    gen_Pop(p->u.func.count_params);
+    if (!pass_enabled("retslot") || p->u.func.count_params != 0) {
+        gen_Pop(p->u.func.count_params);
+    }
 #endif
     return;
 error:
@@ -840,7 +1312,9 @@ trans_stmt(struct ast_stmt *stmt)
     if (stmt == NULL) {
         return;
     } else if (stmt->kind <= ast_exp_listStmt) {
+        YYLTYPE         saved = gen_set_pos(stmt->pos);
         (*trans_stmt_fun_list[stmt->kind])(stmt);
+        gen_set_pos(saved);
         free(stmt);
     } else {
         lyyerror(stmt->pos, "Unknown statement type. "
@@ -938,7 +1412,10 @@ trans_call_exp(struct ast_exp *exp)
         _patches = patch;
     }
 
-    gen_Pop(p->u.func.count_params);
+    if (!pass_enabled("retslot") || p->u.func.count_params != 0) {
+        gen_Pop(p->u.func.count_params);
+    }
+
     return;
 
 error:
@@ -1001,15 +1478,26 @@ sem_trans_prog(struct ast_program *prog)
     _venv = env_base_venv();
     _fenv = env_base_fenv();
     retOffset = 0;
+    analyse_usages(prog);
+    gen_set_owner("(globals)");
     trans_global_vardecList(prog->global_var_def_list);
     int             j_jump = get_next_code_index();
     gen_Jump(0);
     trans_func_def_list(prog->func_def_list);
     link_func_calls();
     int             l_jump = get_next_code_index();
+    gen_set_owner("(main)");
     trans_stmt_list(prog->body);
     backpatch(j_jump, l_jump);
     gen_Halt();
+    trans_cold_blocks();
+
+    while (_usages != NULL) {
+        struct fun_usage *u = _usages;
+        _usages = u->next;
+        free(u);
+    }
+
     free_allocated();
     s_clear();
     return;
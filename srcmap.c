@@ -0,0 +1,140 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbg.h"
+#include "srcmap.h"
+
+struct srcmap  *
+srcmap_load(const char *path)
+{
+    struct srcmap  *map = NULL;
+    FILE           *f = fopen(path, "r");
+    char            line[1024];
+    int             cap_funs = 0;
+    int             cap_ranges = 0;
+    check(f, "Cannot open the file %s", path);
+    map = calloc(1, sizeof(*map));
+    check_mem(map);
+    check(fgets(line, sizeof(line), f) != NULL &&
+          strcmp(line, "turtle-srcmap 1\n") == 0,
+          "%s is not a source map", path);
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        int             id;
+        char            name[1024];
+        struct srcmap_range r;
+
+        if (sscanf(line, "fun %d %1023s", &id, name) == 2) {
+            check(id == map->nfuns, "Bad function id %d in %s", id, path);
+
+            if (map->nfuns == cap_funs) {
+                cap_funs = cap_funs ? cap_funs * 2 : 16;
+                map->funs = realloc(map->funs, cap_funs * sizeof(*map->funs));
+                check_mem(map->funs);
+            }
+
+            map->funs[map->nfuns] = strdup(name);
+            check_mem(map->funs[map->nfuns]);
+            ++map->nfuns;
+        } else if (sscanf(line, "%d %d %d %d %d", &r.pc, &r.count, &r.line,
+                          &r.column, &r.fun) == 5) {
+            if (map->nranges == cap_ranges) {
+                cap_ranges = cap_ranges ? cap_ranges * 2 : 64;
+                map->ranges = realloc(map->ranges,
+                                      cap_ranges * sizeof(*map->ranges));
+                check_mem(map->ranges);
+            }
+
+            map->ranges[map->nranges++] = r;
+        } else {
+            sentinel("Cannot parse \"%s\" in %s", line, path);
+        }
+    }
+
+    fclose(f);
+    return map;
+
+error:
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    srcmap_free(map);
+    return NULL;
+}
+
+const struct srcmap_range *
+srcmap_find(const struct srcmap *map, int pc)
+{
+    int             lo = 0;
+    int             hi = map->nranges - 1;
+
+    while (lo <= hi) {
+        int             mid = (lo + hi) / 2;
+        const struct srcmap_range *r = map->ranges + mid;
+
+        if (pc < r->pc) {
+            hi = mid - 1;
+        } else if (pc >= r->pc + r->count) {
+            lo = mid + 1;
+        } else {
+            return r;
+        }
+    }
+
+    return NULL;
+}
+
+const char     *
+srcmap_fun_name(const struct srcmap *map, int pc)
+{
+    const struct srcmap_range *r = srcmap_find(map, pc);
+
+    if (r == NULL || r->fun < 0 || r->fun >= map->nfuns) {
+        return NULL;
+    }
+
+    return map->funs[r->fun];
+}
+
+void
+srcmap_free(struct srcmap *map)
+{
+    if (map == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < map->nfuns; ++i) {
+        free(map->funs[i]);
+    }
+
+    free(map->funs);
+    free(map->ranges);
+    free(map);
+}
@@ -0,0 +1,75 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Reads the source maps written by `turtle -m FILE'
+ *
+ * See gen_source_map() for the format.
+ */
+
+#ifndef SRCMAP_H_
+#define SRCMAP_H_
+
+/**
+ * A run of instructions generated from the same source position
+ */
+struct srcmap_range {
+    int             pc;
+    int             count;
+    int             line;
+    int             column;
+    int             fun;
+};
+
+struct srcmap {
+    char          **funs;
+    int             nfuns;
+    // Sorted by pc
+    struct srcmap_range *ranges;
+    int             nranges;
+};
+
+/**
+ * @returns the source map loaded from @path, or NULL if it cannot be loaded
+ */
+struct srcmap  *srcmap_load(const char *path);
+
+/**
+ * @returns the range that contains @pc, or NULL if there is none
+ */
+const struct srcmap_range *srcmap_find(const struct srcmap *map, int pc);
+
+/**
+ * @returns the name of the function that contains @pc, or NULL
+ */
+const char     *srcmap_fun_name(const struct srcmap *map, int pc);
+
+/**
+ * Releases @map
+ */
+void            srcmap_free(struct srcmap *map);
+
+#endif /* end of include guard: SRCMAP_H_ */
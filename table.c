@@ -82,10 +82,6 @@ table_find(struct table *t, void *key)
     index = ((uintptr_t) key) % TBL_SIZE;
 
     for (b = t->table[index]; b; b = b->next) {
-        if (b->key == &marksym) {
-            return NULL;
-        }
-
         if (b->key == key) {
             return b->value;
         }
@@ -0,0 +1,7 @@
+26624
+3
+0
+2046
+24064
+1
+10240
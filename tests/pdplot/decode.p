@@ -0,0 +1,15 @@
+22016
+3
+22016
+4
+3584
+26624
+8
+0
+1919
+24064
+1
+26624
+8
+10240
+2048
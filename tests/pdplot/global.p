@@ -0,0 +1,20 @@
+22016
+5
+26624
+10
+1537
+1537
+3584
+26624
+14
+0
+22016
+7
+1027
+10240
+1919
+24064
+1
+26624
+14
+10240
@@ -0,0 +1,9 @@
+26624
+3
+0
+1919
+24064
+1
+26624
+3
+10240
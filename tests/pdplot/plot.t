@@ -0,0 +1,37 @@
+turtle plot
+
+var n
+var i = 0
+
+fun square(x, y, s)
+{
+  up
+  moveto(x, y)
+  down
+  moveto(x + s, y)
+  moveto(x + s, y + s)
+  moveto(x, y + s)
+  moveto(x, y)
+}
+
+fun zigzag(x, y, k)
+{
+  if (0 < k) {
+    moveto(x + 4, y + 8)
+    moveto(x + 8, y)
+    zigzag(x + 8, y, k - 1)
+  }
+}
+
+{
+  read(n)
+  while (i < n) {
+    square(200 - i * 60, 10 + i * 40, 30)
+    square(i * 50, 200, 20)
+    i = i + 1
+  }
+  up
+  moveto(0, 100)
+  down
+  zigzag(0, 100, n * 2)
+}
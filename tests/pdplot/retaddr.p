@@ -0,0 +1,19 @@
+22016
+10
+22016
+20
+26624
+10
+3584
+26624
+13
+0
+2047
+1535
+10240
+1919
+24064
+1
+26624
+13
+10240
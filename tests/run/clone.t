@@ -0,0 +1,38 @@
+turtle clone
+
+var n
+
+fun poly(x, y, side, k)
+  var i = 0
+{
+  moveto(x, y)
+  down
+  while (i < k) {
+    if (k == 3) {
+      moveto(x + side * i, y + side)
+    } else {
+      moveto(x + side, y + side * i)
+    }
+    i = i + 1
+  }
+  up
+  return i
+}
+
+fun rec(w, s)
+{
+  if (0 < w) {
+    moveto(w, s)
+    rec(w - s, s)
+  }
+}
+
+{
+  read(n)
+  poly(n, n, 10, 3)
+  poly(n, 5, 10, 4)
+  poly(1, 2, 10, 3)
+  moveto(poly(n, n, 20, 3), n)
+  rec(100, 7)
+  rec(n, 3)
+}
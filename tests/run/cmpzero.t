@@ -0,0 +1,43 @@
+turtle cmpzero
+
+var x
+var y = 5
+
+{
+  read(x)
+  while (0 < y) {
+    moveto(y, x)
+    y = y - 1
+  }
+  while (y < 3) {
+    y = y + 1
+  }
+  if (x == 0) {
+    moveto(1, 1)
+  }
+  if (1 + 1 == 2) {
+    moveto(2, 2)
+  } else {
+    moveto(3, 3)
+  }
+  if (2 * 3 < 1 - 2) {
+    moveto(4, 4)
+  } else {
+    moveto(5, 5)
+  }
+  while (1 < 0) {
+    moveto(9, 9)
+  }
+  if (0 < x - y) {
+    moveto(x, y)
+  }
+  if (0 == x) {
+    moveto(6, 6)
+  }
+  if (x < 0) {
+    moveto(7, 7)
+  }
+  if (y == 3) {
+    moveto(8, 8)
+  }
+}
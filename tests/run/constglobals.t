@@ -0,0 +1,42 @@
+turtle constglobals
+
+var a = 100
+var b = a * 2 - 7
+var c = 3
+var d = 4
+var e = -5
+var n
+
+fun f(c)
+{
+  moveto(a + c, b + e)
+  return c
+}
+
+fun g()
+  var d = 1
+{
+  moveto(d, a)
+}
+
+fun bump()
+{
+  c = c + n
+}
+
+{
+  read(n)
+  moveto(a, b)
+  f(c)
+  g()
+  d = d + 1
+  moveto(d, c)
+  if (e < 0) {
+    moveto(1, 1)
+  }
+  if (a == 100) {
+    moveto(2, 2)
+  }
+  bump()
+  moveto(c, f(n))
+}
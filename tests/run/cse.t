@@ -0,0 +1,40 @@
+turtle cse
+
+var x = 10
+var y = 20
+var w = 7
+
+fun box(a, b, s)
+  var i = 0
+{
+  while (i < 3) {
+    up
+    moveto(a + s * 2, b + s * 2)
+    down
+    moveto(a + s * 2 + i, b + s * 2)
+    moveto(a + s * 2, b + s * 2 + i)
+    a = a + 1
+    moveto(a + s * 2, b + s * 2)
+    bump()
+    moveto(a + s * 2, b + s * 2 + w * 3)
+    moveto(a + s * 2, b + s * 2 + w * 3)
+    i = i + 1
+  }
+}
+
+fun bump()
+{
+  w = w + 1
+}
+
+{
+  read(x)
+  moveto(x + y * w, y + x * w)
+  moveto(x + y * w, y + x * w)
+  moveto(x + y * w + 1, y + x * w)
+  box(x, y, w)
+  moveto(x + w * w, y - w * w)
+  read(w)
+  moveto(x + w * w, y - w * w)
+  moveto(x + w * w, y - w * w)
+}
@@ -0,0 +1,31 @@
+turtle divs
+var n
+var d
+var q = 0
+fun div (dividend, divisor)
+  var quotient = 0
+{
+  while (divisor < dividend) {
+    quotient = quotient + 1
+    dividend = dividend - divisor
+  }
+  return quotient * 100 + dividend
+}
+{
+  read (n)
+  read (d)
+  while (0 < n) {
+    moveto (div (n, d), n)
+    q = 0
+    while (d < n) { n = n - d  q = 1 + q }
+    moveto (q, n)
+    n = n - 7
+  }
+  read (n)
+  q = 0
+  while (7 < n) { q = q + 1  n = n - 7 }
+  moveto (q, n)
+  moveto (div (30000, 1), div (-5, 3))
+  moveto (div (5, -3), div (0, 1))
+  moveto (div (32767, 2), div (100, 100))
+}
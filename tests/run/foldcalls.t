@@ -0,0 +1,31 @@
+turtle foldcalls
+
+var n
+
+fun sq(x)
+{
+  return x * x
+}
+
+fun fib(n)
+{
+  if (n < 2) {
+    return n
+  }
+  return fib(n - 1) + fib(n - 2)
+}
+
+fun plot(x)
+{
+  moveto(x, x)
+  return x
+}
+
+{
+  read(n)
+  down
+  moveto(sq(7) + n, fib(15))
+  moveto(plot(3), sq(n))
+  sq(4)
+  moveto(fib(sq(3)), sq(sq(n)))
+}
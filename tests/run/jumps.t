@@ -0,0 +1,49 @@
+turtle jumps
+
+var n
+var i
+
+fun unused(a)
+{
+  moveto(a, a)
+  return a
+}
+
+fun pick(a)
+{
+  if (a < 10) {
+    if (a == 5) {
+      return 50
+    } else {
+      if (a < 0) {
+        return -1
+      }
+    }
+  } else {
+    while (10 < a) {
+      a = a - 10
+    }
+  }
+  return a
+}
+
+{
+  read(n)
+  i = 0
+  down
+  while (i < n) {
+    if (i == 3) {
+      up
+    } else {
+      if (i == 4) {
+        down
+      }
+    }
+    moveto(i, pick(i * 3 - 2))
+    i = i + 1
+  }
+  if (n < 0) {
+  } else {
+    moveto(pick(n), n)
+  }
+}
@@ -0,0 +1,65 @@
+turtle pen
+
+var n
+var i = 0
+
+fun box(x, y)
+{
+  up
+  moveto(x, y)
+  down
+  moveto(x + 10, y)
+  moveto(x + 10, y + 10)
+  up
+}
+
+fun go()
+{
+  moveto(5, 5)
+  return 1
+}
+
+fun a()
+{
+  down
+  return 1
+}
+
+fun b()
+{
+  down
+  moveto(5, 5)
+  return 0
+}
+
+{
+  read(n)
+  up
+  box(n, n)
+  up
+  moveto(5, 5)
+  moveto(5, 5)
+  down
+  while (i < n) {
+    down
+    moveto(go(), 5)
+    moveto(5, 5)
+    i = i + 1
+    if (i == 3) {
+      up
+    }
+  }
+  down
+  moveto(0, 0)
+  up
+  up
+  if (a() > b()) {
+    moveto(9, 9)
+  }
+  up
+  if (b() >= a()) {
+    moveto(7, 7)
+  } else {
+    moveto(8, 8)
+  }
+}
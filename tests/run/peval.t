@@ -0,0 +1,39 @@
+turtle peval
+
+var g = 3
+var h = 0
+
+fun sq(x)
+{
+  return x * x
+}
+
+fun fib(n)
+{
+  if (n < 2) {
+    return n
+  }
+  return fib(n - 1) + fib(n - 2)
+}
+
+fun side(n)
+  var i = 0
+{
+  while (i < n) {
+    moveto(i * sq(g) + 1, fib(i))
+    h = h + 1
+    i = i + 1
+  }
+  return h
+}
+
+{
+  down
+  if (12 < side(12)) {
+    moveto(30000 * 3, -sq(200))
+  }
+  if (g != 3) {
+    up
+  }
+  moveto(fib(20), h)
+}
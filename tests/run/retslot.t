@@ -0,0 +1,41 @@
+turtle retslot
+
+var n
+var g = 0
+
+fun f(a)
+{
+  g = g + a
+  moveto(g, n)
+  return a * 2
+}
+
+fun h(a)
+{
+  return f(a)
+}
+
+fun k()
+{
+  moveto(1, 2)
+}
+
+fun twice(a)
+{
+  if (a < 0) {
+    return -a
+  }
+  f(a)
+  return f(a)
+}
+
+{
+  read(n)
+  f(3)
+  h(n)
+  k()
+  g = f(5) + 1
+  moveto(g, 0)
+  twice(n)
+  moveto(twice(-n), h(1))
+}
@@ -0,0 +1,33 @@
+turtle rotate
+var n
+var i = 0
+var j
+fun steps(k)
+  var s = 0
+{
+  while (k < 0) {
+    k = k + 3
+    s = s + 1
+  }
+  return s
+}
+{
+  read(n)
+  down
+  while (i < n) {
+    moveto(i + 1, i * 2)
+    j = 0
+    while (j < i) {
+      moveto(i, j + 1)
+      j = j + 1
+    }
+    i = i + 1
+  }
+  while (n < 0) {
+    moveto(9, 9)
+  }
+  while (steps(-n) < n) {
+    moveto(n, n * 3)
+    n = n - 1
+  }
+}
@@ -0,0 +1,30 @@
+turtle unroll
+
+var n
+var i
+
+{
+  read(n)
+  i = 0
+  down
+  while (i < 100) {
+    moveto(i, i * 3 + n)
+    i = i + 1
+  }
+  up
+  i = 0
+  while (i < 7) {
+    moveto(i + n, 5)
+    moveto(i * n, i - n)
+    moveto(i - n, i * 2)
+    moveto(n * 2, i)
+    moveto(i + 5, n - i)
+    i = i + 1
+  }
+  i = 30000
+  while (i < -30000) {
+    moveto(i, 1)
+    i = i + 1000
+  }
+  moveto(i, 2)
+}
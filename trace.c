@@ -0,0 +1,765 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "trace.h"
+
+#define MAGIC "PDPLOTTR"
+
+/**
+ * Block header: first step and number of steps, 5 registers, 2 sizes and the
+ * number of branches
+ */
+#define BLOCK_HEADER_SIZE (2 * 8 + 5 * 4 + 3 * 4)
+
+/**
+ * Bytes taken by the bits of @n branches
+ */
+#define BITS_SIZE(n) (((n) + 7) / 8)
+
+struct trace_block {
+    long long       first;
+    long long       steps;
+    int             pc;
+    int             sp;
+    int             fp;
+    int             pen_x;
+    int             pen_y;
+    // Of the varints
+    uint32_t        size;
+    uint32_t        branches;
+    uint32_t        packed_size;
+    // Of the compressed data in the file
+    long            offset;
+};
+
+/**
+ * A block handed over to the writer, with its buffers
+ */
+struct trace_pending {
+    uint8_t        *data;
+    uint8_t        *bits;
+    size_t          used;
+    size_t          branches;
+    long long       first;
+    long long       steps;
+    int             pc;
+    int             sp;
+    int             fp;
+    int             pen_x;
+    int             pen_y;
+};
+
+struct trace_writer {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+    // Set while block is being written, after which its buffers are the
+    // next ones the recorder fills
+    int             busy;
+    struct trace_pending block;
+    // Set once the last block is handed over
+    int             closing;
+};
+
+struct trace_reader {
+    FILE           *in;
+    struct vm_image image;
+    struct trace_block *blocks;
+    int             nblocks;
+    // The block being read, -1 if none
+    int             current;
+    uint8_t        *data;
+    uint8_t        *packed;
+    const uint8_t  *p;
+    const uint8_t  *end;
+    // Next branch
+    uint32_t        branch;
+    // State before the next step
+    long long       step;
+    int             pc;
+    int             sp;
+    int             fp;
+    int             pen_x;
+    int             pen_y;
+};
+
+static uint8_t *
+put(uint8_t *p, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; ++i) {
+        *p++ = (uint8_t) (v >> (8 * i));
+    }
+
+    return p;
+}
+
+static uint64_t
+get(const uint8_t **p, int bytes)
+{
+    uint64_t        v = 0;
+
+    for (int i = 0; i < bytes; ++i) {
+        v |= (uint64_t) *(*p)++ << (8 * i);
+    }
+
+    return v;
+}
+
+/**
+ * Starts the block of @t at the current step of @vm. Its bits are all 0.
+ */
+static void
+start_block(struct trace *t, const struct vm *vm)
+{
+    t->used = 0;
+    t->branches = 0;
+    t->first = vm->steps;
+    t->pc = vm->pc;
+    t->sp = vm->sp;
+    t->fp = vm->fp;
+    t->pen_x = vm->pen_x;
+    t->pen_y = vm->pen_y;
+}
+
+/**
+ * Writes the block @b to the file of @t
+ */
+static void
+write_block(struct trace *t, struct trace_pending *b)
+{
+    size_t          bits = BITS_SIZE(b->branches);
+    uLongf          size = compressBound(b->used + bits);
+    uint8_t        *buf = malloc(BLOCK_HEADER_SIZE + size);
+    uint8_t        *p;
+
+    check_mem(buf);
+    memcpy(b->data + b->used, b->bits, bits);
+    check(compress2(buf + BLOCK_HEADER_SIZE, &size, b->data, b->used + bits,
+                    Z_BEST_SPEED) == Z_OK, "Cannot compress the trace");
+    p = put(buf, (uint64_t) b->first, 8);
+    p = put(p, (uint64_t) (b->steps - b->first), 8);
+    p = put(p, (uint32_t) b->pc, 4);
+    p = put(p, (uint32_t) b->sp, 4);
+    p = put(p, (uint32_t) b->fp, 4);
+    p = put(p, (uint32_t) b->pen_x, 4);
+    p = put(p, (uint32_t) b->pen_y, 4);
+    p = put(p, (uint32_t) b->used, 4);
+    p = put(p, (uint32_t) b->branches, 4);
+    put(p, (uint32_t) size, 4);
+    check(fwrite(buf, 1, BLOCK_HEADER_SIZE + size, t->out) ==
+          BLOCK_HEADER_SIZE + size, "Cannot write the trace");
+    free(buf);
+    return;
+
+error:
+    free(buf);
+    t->failed = 1;
+}
+
+/**
+ * The writer thread of @arg, a struct trace
+ */
+static void    *
+write_blocks(void *arg)
+{
+    struct trace   *t = arg;
+    struct trace_writer *w = t->writer;
+
+    pthread_mutex_lock(&w->lock);
+
+    for (;;) {
+        while (!w->busy && !w->closing) {
+            pthread_cond_wait(&w->changed, &w->lock);
+        }
+
+        if (!w->busy) {
+            break;
+        }
+
+        pthread_mutex_unlock(&w->lock);
+
+        // The first failure is enough
+        if (!t->failed) {
+            write_block(t, &w->block);
+        }
+
+        memset(w->block.bits, 0, BITS_SIZE(w->block.branches));
+        pthread_mutex_lock(&w->lock);
+        w->busy = 0;
+        pthread_cond_signal(&w->changed);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/**
+ * Hands the block of @t, which ends at @steps, over to the writer, and takes
+ * the buffers of the block it wrote before
+ */
+static void
+hand_over(struct trace *t, long long steps)
+{
+    struct trace_writer *w = t->writer;
+    struct trace_pending *b = &w->block;
+    uint8_t        *data,
+                   *bits;
+
+    pthread_mutex_lock(&w->lock);
+
+    while (w->busy) {
+        pthread_cond_wait(&w->changed, &w->lock);
+    }
+
+    data = b->data;
+    bits = b->bits;
+    b->data = t->data;
+    b->bits = t->bits;
+    b->used = t->used;
+    b->branches = t->branches;
+    b->first = t->first;
+    b->steps = steps;
+    b->pc = t->pc;
+    b->sp = t->sp;
+    b->fp = t->fp;
+    b->pen_x = t->pen_x;
+    b->pen_y = t->pen_y;
+    t->data = data;
+    t->bits = bits;
+    w->busy = 1;
+    pthread_cond_signal(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+}
+
+struct trace   *
+trace_new(const char *path, const struct vm *vm)
+{
+    struct trace   *t = calloc(1, sizeof(*t));
+    struct trace_writer *w = NULL;
+    const struct vm_image *image = vm->image;
+    uint8_t        *header = NULL,
+                   *p;
+    size_t          size = 8 + 4 + 4 + 2 * (size_t) image->size;
+
+    check_mem(t);
+    w = calloc(1, sizeof(*w));
+    check_mem(w);
+    t->data = malloc(TRACE_DATA_SIZE);
+    t->bits = calloc(1, TRACE_BLOCK_SIZE + 1);
+    w->block.data = malloc(TRACE_DATA_SIZE);
+    w->block.bits = calloc(1, TRACE_BLOCK_SIZE + 1);
+    header = malloc(size);
+    check_mem(t->data && t->bits && w->block.data && w->block.bits &&
+              header);
+    t->out = fopen(path, "wb");
+    check(t->out, "Cannot open the file %s for writing", path);
+    memcpy(header, MAGIC, 8);
+    p = put(header + 8, TRACE_VERSION, 4);
+    p = put(p, (uint32_t) image->size, 4);
+
+    for (int i = 0; i < image->size; ++i) {
+        p = put(p, image->code[i], 2);
+    }
+
+    check(fwrite(header, 1, size, t->out) == size,
+          "Cannot write the file %s", path);
+    free(header);
+    header = NULL;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->changed, NULL);
+    t->writer = w;
+    check(pthread_create(&w->thread, NULL, write_blocks, t) == 0,
+          "Cannot start the trace writer");
+    start_block(t, vm);
+    return t;
+
+error:
+    free(header);
+
+    if (t != NULL && t->writer != NULL) {
+        pthread_cond_destroy(&w->changed);
+        pthread_mutex_destroy(&w->lock);
+    }
+
+    if (w != NULL) {
+        free(w->block.data);
+        free(w->block.bits);
+        free(w);
+    }
+
+    if (t != NULL) {
+        if (t->out != NULL) {
+            fclose(t->out);
+        }
+
+        free(t->data);
+        free(t->bits);
+        free(t);
+    }
+
+    return NULL;
+}
+
+void
+trace_cut(struct trace *t, const struct vm *vm)
+{
+    hand_over(t, vm->steps);
+    start_block(t, vm);
+}
+
+int
+trace_close(struct trace *t, const struct vm *vm)
+{
+    struct trace_writer *w;
+    int             failed;
+
+    if (t == NULL) {
+        return 0;
+    }
+
+    w = t->writer;
+    hand_over(t, vm->steps);
+    pthread_mutex_lock(&w->lock);
+    w->closing = 1;
+    pthread_cond_signal(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    if (fclose(t->out) != 0) {
+        t->failed = 1;
+    }
+
+    failed = t->failed;
+    pthread_cond_destroy(&w->changed);
+    pthread_mutex_destroy(&w->lock);
+    free(w->block.data);
+    free(w->block.bits);
+    free(w);
+    free(t->data);
+    free(t->bits);
+    free(t);
+    return failed ? -1 : 0;
+}
+
+struct trace_reader *
+trace_reader_open(const char *path)
+{
+    struct trace_reader *r = calloc(1, sizeof(*r));
+    uint8_t         header[BLOCK_HEADER_SIZE];
+    const uint8_t  *p;
+    struct trace_block *b;
+    int             capacity = 0;
+    size_t          largest = 0,
+                    largest_packed = 0;
+    long long       next = 0;
+    size_t          n;
+
+    check_mem(r);
+    r->current = -1;
+    r->in = fopen(path, "rb");
+    check(r->in, "Cannot open the file %s", path);
+    check(fread(header, 1, 16, r->in) == 16 &&
+          memcmp(header, MAGIC, 8) == 0, "%s is not a trace", path);
+    p = header + 8;
+    check(get(&p, 4) == TRACE_VERSION,
+          "%s is from another version of pdplot", path);
+    r->image.size = (int) get(&p, 4);
+    check(r->image.size > 0 && r->image.size <= VM_CODE_SIZE,
+          "%s is not a valid trace", path);
+
+    for (int i = 0; i < r->image.size; ++i) {
+        check(fread(header, 1, 2, r->in) == 2, "%s is truncated", path);
+        p = header;
+        r->image.code[i] = (uint16_t) get(&p, 2);
+    }
+
+    // Only the headers are read here, the blocks are skipped over
+    while ((n = fread(header, 1, BLOCK_HEADER_SIZE, r->in)) != 0) {
+        check(n == BLOCK_HEADER_SIZE, "%s is truncated", path);
+
+        if (r->nblocks == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            b = realloc(r->blocks, capacity * sizeof(*b));
+            check_mem(b);
+            r->blocks = b;
+        }
+
+        b = &r->blocks[r->nblocks++];
+        p = header;
+        b->first = (long long) get(&p, 8);
+        b->steps = (long long) get(&p, 8);
+        b->pc = (int32_t) get(&p, 4);
+        b->sp = (int32_t) get(&p, 4);
+        b->fp = (int32_t) get(&p, 4);
+        b->pen_x = (int32_t) get(&p, 4);
+        b->pen_y = (int32_t) get(&p, 4);
+        b->size = (uint32_t) get(&p, 4);
+        b->branches = (uint32_t) get(&p, 4);
+        b->packed_size = (uint32_t) get(&p, 4);
+        b->offset = ftell(r->in);
+        check(b->first == next && b->steps >= 0 &&
+              b->size + (uint64_t) BITS_SIZE(b->branches) <= TRACE_DATA_SIZE,
+              "%s is not a valid trace", path);
+        check(fseek(r->in, b->packed_size, SEEK_CUR) == 0,
+              "%s is truncated", path);
+        next += b->steps;
+        n = b->size + BITS_SIZE(b->branches);
+        largest = n > largest ? n : largest;
+        largest_packed = b->packed_size > largest_packed ?
+            b->packed_size : largest_packed;
+    }
+
+    check(r->nblocks > 0, "%s has no steps", path);
+    r->data = malloc(largest + 1);
+    r->packed = malloc(largest_packed + 1);
+    check_mem(r->data && r->packed);
+    check(trace_reader_seek(r, 0) == 0, "%s is not a valid trace", path);
+    return r;
+
+error:
+    trace_reader_free(r);
+    return NULL;
+}
+
+long long
+trace_reader_steps(const struct trace_reader *r)
+{
+    const struct trace_block *last = &r->blocks[r->nblocks - 1];
+
+    return last->first + last->steps;
+}
+
+const struct vm_image *
+trace_reader_image(const struct trace_reader *r)
+{
+    return &r->image;
+}
+
+/**
+ * Decompresses the block @i of @r and moves to its first step
+ */
+static int
+load_block(struct trace_reader *r, int i)
+{
+    const struct trace_block *b = &r->blocks[i];
+    uLongf          size = b->size + BITS_SIZE(b->branches);
+
+    if (r->current != i) {
+        check(fseek(r->in, b->offset, SEEK_SET) == 0 &&
+              fread(r->packed, 1, b->packed_size, r->in) == b->packed_size,
+              "Cannot read the trace");
+        check(uncompress(r->data, &size, r->packed, b->packed_size) == Z_OK
+              && size == b->size + BITS_SIZE(b->branches),
+              "The trace is corrupted");
+        r->current = i;
+    }
+
+    r->p = r->data;
+    r->end = r->data + b->size;
+    r->branch = 0;
+    r->step = b->first;
+    r->pc = b->pc;
+    r->sp = b->sp;
+    r->fp = b->fp;
+    r->pen_x = b->pen_x;
+    r->pen_y = b->pen_y;
+    return 0;
+
+error:
+    r->current = -1;
+    return -1;
+}
+
+int
+trace_reader_seek(struct trace_reader *r, long long step)
+{
+    struct trace_event event;
+    int             lo = 0,
+                    hi = r->nblocks - 1;
+
+    check(step >= 0 && step <= trace_reader_steps(r),
+          "There is no step %lld in the trace", step);
+
+    // The last block that starts at or before the step
+    while (lo < hi) {
+        int             mid = (lo + hi + 1) / 2;
+
+        if (r->blocks[mid].first <= step) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    check(load_block(r, lo) == 0, "Cannot seek to step %lld", step);
+
+    while (r->step < step) {
+        check(trace_reader_next(r, &event) == 1,
+              "Cannot seek to step %lld", step);
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * @returns the next varint of the block, 0 past its end (only the last step
+ * of a trace that failed may be short of data)
+ */
+static uint32_t
+next_varint(struct trace_reader *r)
+{
+    uint32_t        v = 0;
+    int             shift = 0;
+
+    while (r->p < r->end && shift < 35) {
+        uint8_t         byte = *r->p++;
+        v |= (uint32_t) (byte & 0x7F) << shift;
+
+        if (!(byte & 0x80)) {
+            break;
+        }
+
+        shift += 7;
+    }
+
+    return v;
+}
+
+/**
+ * @returns 1 if the next branch of the block was taken
+ */
+static int
+next_branch(struct trace_reader *r)
+{
+    uint32_t        i = r->branch++;
+
+    if (i >= r->blocks[r->current].branches) {
+        return 0;
+    }
+
+    return (r->end[i / 8] >> (i % 8)) & 1;
+}
+
+static int
+next_signed(struct trace_reader *r)
+{
+    uint32_t        v = next_varint(r);
+
+    return (int) (v >> 1) ^ -(int) (v & 1);
+}
+
+int
+trace_reader_next(struct trace_reader *r, struct trace_event *event)
+{
+    const struct trace_block *b;
+    uint16_t        w;
+    int             base;
+
+    check(r->current >= 0, "The trace is corrupted");
+    b = &r->blocks[r->current];
+
+    // Blocks of no steps are only possible at the end
+    while (r->step == b->first + b->steps) {
+        if (r->current + 1 == r->nblocks) {
+            return 0;
+        }
+
+        check(load_block(r, r->current + 1) == 0, "Cannot read the trace");
+        b = &r->blocks[r->current];
+    }
+
+    check(r->pc >= 0 && r->pc < r->image.size, "The trace is corrupted");
+    memset(event, 0, sizeof(*event));
+    w = r->image.code[r->pc];
+    event->step = r->step++;
+    event->pc = r->pc;
+    event->opcode = (w >> 8) & 0x7E;
+    event->sp = r->sp;
+    event->fp = r->fp;
+    base = (w & 0x100) ? r->fp : 0;
+    event->addr = base + (int8_t) (w & 0xFF);
+
+    if (vm_is_two_words(event->opcode) && r->pc + 1 < r->image.size) {
+        event->operand = r->image.code[r->pc + 1];
+        r->pc += 2;
+    } else {
+        r->pc += 1;
+    }
+
+    switch (event->opcode) {
+    case VM_Read:
+        event->value = next_signed(r);
+        break;
+
+    case VM_Store:
+        event->value = next_signed(r);
+        --r->sp;
+        break;
+
+    case VM_Load:
+    case VM_Loadi:
+        ++r->sp;
+        break;
+
+    case VM_Move:
+        r->pen_x += next_signed(r);
+        r->pen_y += next_signed(r);
+        event->x = r->pen_x;
+        event->y = r->pen_y;
+        r->sp -= 2;
+        break;
+
+    case VM_Add:
+    case VM_Sub:
+    case VM_Mul:
+        --r->sp;
+        break;
+
+    case VM_Pop:
+        r->sp -= event->operand;
+        break;
+
+    case VM_Jsr:
+        r->sp += 2;
+        r->fp = r->sp;
+        r->pc = event->operand;
+        break;
+
+    case VM_Rts:
+        r->sp = r->fp - 2;
+        r->pc = event->pc + next_signed(r);
+        r->fp += next_signed(r);
+        break;
+
+    case VM_Jump:
+        r->pc = event->operand;
+        break;
+
+    case VM_Jeq:
+    case VM_Jlt:
+        event->taken = next_branch(r);
+
+        if (event->taken) {
+            r->pc = event->operand;
+        }
+
+        break;
+
+    default:
+        // Halt, Up, Down, Test, Neg, or the step that failed
+        break;
+    }
+
+    if (event->opcode != VM_Read && event->opcode != VM_Store &&
+            event->opcode != VM_Load) {
+        event->addr = 0;
+    }
+
+    check(r->p <= r->end, "The trace is corrupted");
+    return 1;
+
+error:
+    return -1;
+}
+
+void
+trace_reader_free(struct trace_reader *r)
+{
+    if (r == NULL) {
+        return;
+    }
+
+    if (r->in != NULL) {
+        fclose(r->in);
+    }
+
+    free(r->blocks);
+    free(r->data);
+    free(r->packed);
+    free(r);
+}
+
+int
+trace_print(const char *path, long long first, long long count, FILE *out)
+{
+    struct trace_reader *r = trace_reader_open(path);
+    struct trace_event event;
+    int             got = 0;
+
+    check(r, "Cannot read the trace %s", path);
+    check(trace_reader_seek(r, first) == 0, "Cannot seek in %s", path);
+
+    while (count-- != 0 && (got = trace_reader_next(r, &event)) == 1) {
+        fprintf(out, "%lld %d %s", event.step, event.pc,
+                vm_opcode_name(event.opcode) ? vm_opcode_name(event.opcode)
+                : "?");
+
+        if (vm_is_two_words(event.opcode)) {
+            fprintf(out, " %d", event.operand);
+        }
+
+        fprintf(out, " sp=%d fp=%d", event.sp, event.fp);
+
+        switch (event.opcode) {
+        case VM_Read:
+        case VM_Store:
+            fprintf(out, " [%d]=%d", event.addr, event.value);
+            break;
+
+        case VM_Load:
+            // The trace holds no value for a Load, only its place
+            fprintf(out, " [%d]", event.addr);
+            break;
+
+        case VM_Move:
+            fprintf(out, " pen=%d,%d", event.x, event.y);
+            break;
+
+        case VM_Jeq:
+        case VM_Jlt:
+            fprintf(out, " %s", event.taken ? "taken" : "not taken");
+            break;
+        }
+
+        fprintf(out, "\n");
+    }
+
+    check(got >= 0, "%s is corrupted", path);
+    trace_reader_free(r);
+    return 0;
+
+error:
+    trace_reader_free(r);
+    return -1;
+}
@@ -0,0 +1,274 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Execution traces
+ *
+ * The recorder keeps what a run did, step by step, in little space: the
+ * image, then only what cannot be told from it, i.e., whether each Jeq/Jlt
+ * was taken, where each Rts went, the value of each Read/Store and the
+ * position of each Move. The reader replays these against the image to give
+ * back the pc, SP and FP of every step, the values written to the stack and
+ * the pen events.
+ *
+ * The data is cut into blocks of about TRACE_BLOCK_SIZE bytes. Each one is
+ * compressed on its own and starts with the state of the machine at its
+ * first step, so that the reader can seek to any step by decompressing a
+ * single block. The recorder compresses a block on another thread while the
+ * machine runs on to fill the next one.
+ *
+ * All numbers are little-endian:
+ *
+ *     "PDPLOTTR", version (u32), image size n (u32), n code words (u16),
+ *     then per block:
+ *     first step, number of steps (i64), pc, sp, fp, pen_x, pen_y (i32),
+ *     size of the varints, number of branches, size once compressed (u32),
+ *     compressed data (zlib)
+ *
+ * The data of a block is a sequence of varints, the signed ones zigzag
+ * encoded, in the order of the steps they belong to:
+ *
+ *     Rts             pc - pc of the Rts, fp - fp before the Rts (signed)
+ *     Read, Store     the value written (signed)
+ *     Move            x - pen x, y - pen y (signed)
+ *
+ * followed by one bit per Jeq or Jlt, set if taken, from the lowest bit of
+ * the first byte on.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdio.h>
+
+#include "vm.h"
+
+#define TRACE_VERSION 1
+
+/**
+ * A block is cut at the first Jeq, Jlt, Rts, Jump or Jsr once its data
+ * reaches that size. There are no more than VM_CODE_SIZE steps in between,
+ * each with at most two varints of 5 bytes.
+ */
+#define TRACE_BLOCK_SIZE 0x10000
+#define TRACE_DATA_SIZE (2 * TRACE_BLOCK_SIZE + 10 * VM_CODE_SIZE)
+
+struct trace_writer;
+
+/**
+ * Recorder. The machine calls the trace_*() functions below on the steps
+ * that write to the data of the block, then trace_jump() on the ones that
+ * may end it.
+ */
+struct trace {
+    FILE           *out;
+    uint8_t        *data;
+    size_t          used;
+    // One bit per branch
+    uint8_t        *bits;
+    size_t          branches;
+    // State at the first step of the block
+    long long       first;
+    int             pc;
+    int             sp;
+    int             fp;
+    int             pen_x;
+    int             pen_y;
+    // Compresses and writes the blocks on its own thread
+    struct trace_writer *writer;
+    // Set once anything could not be written, by the writer
+    int             failed;
+};
+
+/**
+ * One step, as given back by the reader
+ */
+struct trace_event {
+    // Starting from 0
+    long long       step;
+    int             pc;
+    int             opcode;
+    // 0 unless the instruction takes one
+    int             operand;
+    // Before the step
+    int             sp;
+    int             fp;
+    // Jeq, Jlt: 1 if taken
+    int             taken;
+    // Read, Store: stack[addr] = value; Load: stack[addr] pushed
+    int             addr;
+    int             value;
+    // Move: where the pen went
+    int             x;
+    int             y;
+};
+
+struct trace_reader;
+
+/**
+ * @returns a recorder writing to @path the trace of @vm from its current
+ * state, or NULL if @path cannot be written
+ */
+struct trace   *trace_new(const char *path, const struct vm *vm);
+
+/**
+ * Writes the block recorded so far, and starts the next one from the state
+ * of @vm
+ */
+void            trace_cut(struct trace *t, const struct vm *vm);
+
+/**
+ * Writes the last block, ending at the current step of @vm, and frees @t
+ *
+ * @returns 0 if the whole trace was written, -1 otherwise
+ */
+int             trace_close(struct trace *t, const struct vm *vm);
+
+static inline void
+trace_put(struct trace *t, uint32_t v)
+{
+    uint8_t        *p = t->data + t->used;
+
+    while (v >= 0x80) {
+        *p++ = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+
+    *p++ = (uint8_t) v;
+    t->used = (size_t) (p - t->data);
+}
+
+static inline uint32_t
+trace_zigzag(int v)
+{
+    return ((uint32_t) v << 1) ^ (uint32_t) -(v < 0);
+}
+
+/**
+ * @returns 1 once the block is to be cut, at the next Jeq, Jlt, Rts, Jump or
+ * Jsr
+ */
+static inline int
+trace_full(const struct trace *t)
+{
+    return t->used + t->branches / 8 >= TRACE_BLOCK_SIZE;
+}
+
+/**
+ * After a Jeq, Jlt, Rts, Jump or Jsr, i.e., a step that may end the block,
+ * once @vm is at the next step
+ */
+static inline void
+trace_jump(struct trace *t, const struct vm *vm)
+{
+    if (trace_full(t)) {
+        trace_cut(t, vm);
+    }
+}
+
+/**
+ * On a Jeq or Jlt
+ */
+static inline void
+trace_branch(struct trace *t, int taken)
+{
+    t->bits[t->branches / 8] |= (uint8_t) (taken << (t->branches % 8));
+    ++t->branches;
+}
+
+/**
+ * On the Rts at @pc, run with the frame at @fp, that goes back to @to with
+ * the frame at @to_fp
+ */
+static inline void
+trace_return(struct trace *t, int pc, int fp, int to, int to_fp)
+{
+    trace_put(t, trace_zigzag(to - pc));
+    trace_put(t, trace_zigzag(to_fp - fp));
+}
+
+/**
+ * On a Read or Store of @value
+ */
+static inline void
+trace_value(struct trace *t, int value)
+{
+    trace_put(t, trace_zigzag(value));
+}
+
+/**
+ * On a Move by (@dx, @dy)
+ */
+static inline void
+trace_move(struct trace *t, int dx, int dy)
+{
+    trace_put(t, trace_zigzag(dx));
+    trace_put(t, trace_zigzag(dy));
+}
+
+/**
+ * @returns a reader of the trace @path, at its first step, or NULL if it
+ * cannot be read
+ */
+struct trace_reader *trace_reader_open(const char *path);
+
+/**
+ * @returns the number of steps in the trace read by @r
+ */
+long long       trace_reader_steps(const struct trace_reader *r);
+
+/**
+ * @returns the image the trace read by @r was recorded from
+ */
+const struct vm_image *trace_reader_image(const struct trace_reader *r);
+
+/**
+ * Moves @r to @step, so that it is the next one given back
+ *
+ * @returns 0 on success, -1 if there is no such step or the trace is broken
+ */
+int             trace_reader_seek(struct trace_reader *r, long long step);
+
+/**
+ * Gives back the next step in @event
+ *
+ * @returns 1 if there was one, 0 at the end of the trace, -1 if it is broken
+ */
+int             trace_reader_next(struct trace_reader *r,
+                                  struct trace_event *event);
+
+void            trace_reader_free(struct trace_reader *r);
+
+/**
+ * Prints @count steps (all if negative) from @first of the trace @path to
+ * @out, one per line
+ *
+ * @returns 0 on success, -1 otherwise
+ */
+int             trace_print(const char *path, long long first, long long count,
+                            FILE *out);
+
+#endif /* end of include guard: TRACE_H_ */
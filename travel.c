@@ -0,0 +1,414 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "travel.h"
+
+/**
+ * 2-opt only tries to reverse runs of up to TRAVEL_WINDOW strokes, and stops
+ * after TRAVEL_PASSES passes
+ */
+#define TRAVEL_WINDOW 256
+#define TRAVEL_PASSES 16
+
+/**
+ * Pen of a replayed stream, for the statistics
+ */
+struct account {
+    struct travel_stats stats;
+    int             pen_down;
+    int             x;
+    int             y;
+};
+
+static double
+distance(int x1, int y1, int x2, int y2)
+{
+    return hypot((double) (x2 - x1), (double) (y2 - y1));
+}
+
+/**
+ * Adds the event to the statistics of the pen @a
+ */
+static void
+account(void *data, enum vm_pen_event event, int x, int y)
+{
+    struct account *a = data;
+
+    switch (event) {
+    case vm_pen_up:
+        if (a->pen_down) {
+            ++a->stats.actuations;
+        }
+
+        a->pen_down = 0;
+        break;
+
+    case vm_pen_down:
+        if (!a->pen_down) {
+            ++a->stats.actuations;
+            ++a->stats.strokes;
+        }
+
+        a->pen_down = 1;
+        break;
+
+    case vm_pen_move:
+        if (a->pen_down) {
+            a->stats.down_distance += distance(a->x, a->y, x, y);
+        } else {
+            a->stats.up_distance += distance(a->x, a->y, x, y);
+        }
+
+        a->x = x;
+        a->y = y;
+        break;
+    }
+}
+
+static int
+add_point(struct travel *t, int x, int y)
+{
+    if (t->npoints == t->points_capacity) {
+        t->points_capacity = t->points_capacity ? 2 * t->points_capacity : 256;
+        t->points = realloc(t->points,
+                            t->points_capacity * sizeof(*t->points));
+        check_mem(t->points);
+    }
+
+    t->points[t->npoints].x = x;
+    t->points[t->npoints].y = y;
+    ++t->npoints;
+    ++t->strokes[t->nstrokes - 1].count;
+    return 0;
+
+error:
+    return -1;
+}
+
+static int
+add_stroke(struct travel *t)
+{
+    if (t->nstrokes == t->strokes_capacity) {
+        t->strokes_capacity = t->strokes_capacity ?
+                              2 * t->strokes_capacity : 64;
+        t->strokes = realloc(t->strokes,
+                             t->strokes_capacity * sizeof(*t->strokes));
+        check_mem(t->strokes);
+    }
+
+    t->strokes[t->nstrokes].first = t->npoints;
+    t->strokes[t->nstrokes].count = 0;
+    t->strokes[t->nstrokes].reversed = 0;
+    ++t->nstrokes;
+    return add_point(t, t->x, t->y);
+
+error:
+    return -1;
+}
+
+static const struct travel_point *
+stroke_start(const struct travel *t, const struct travel_stroke *s)
+{
+    return &t->points[s->reversed ? s->first + s->count - 1 : s->first];
+}
+
+static const struct travel_point *
+stroke_end(const struct travel *t, const struct travel_stroke *s)
+{
+    return &t->points[s->reversed ? s->first : s->first + s->count - 1];
+}
+
+/**
+ * @returns the distance from the end of the stroke @i (the origin if @i is
+ * -1) to the start of the stroke @j (0 if there is none)
+ */
+static double
+gap(const struct travel *t, int i, int j)
+{
+    const struct travel_point *a,
+                   *b;
+    struct travel_point origin = { 0, 0 };
+
+    if (j >= t->nstrokes) {
+        return 0;
+    }
+
+    a = i < 0 ? &origin : stroke_end(t, &t->strokes[i]);
+    b = stroke_start(t, &t->strokes[j]);
+    return distance(a->x, a->y, b->x, b->y);
+}
+
+/**
+ * Greedily orders the strokes: each one is followed by the closest start or
+ * end of the remaining ones
+ */
+static void
+nearest_neighbour(struct travel *t)
+{
+    int             x = 0,
+                    y = 0;
+
+    for (int i = 0; i < t->nstrokes; ++i) {
+        int             best = i;
+        double          best_distance = -1;
+
+        for (int j = i; j < t->nstrokes; ++j) {
+            struct travel_stroke *s = &t->strokes[j];
+            const struct travel_point *first = &t->points[s->first];
+            const struct travel_point *last =
+                &t->points[s->first + s->count - 1];
+            double          d = distance(x, y, first->x, first->y);
+
+            if (best_distance < 0 || d < best_distance) {
+                best = j;
+                best_distance = d;
+                s->reversed = 0;
+            }
+
+            d = distance(x, y, last->x, last->y);
+
+            if (d < best_distance) {
+                best = j;
+                best_distance = d;
+                s->reversed = 1;
+            }
+
+            if (best_distance == 0) {
+                break;
+            }
+        }
+
+        struct travel_stroke tmp = t->strokes[i];
+        t->strokes[i] = t->strokes[best];
+        t->strokes[best] = tmp;
+        x = stroke_end(t, &t->strokes[i])->x;
+        y = stroke_end(t, &t->strokes[i])->y;
+    }
+}
+
+/**
+ * Draws the strokes @i to @j in the opposite order and direction
+ */
+static void
+reverse(struct travel *t, int i, int j)
+{
+    for (; i <= j; ++i, --j) {
+        struct travel_stroke tmp = t->strokes[i];
+        t->strokes[i] = t->strokes[j];
+        t->strokes[j] = tmp;
+        t->strokes[i].reversed = !t->strokes[i].reversed;
+
+        if (i != j) {
+            t->strokes[j].reversed = !t->strokes[j].reversed;
+        }
+    }
+}
+
+/**
+ * Reverses runs of strokes while it shortens the travel. Only the gaps
+ * around the run change.
+ */
+static void
+two_opt(struct travel *t)
+{
+    int             improved = 1;
+
+    for (int pass = 0; pass < TRAVEL_PASSES && improved; ++pass) {
+        improved = 0;
+
+        for (int i = 0; i < t->nstrokes; ++i) {
+            for (int j = i; j < t->nstrokes && j < i + TRAVEL_WINDOW; ++j) {
+                const struct travel_point *a,
+                               *b,
+                               *c;
+                struct travel_point origin = { 0, 0 };
+                double          before,
+                                after;
+
+                a = i == 0 ? &origin : stroke_end(t, &t->strokes[i - 1]);
+                // After the reversal, i ends where it started and j starts
+                // where it ended
+                b = stroke_end(t, &t->strokes[j]);
+                c = stroke_start(t, &t->strokes[i]);
+                before = gap(t, i - 1, i) + gap(t, j, j + 1);
+                after = distance(a->x, a->y, b->x, b->y);
+
+                if (j + 1 < t->nstrokes) {
+                    const struct travel_point *d =
+                        stroke_start(t, &t->strokes[j + 1]);
+                    after += distance(c->x, c->y, d->x, d->y);
+                }
+
+                if (after < before - 1e-9) {
+                    reverse(t, i, j);
+                    improved = 1;
+                }
+            }
+        }
+    }
+}
+
+struct travel  *
+travel_new(void)
+{
+    struct travel  *t = calloc(1, sizeof(*t));
+    check_mem(t);
+    return t;
+
+error:
+    return NULL;
+}
+
+void
+travel_record(void *data, enum vm_pen_event event, int x, int y)
+{
+    struct travel  *t = data;
+    struct account  a = { t->before, t->pen_down, t->x, t->y };
+
+    account(&a, event, x, y);
+    t->before = a.stats;
+
+    if (t->forward != NULL) {
+        t->forward(t->forward_data, event, x, y);
+    }
+
+    switch (event) {
+    case vm_pen_up:
+        t->pen_down = 0;
+        break;
+
+    case vm_pen_down:
+        if (!t->pen_down) {
+            add_stroke(t);
+        }
+
+        t->pen_down = 1;
+        break;
+
+    case vm_pen_move:
+        // Moving to the same point draws nothing
+        if (t->pen_down && (x != t->x || y != t->y)) {
+            t->x = x;
+            t->y = y;
+            add_point(t, x, y);
+        }
+
+        t->x = x;
+        t->y = y;
+        break;
+    }
+}
+
+void
+travel_optimise(struct travel *t)
+{
+    nearest_neighbour(t);
+    two_opt(t);
+}
+
+void
+travel_replay(const struct travel *t,
+              void (*pen)(void *data, enum vm_pen_event event, int x, int y),
+              void *data)
+{
+    int             pen_down = 0;
+    int             x = 0,
+                    y = 0;
+
+    for (int i = 0; i < t->nstrokes; ++i) {
+        const struct travel_stroke *s = &t->strokes[i];
+        const struct travel_point *start = stroke_start(t, s);
+
+        if (!pen_down || start->x != x || start->y != y) {
+            if (pen_down) {
+                pen(data, vm_pen_up, x, y);
+            }
+
+            if (start->x != x || start->y != y) {
+                pen(data, vm_pen_move, start->x, start->y);
+            }
+
+            pen(data, vm_pen_down, start->x, start->y);
+            pen_down = 1;
+        }
+
+        for (int k = 1; k < s->count; ++k) {
+            const struct travel_point *p =
+                &t->points[s->reversed ? s->first + s->count - 1 - k :
+                           s->first + k];
+            pen(data, vm_pen_move, p->x, p->y);
+        }
+
+        x = stroke_end(t, s)->x;
+        y = stroke_end(t, s)->y;
+    }
+
+    if (pen_down) {
+        pen(data, vm_pen_up, x, y);
+    }
+}
+
+double
+travel_time(const struct travel_stats *stats)
+{
+    return stats->up_distance / TRAVEL_UP_SPEED +
+           stats->down_distance / TRAVEL_DOWN_SPEED +
+           stats->actuations * TRAVEL_ACTUATION;
+}
+
+void
+travel_report(const struct travel *t, FILE *out)
+{
+    struct account  after = { { 0, 0, 0, 0 }, 0, 0, 0 };
+
+    travel_replay(t, account, &after);
+    fprintf(out, "%-20s %12s %12s\n", "", "before", "after");
+    fprintf(out, "%-20s %12ld %12ld\n", "strokes", t->before.strokes,
+            after.stats.strokes);
+    fprintf(out, "%-20s %12ld %12ld\n", "pen up/down",
+            t->before.actuations, after.stats.actuations);
+    fprintf(out, "%-20s %12.1f %12.1f\n", "pen-up travel",
+            t->before.up_distance, after.stats.up_distance);
+    fprintf(out, "%-20s %12.1f %12.1f\n", "pen-down travel",
+            t->before.down_distance, after.stats.down_distance);
+    fprintf(out, "%-20s %12.2f %12.2f\n", "estimated time (s)",
+            travel_time(&t->before), travel_time(&after.stats));
+}
+
+void
+travel_free(struct travel *t)
+{
+    if (t == NULL) {
+        return;
+    }
+
+    free(t->points);
+    free(t->strokes);
+    free(t);
+}
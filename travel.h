@@ -0,0 +1,136 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Pen travel optimiser
+ *
+ * Collects the plot stream of a machine as strokes, i.e., the polylines drawn
+ * between a Down and the next Up, and replays them in an order that reduces
+ * the distance travelled with the pen up. Strokes may be drawn backwards, so
+ * the image is the same but the stream is not.
+ */
+
+#ifndef TRAVEL_H_
+#define TRAVEL_H_
+
+#include <stdio.h>
+
+#include "vm.h"
+
+/**
+ * Plotter model used by the estimates: speeds in units per second, and time
+ * to lift or lower the pen in seconds
+ */
+#define TRAVEL_UP_SPEED 400.0
+#define TRAVEL_DOWN_SPEED 200.0
+#define TRAVEL_ACTUATION 0.05
+
+struct travel_point {
+    int             x;
+    int             y;
+};
+
+struct travel_stroke {
+    // Index of the first point in travel.points
+    int             first;
+    int             count;
+    // Drawn from the last point to the first one
+    int             reversed;
+};
+
+/**
+ * What it takes to plot a stream
+ */
+struct travel_stats {
+    double          up_distance;
+    double          down_distance;
+    long            actuations;
+    long            strokes;
+};
+
+struct travel {
+    struct travel_point *points;
+    int             npoints;
+    int             points_capacity;
+    // In drawing order
+    struct travel_stroke *strokes;
+    int             nstrokes;
+    int             strokes_capacity;
+    // State of the pen while recording
+    int             pen_down;
+    int             x;
+    int             y;
+    // Statistics of the recorded stream
+    struct travel_stats before;
+    // Called with every recorded event, unless NULL
+    void          (*forward)(void *data, enum vm_pen_event event, int x,
+                             int y);
+    void           *forward_data;
+};
+
+/**
+ * @returns a new, empty recorder
+ */
+struct travel  *travel_new(void);
+
+/**
+ * Pen callback that records an event in the struct travel * in @data
+ */
+void            travel_record(void *data, enum vm_pen_event event, int x,
+                              int y);
+
+/**
+ * Reorders and reverses the strokes of @t with a nearest neighbour tour
+ * improved by 2-opt
+ */
+void            travel_optimise(struct travel *t);
+
+/**
+ * Plays the strokes of @t in their current order to @pen
+ *
+ * Consecutive strokes that meet are drawn without lifting the pen.
+ */
+void            travel_replay(const struct travel *t,
+                              void (*pen)(void *data, enum vm_pen_event event,
+                                          int x, int y), void *data);
+
+/**
+ * @returns the estimated plotting time of @stats, in seconds
+ */
+double          travel_time(const struct travel_stats *stats);
+
+/**
+ * Writes the statistics of the recorded stream and of the strokes of @t in
+ * their current order
+ */
+void            travel_report(const struct travel *t, FILE *out);
+
+/**
+ * Releases @t
+ */
+void            travel_free(struct travel *t);
+
+#endif /* end of include guard: TRAVEL_H_ */
@@ -0,0 +1,531 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "opt.h"
+
+/**
+ * Code growth allowed for unrolled loops, in percent of the size of the
+ * program, and at least UNROLL_MIN_BUDGET AST nodes. A loop is fully unrolled
+ * if the copies of its body take at most UNROLL_MAX_SIZE AST nodes, or else
+ * its body is copied up to UNROLL_MAX_FACTOR times.
+ */
+#define UNROLL_GROWTH 50
+#define UNROLL_MIN_BUDGET 256
+#define UNROLL_MAX_SIZE 256
+#define UNROLL_MAX_FACTOR 4
+
+/**
+ * A while loop that runs a known number of times: its variable starts at
+ * init, and the assignment update at the top level of its body adds step
+ */
+struct counted_loop {
+    struct s_symbol *var;
+    int             init;
+    int             step;
+    int             trips;
+    struct ast_stmt_list *update;
+    // The values of the variable can be dropped once propagated
+    int             keep_stores;
+};
+
+static int      _unroll_budget;
+
+/**
+ * The function being optimised, NULL in the main body
+ */
+static struct ast_fun_dec *_fun;
+
+/**
+ * @returns 1 if @list or the statements nested in it call a function
+ */
+static int      calls_in(struct ast_stmt_list *list);
+
+/**
+ * @returns 1 if a function of @prog may assign the global variable @var
+ */
+static int      written_by_calls(struct ast_program *prog,
+                                 struct s_symbol *var);
+
+/**
+ * @returns 1 and sets @value if the value of @var is a known constant just
+ * before the statement @at of @list. @top is set if @list is the body of
+ * the current function or of the program.
+ */
+static int      value_before(struct ast_program *prog,
+                             struct ast_stmt_list *list,
+                             struct ast_stmt_list *at, int top,
+                             struct s_symbol *var, int *value);
+
+/**
+ * @returns 1 and fills @loop if the while statement @at of @list runs a known
+ * number of times
+ */
+static int      match_counted_loop(struct ast_program *prog,
+                                   struct ast_stmt_list *list,
+                                   struct ast_stmt_list *at, int top,
+                                   struct counted_loop *loop);
+
+/**
+ * @returns a copy of the body of the loop @stmt for the iteration where the
+ * variable of @loop is @value, with the variable replaced by constants
+ */
+static struct ast_stmt_list *unroll_copy(struct ast_stmt *stmt,
+                                         struct counted_loop *loop,
+                                         int value, int last);
+
+/**
+ * Unrolls the counted loops in @list and the statements nested in it
+ */
+static void     unroll_loops(struct ast_program *prog,
+                             struct ast_stmt_list **list, int top);
+
+static int
+calls_in(struct ast_stmt_list *list)
+{
+    struct ast_exp_list *exps;
+
+    for (; list; list = list->tail) {
+        struct ast_stmt *stmt = list->head;
+
+        switch (stmt->kind) {
+        case ast_moveStmt:
+            if (ast_has_call(stmt->u.move.exp1) ||
+                    ast_has_call(stmt->u.move.exp2)) {
+                return 1;
+            }
+
+            break;
+
+        case ast_assignStmt:
+            if (ast_has_call(stmt->u.assign.exp)) {
+                return 1;
+            }
+
+            break;
+
+        case ast_iftStmt:
+            if (ast_has_call(stmt->u.ift.test) || calls_in(stmt->u.ift.then)) {
+                return 1;
+            }
+
+            break;
+
+        case ast_ifteStmt:
+            if (ast_has_call(stmt->u.ifte.test) ||
+                    calls_in(stmt->u.ifte.then) ||
+                    calls_in(stmt->u.ifte.elsee)) {
+                return 1;
+            }
+
+            break;
+
+        case ast_whileStmt:
+            if (ast_has_call(stmt->u.whilee.test) ||
+                    calls_in(stmt->u.whilee.body)) {
+                return 1;
+            }
+
+            break;
+
+        case ast_returnStmt:
+            if (ast_has_call(stmt->u.returnn.exp)) {
+                return 1;
+            }
+
+            break;
+
+        case ast_callStmt:
+            return 1;
+
+        case ast_exp_listStmt:
+            for (exps = stmt->u.seq; exps; exps = exps->tail) {
+                if (ast_has_call(exps->head)) {
+                    return 1;
+                }
+            }
+
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int
+written_by_calls(struct ast_program *prog, struct s_symbol *var)
+{
+    struct ast_fun_dec_list *p;
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        if (!opt_is_local(p->head, var) &&
+                opt_writes_var(p->head->body, var)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+value_before(struct ast_program *prog, struct ast_stmt_list *list,
+             struct ast_stmt_list *at, int top, struct s_symbol *var,
+             int *value)
+{
+    struct ast_var_dec_list *v;
+    struct ast_field_list *param;
+    struct ast_stmt_list *q;
+    int             known = 0;
+
+    if (top) {
+        if (_fun == NULL) {
+            v = prog->global_var_def_list;
+        } else {
+            for (param = _fun->params; param; param = param->tail) {
+                if (param->head->name == var) {
+                    return 0;
+                }
+            }
+
+            v = _fun->var;
+        }
+
+        // The last declaration wins, and semant.c rejects the others
+        for (; v; v = v->tail) {
+            if (v->head->sym == var) {
+                known = ast_const_value(v->head->init, value);
+            }
+        }
+    }
+
+    for (q = list; q != at; q = q->tail) {
+        struct ast_stmt_list *rest = q->tail;
+
+        if (q->head->kind == ast_assignStmt &&
+                q->head->u.assign.var == var) {
+            known = ast_const_value(q->head->u.assign.exp, value);
+            continue;
+        }
+
+        q->tail = NULL;
+
+        if (opt_writes_var(q, var)) {
+            known = 0;
+        }
+
+        q->tail = rest;
+    }
+
+    return known;
+}
+
+static int
+match_counted_loop(struct ast_program *prog, struct ast_stmt_list *list,
+                   struct ast_stmt_list *at, int top,
+                   struct counted_loop *loop)
+{
+    struct ast_exp *test = at->head->u.whilee.test;
+    struct ast_exp *left,
+                   *right;
+    struct ast_stmt_list *q;
+    struct ast_exp *exp;
+    int             limit,
+                    value;
+    int             below;
+
+    if (test->kind != ast_opExp || test->u.op.oper != ast_LT) {
+        return 0;
+    }
+
+    left = test->u.op.left;
+    right = test->u.op.right;
+
+    // i < limit, or limit < i
+    if (left->kind == ast_varExp && ast_const_value(right, &limit)) {
+        loop->var = left->u.var;
+        below = 1;
+    } else if (right->kind == ast_varExp && ast_const_value(left, &limit)) {
+        loop->var = right->u.var;
+        below = 0;
+    } else {
+        return 0;
+    }
+
+    loop->update = NULL;
+
+    for (q = at->head->u.whilee.body; q; q = q->tail) {
+        struct ast_stmt_list *rest = q->tail;
+        int             writes;
+
+        if (loop->update == NULL && q->head->kind == ast_assignStmt &&
+                q->head->u.assign.var == loop->var) {
+            loop->update = q;
+            continue;
+        }
+
+        q->tail = NULL;
+        writes = opt_writes_var(q, loop->var);
+        q->tail = rest;
+
+        if (writes) {
+            return 0;
+        }
+    }
+
+    if (loop->update == NULL) {
+        return 0;
+    }
+
+    // i = i + step, i = step + i or i = i - step
+    exp = loop->update->head->u.assign.exp;
+
+    if (exp->kind != ast_opExp) {
+        return 0;
+    }
+
+    left = exp->u.op.left;
+    right = exp->u.op.right;
+
+    if (exp->u.op.oper == ast_plusOp && right->kind == ast_varExp &&
+            right->u.var == loop->var) {
+        right = left;
+        left = exp->u.op.right;
+    }
+
+    if ((exp->u.op.oper != ast_plusOp && exp->u.op.oper != ast_minusOp) ||
+            left->kind != ast_varExp || left->u.var != loop->var ||
+            !ast_const_value(right, &loop->step)) {
+        return 0;
+    }
+
+    if (exp->u.op.oper == ast_minusOp) {
+        loop->step = (int16_t) -loop->step;
+    }
+
+    if (!opt_is_local(_fun, loop->var) &&
+            written_by_calls(prog, loop->var)) {
+        return 0;
+    }
+
+    if (!value_before(prog, list, at, top, loop->var, &loop->init)) {
+        return 0;
+    }
+
+    // Like the machine, compare by subtracting on 16 bits. The variable takes
+    // at most 0x10000 values before it comes back to its first value.
+    value = loop->init;
+
+    for (loop->trips = 0; loop->trips <= 0x10000; ++loop->trips) {
+        if (!(below ? (int16_t) (value - limit) < 0 :
+              (int16_t) (limit - value) < 0)) {
+            break;
+        }
+
+        value = (int16_t) (value + loop->step);
+    }
+
+    // A function may read a global variable at any time
+    loop->keep_stores = !opt_is_local(_fun, loop->var) &&
+            calls_in(at->head->u.whilee.body);
+    return loop->trips <= 0x10000;
+}
+
+static struct ast_stmt_list *
+unroll_copy(struct ast_stmt *stmt, struct counted_loop *loop, int value,
+            int last)
+{
+    struct ast_stmt_list *copy = ast_copy_stmt_list(stmt->u.whilee.body);
+    struct ast_stmt_list **p = &copy;
+    struct ast_stmt_list *orig = stmt->u.whilee.body;
+
+    for (; orig; orig = orig->tail) {
+        struct ast_stmt_list *q = *p;
+        struct ast_stmt_list *rest = q->tail;
+
+        if (orig != loop->update) {
+            q->tail = NULL;
+            opt_subst_stmt_list(q, loop->var, value);
+            q->tail = rest;
+            p = &q->tail;
+            continue;
+        }
+
+        value = (int16_t) (value + loop->step);
+
+        if (last || loop->keep_stores) {
+            ast_free_exp(q->head->u.assign.exp);
+            q->head->u.assign.exp = ast_int_exp(q->head->pos, value);
+            p = &q->tail;
+        } else {
+            *p = rest;
+            q->tail = NULL;
+            ast_free_stmt_list(q);
+        }
+    }
+
+    return copy;
+}
+
+static void
+unroll_loops(struct ast_program *prog, struct ast_stmt_list **list, int top)
+{
+    struct ast_stmt_list **p;
+    struct counted_loop loop;
+
+    for (p = list; *p != NULL;) {
+        struct ast_stmt_list *node = *p;
+        struct ast_stmt *stmt = node->head;
+        struct ast_stmt_list *copies = NULL;
+        struct ast_stmt_list **tail = &copies;
+        int             size,
+                        factor,
+                        peeled,
+                        value,
+                        i;
+
+        switch (stmt->kind) {
+        case ast_iftStmt:
+            unroll_loops(prog, &stmt->u.ift.then, 0);
+            break;
+
+        case ast_ifteStmt:
+            unroll_loops(prog, &stmt->u.ifte.then, 0);
+            unroll_loops(prog, &stmt->u.ifte.elsee, 0);
+            break;
+
+        case ast_whileStmt:
+            unroll_loops(prog, &stmt->u.whilee.body, 0);
+            break;
+
+        default:
+            break;
+        }
+
+        if (stmt->kind != ast_whileStmt ||
+                !match_counted_loop(prog, *list, node, top, &loop)) {
+            p = &node->tail;
+            continue;
+        }
+
+        size = opt_stmt_list_size(stmt->u.whilee.body);
+
+        if (loop.trips * size <= UNROLL_MAX_SIZE &&
+                loop.trips * size <= _unroll_budget + size) {
+            factor = 0;
+            peeled = loop.trips;
+        } else {
+            factor = UNROLL_MAX_FACTOR;
+
+            while (factor > 1 && (factor * size > UNROLL_MAX_SIZE ||
+                                  (factor - 1) * size > _unroll_budget)) {
+                --factor;
+            }
+
+            peeled = loop.trips % factor;
+
+            if (factor == 1 || (factor + peeled - 1) * size > _unroll_budget) {
+                p = &node->tail;
+                continue;
+            }
+        }
+
+        value = loop.init;
+
+        for (i = 0; i < peeled; ++i) {
+            *tail = unroll_copy(stmt, &loop, value, i == peeled - 1);
+
+            while (*tail != NULL) {
+                tail = &(*tail)->tail;
+            }
+
+            value = (int16_t) (value + loop.step);
+        }
+
+        if (factor == 0) {
+            if (peeled > 1) {
+                _unroll_budget -= (peeled - 1) * size;
+            }
+
+            *tail = node->tail;
+            *p = copies;
+            node->tail = NULL;
+            ast_free_stmt_list(node);
+            p = tail;
+            continue;
+        }
+
+        // The remaining iterations are a multiple of factor, so the test can
+        // be skipped between the copies
+        _unroll_budget -= (factor + peeled - 1) * size;
+
+        if (factor > 1) {
+            struct ast_stmt_list *body = ast_copy_stmt_list(
+                    stmt->u.whilee.body);
+            struct ast_stmt_list *last = stmt->u.whilee.body;
+
+            // Appends factor - 1 copies of the body as it was, not as it grows
+            for (i = 1; i < factor; ++i) {
+                while (last->tail != NULL) {
+                    last = last->tail;
+                }
+
+                last->tail = i < factor - 1 ? ast_copy_stmt_list(body) : body;
+            }
+        }
+
+        *tail = node;
+        *p = copies;
+        p = &node->tail;
+    }
+}
+
+void
+opt_unroll(struct ast_program *prog)
+{
+    struct ast_fun_dec_list *p;
+    int             size = opt_stmt_list_size(prog->body);
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        size += opt_stmt_list_size(p->head->body);
+    }
+
+    _unroll_budget = size * UNROLL_GROWTH / 100;
+
+    if (_unroll_budget < UNROLL_MIN_BUDGET) {
+        _unroll_budget = UNROLL_MIN_BUDGET;
+    }
+
+    for (p = prog->func_def_list; p; p = p->tail) {
+        _fun = p->head;
+        unroll_loops(prog, &p->head->body, 1);
+    }
+
+    _fun = NULL;
+    unroll_loops(prog, &prog->body, 1);
+}
@@ -0,0 +1,263 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vector.h"
+
+/**
+ * Width of the SVG viewBox attribute, which is filled in at the end if the
+ * file is seekable
+ */
+#define VIEW_BOX_WIDTH 48
+
+static void
+flush(struct vector *v)
+{
+    fwrite(v->buf, 1, v->used, v->f);
+    v->offset += v->used;
+    v->used = 0;
+}
+
+static void
+put(struct vector *v, const char *fmt, ...)
+{
+    va_list         ap;
+    int             n;
+
+    if (VECTOR_BUFFER - v->used < VECTOR_LINE) {
+        flush(v);
+    }
+
+    va_start(ap, fmt);
+    n = vsnprintf(v->buf + v->used, VECTOR_LINE, fmt, ap);
+    va_end(ap);
+    v->used += n < VECTOR_LINE ? n : VECTOR_LINE - 1;
+}
+
+static void
+extend_box(struct vector *v, int x, int y)
+{
+    if (v->empty) {
+        v->min_x = v->max_x = x;
+        v->min_y = v->max_y = y;
+        v->empty = 0;
+        return;
+    }
+
+    v->min_x = x < v->min_x ? x : v->min_x;
+    v->min_y = y < v->min_y ? y : v->min_y;
+    v->max_x = x > v->max_x ? x : v->max_x;
+    v->max_y = y > v->max_y ? y : v->max_y;
+}
+
+static void
+line_to(struct vector *v, int x, int y)
+{
+    put(v, v->svg ? "L%d %d\n" : "%d %d l\n", x, y);
+    extend_box(v, x, y);
+    ++v->commands;
+}
+
+/**
+ * Writes the end of the current subpath: the pending segment, or a dot if
+ * nothing was drawn
+ */
+static void
+end_subpath(struct vector *v)
+{
+    if (v->open && (v->dx != 0 || v->dy != 0 || !v->drawn)) {
+        line_to(v, v->end_x, v->end_y);
+    }
+
+    v->open = 0;
+}
+
+/**
+ * Lowers the pen: continues the current subpath if it ends there, or starts
+ * a new one, in a new path if the current one is long
+ */
+static void
+pen_down(struct vector *v)
+{
+    if (v->open && v->end_x == v->x && v->end_y == v->y) {
+        return;
+    }
+
+    end_subpath(v);
+
+    if (v->commands >= VECTOR_PATH_MAX) {
+        put(v, v->svg ? "\"/>\n" : "stroke\n");
+        v->commands = 0;
+    }
+
+    if (v->commands == 0) {
+        put(v, v->svg ? "<path d=\"" : "newpath\n");
+    }
+
+    put(v, v->svg ? "M%d %d\n" : "%d %d m\n", v->x, v->y);
+    extend_box(v, v->x, v->y);
+    ++v->commands;
+    v->open = 1;
+    v->end_x = v->x;
+    v->end_y = v->y;
+    v->drawn = 0;
+    v->dx = 0;
+    v->dy = 0;
+}
+
+struct vector  *
+vector_open(const char *path)
+{
+    size_t          len = strlen(path);
+    struct vector  *v = calloc(1, sizeof(*v));
+    check_mem(v);
+    v->f = fopen(path, "w");
+    check(v->f, "Cannot open the file %s for writing", path);
+    v->svg = len > 4 && strcmp(path + len - 4, ".svg") == 0;
+    v->empty = 1;
+
+    if (v->svg) {
+        put(v, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"");
+        v->view_box = v->offset + v->used;
+        put(v, "%-*s", VIEW_BOX_WIDTH, "-32768 -32768 65536 65536");
+        put(v, "\">\n<g transform=\"scale(1 -1)\" fill=\"none\" "
+            "stroke=\"black\" stroke-width=\"1\"\n");
+        put(v, "   stroke-linecap=\"round\" stroke-linejoin=\"round\">\n");
+    } else {
+        put(v, "%%!PS-Adobe-3.0 EPSF-3.0\n%%%%BoundingBox: (atend)\n"
+            "%%%%Creator: pdplot\n%%%%EndComments\n");
+        put(v, "/m { moveto } bind def\n/l { lineto } bind def\n"
+            "1 setlinewidth 1 setlinecap 1 setlinejoin\n");
+    }
+
+    return v;
+
+error:
+    free(v);
+    return NULL;
+}
+
+void
+vector_record(void *data, enum vm_pen_event event, int x, int y)
+{
+    struct vector  *v = data;
+    int             dx = x - v->x,
+                    dy = y - v->y;
+
+    if (v->forward != NULL) {
+        v->forward(v->forward_data, event, x, y);
+    }
+
+    switch (event) {
+    case vm_pen_up:
+        v->pen_down = 0;
+        break;
+
+    case vm_pen_down:
+        if (!v->pen_down) {
+            pen_down(v);
+        }
+
+        v->pen_down = 1;
+        break;
+
+    case vm_pen_move:
+        if (!v->pen_down || (dx == 0 && dy == 0)) {
+            v->x = x;
+            v->y = y;
+            break;
+        }
+
+        // Same direction as the pending segment: extend it
+        if ((long long) dx * v->dy != (long long) dy * v->dx ||
+                (long long) dx * v->dx + (long long) dy * v->dy <= 0) {
+            if (v->dx != 0 || v->dy != 0) {
+                line_to(v, v->x, v->y);
+            }
+
+            v->dx = dx;
+            v->dy = dy;
+        }
+
+        v->x = v->end_x = x;
+        v->y = v->end_y = y;
+        v->drawn = 1;
+        break;
+    }
+}
+
+int
+vector_close(struct vector *v)
+{
+    int             ret = 0;
+
+    end_subpath(v);
+
+    if (v->svg) {
+        if (v->commands > 0) {
+            put(v, "\"/>\n");
+        }
+
+        put(v, "</g>\n</svg>\n");
+    } else {
+        if (v->commands > 0) {
+            put(v, "stroke\n");
+        }
+
+        put(v, "showpage\n%%%%Trailer\n");
+
+        if (v->empty) {
+            put(v, "%%%%BoundingBox: 0 0 0 0\n");
+        } else {
+            put(v, "%%%%BoundingBox: %d %d %d %d\n", v->min_x - 1,
+                v->min_y - 1, v->max_x + 1, v->max_y + 1);
+        }
+
+        put(v, "%%%%EOF\n");
+    }
+
+    flush(v);
+
+    // The y axis is flipped, and the box has room for the line width
+    if (v->svg && !v->empty && fseek(v->f, v->view_box, SEEK_SET) == 0) {
+        fprintf(v->f, "%-*.*s", VIEW_BOX_WIDTH, VIEW_BOX_WIDTH, "");
+        fseek(v->f, v->view_box, SEEK_SET);
+        fprintf(v->f, "%d %d %d %d", v->min_x - 1, -v->max_y - 1,
+                v->max_x - v->min_x + 2, v->max_y - v->min_y + 2);
+    }
+
+    if (ferror(v->f)) {
+        ret = -1;
+    }
+
+    fclose(v->f);
+    free(v);
+    return ret;
+}
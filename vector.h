@@ -0,0 +1,111 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Vector output for plot streams: Encapsulated PostScript or SVG
+ *
+ * The file is written while the machine runs, through a fixed-size buffer.
+ * Consecutive collinear segments are merged, moves that draw nothing are
+ * dropped and the pen-down runs become subpaths of a few long paths.
+ */
+
+#ifndef VECTOR_H_
+#define VECTOR_H_
+
+#include <stdio.h>
+
+#include "vm.h"
+
+#define VECTOR_BUFFER 8192
+
+/**
+ * Longest single write to the buffer
+ */
+#define VECTOR_LINE 128
+
+/**
+ * A path is ended at the next subpath after that many commands, as some
+ * PostScript interpreters limit the size of paths
+ */
+#define VECTOR_PATH_MAX 1000
+
+struct vector {
+    FILE           *f;
+    int             svg;
+    char            buf[VECTOR_BUFFER];
+    int             used;
+    // Bytes written to f so far, and offset of the SVG viewBox
+    long            offset;
+    long            view_box;
+    // State of the pen
+    int             pen_down;
+    int             x;
+    int             y;
+    // Commands in the current path, 0 if there is none
+    int             commands;
+    // Set while a subpath may be continued, i.e., until the pen goes down
+    // somewhere else. It ends at (end_x, end_y).
+    int             open;
+    int             end_x;
+    int             end_y;
+    // Set once the current subpath draws something
+    int             drawn;
+    // Direction of the segment that ends the subpath and is not written yet,
+    // (0, 0) if none
+    int             dx;
+    int             dy;
+    // Bounding box of the drawing
+    int             empty;
+    int             min_x;
+    int             min_y;
+    int             max_x;
+    int             max_y;
+    // Called with every recorded event, unless NULL
+    void          (*forward)(void *data, enum vm_pen_event event, int x,
+                             int y);
+    void           *forward_data;
+};
+
+/**
+ * @returns a writer to @path, in SVG if @path ends with `.svg' and in
+ * PostScript otherwise, or NULL if the file cannot be opened
+ */
+struct vector  *vector_open(const char *path);
+
+/**
+ * Pen callback that writes an event to the struct vector * in @data
+ */
+void            vector_record(void *data, enum vm_pen_event event, int x,
+                              int y);
+
+/**
+ * Finishes the file of @v and releases @v
+ *
+ * @returns 0 on success, -1 if the file could not be written
+ */
+int             vector_close(struct vector *v);
+
+#endif /* end of include guard: VECTOR_H_ */
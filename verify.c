@@ -0,0 +1,365 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include "verify.h"
+
+struct function {
+    int             entry;
+    // The program itself, run with FP = GP = 0
+    int             top;
+    // Most words below its frame it reaches, i.e., that its callers must
+    // have pushed before the Jsr
+    int             args;
+};
+
+struct call {
+    int             caller;
+    int             callee;
+    // Of the caller, at the Jsr
+    int             height;
+};
+
+struct verifier {
+    const struct vm_image *image;
+    // 1 where an instruction starts
+    uint8_t         start[VM_CODE_SIZE];
+    // 1 + index of the function an instruction was last reached from, and
+    // the least height of the stack there so far
+    int             owner[VM_CODE_SIZE];
+    int             height[VM_CODE_SIZE];
+    // 1 while in work
+    uint8_t         queued[VM_CODE_SIZE];
+    // Index of the function entered at an address with Jsr, -1 if none
+    int             function_at[VM_CODE_SIZE];
+    // Instructions left to check
+    int             work[VM_CODE_SIZE];
+    int             nwork;
+    struct function *functions;
+    int             nfunctions;
+    int             functions_capacity;
+    struct call    *calls;
+    int             ncalls;
+    int             calls_capacity;
+    // Highest global written by a function
+    int             globals;
+};
+
+/**
+ * @returns the index of the new function entered at @entry, -1 if out of
+ * memory
+ */
+static int
+add_function(struct verifier *v, int entry, int top)
+{
+    struct function *f;
+
+    if (v->nfunctions == v->functions_capacity) {
+        v->functions_capacity = v->functions_capacity ?
+            2 * v->functions_capacity : 16;
+        f = realloc(v->functions,
+                    v->functions_capacity * sizeof(*v->functions));
+        check_mem(f);
+        v->functions = f;
+    }
+
+    f = &v->functions[v->nfunctions];
+    f->entry = entry;
+    f->top = top;
+    f->args = 0;
+    return v->nfunctions++;
+
+error:
+    return -1;
+}
+
+static int
+add_call(struct verifier *v, int caller, int callee, int height)
+{
+    struct call    *c;
+
+    if (v->ncalls == v->calls_capacity) {
+        v->calls_capacity = v->calls_capacity ? 2 * v->calls_capacity : 64;
+        c = realloc(v->calls, v->calls_capacity * sizeof(*v->calls));
+        check_mem(c);
+        v->calls = c;
+    }
+
+    c = &v->calls[v->ncalls++];
+    c->caller = caller;
+    c->callee = callee;
+    c->height = height;
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * Queues the instruction at @pc, reached with at least @height words in the
+ * frame of the function @f, unless it is known to have no more already
+ */
+static int
+reach(struct verifier *v, int f, int pc, int height)
+{
+    check_debug(pc < v->image->size && v->start[pc],
+                "%d is not an instruction", pc);
+
+    if (v->owner[pc] == f + 1 && v->height[pc] <= height) {
+        return 0;
+    }
+
+    v->owner[pc] = f + 1;
+    v->height[pc] = height;
+
+    if (!v->queued[pc]) {
+        v->queued[pc] = 1;
+        v->work[v->nwork++] = pc;
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * Checks that the function @f may access the word at @offset from FP, or
+ * from GP if not @local, and write to it if @write
+ */
+static int
+address(struct verifier *v, int f, int local, int offset, int write)
+{
+    struct function *fn = &v->functions[f];
+
+    if (fn->top || !local) {
+        check_debug(offset > 0, "Bad global %d", offset);
+
+        if (!fn->top && write && offset > v->globals) {
+            v->globals = offset;
+        }
+    } else if (offset > 0) {
+        // Within the frame
+    } else if (offset <= -2) {
+        if (-offset - 1 > fn->args) {
+            fn->args = -offset - 1;
+        }
+    } else {
+        // The old FP and return address
+        check_debug(!write, "Write to the frame of %d", fn->entry);
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+static int
+check_function(struct verifier *v, int f)
+{
+    const uint16_t *code = v->image->code;
+    int             entry = v->functions[f].entry;
+
+    v->nwork = 0;
+    check_debug(reach(v, f, entry, 0) == 0, "Bad entry %d", entry);
+
+    while (v->nwork > 0) {
+        int             pc = v->work[--v->nwork];
+        int             height = v->height[pc];
+        uint16_t        w = code[pc];
+        int             opcode = (w >> 8) & 0x7E;
+        int             local = w & 0x100;
+        int             offset = (int8_t) (w & 0xFF);
+        int             two = vm_is_two_words(opcode);
+        int             operand = two ? code[pc + 1] : 0;
+        int             pops = 0,
+                        pushes = 0,
+                        falls = 1,
+                        target = -1,
+                        callee;
+
+        v->queued[pc] = 0;
+
+        switch (opcode) {
+        case VM_Halt:
+            falls = 0;
+            break;
+
+        case VM_Read:
+            check_debug(address(v, f, local, offset, 1) == 0, "At %d", pc);
+            break;
+
+        case VM_Store:
+            check_debug(address(v, f, local, offset, 1) == 0, "At %d", pc);
+            pops = 1;
+            break;
+
+        case VM_Load:
+            check_debug(address(v, f, local, offset, 0) == 0, "At %d", pc);
+            pushes = 1;
+            break;
+
+        case VM_Move:
+            pops = 2;
+            break;
+
+        case VM_Add:
+        case VM_Sub:
+        case VM_Mul:
+            pops = 2;
+            pushes = 1;
+            break;
+
+        case VM_Test:
+        case VM_Neg:
+            pops = 1;
+            pushes = 1;
+            break;
+
+        case VM_Loadi:
+            pushes = 1;
+            break;
+
+        case VM_Pop:
+            pops = operand;
+            break;
+
+        case VM_Jsr:
+            check_debug(operand < v->image->size && v->start[operand],
+                        "Call to %d at %d", operand, pc);
+            callee = v->function_at[operand];
+
+            if (callee < 0) {
+                callee = add_function(v, operand, 0);
+                check(callee >= 0, "Cannot add the function %d", operand);
+                v->function_at[operand] = callee;
+            }
+
+            check(add_call(v, f, callee, height) == 0, "Cannot add a call");
+            break;
+
+        case VM_Rts:
+            check_debug(!v->functions[f].top, "Rts out of a function at %d",
+                        pc);
+            falls = 0;
+            break;
+
+        case VM_Jump:
+            target = operand;
+            falls = 0;
+            break;
+
+        case VM_Jeq:
+        case VM_Jlt:
+            target = operand;
+            break;
+
+        default:
+            // Up and Down
+            break;
+        }
+
+        check_debug(height >= pops, "Stack underflow at %d", pc);
+        height += pushes - pops;
+
+        if (target >= 0) {
+            check_debug(reach(v, f, target, height) == 0, "From %d", pc);
+        }
+
+        if (falls) {
+            check_debug(reach(v, f, pc + 1 + two, height) == 0, "From %d",
+                        pc);
+        }
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+int
+verify_image(const struct vm_image *image)
+{
+    struct verifier *v = calloc(1, sizeof(*v));
+    int             lowest = INT_MAX;
+    int             ret = -1;
+
+    check_mem(v);
+    v->image = image;
+
+    // Decodes as the disassembler does
+    for (int pc = 0; pc < image->size;) {
+        int             opcode = (image->code[pc] >> 8) & 0x7E;
+
+        check_debug(vm_opcode_name(opcode) != NULL,
+                    "%d is not an instruction (at %d)", image->code[pc], pc);
+        check_debug(!vm_is_two_words(opcode) || pc + 1 < image->size,
+                    "Missing operand at %d", pc);
+        v->start[pc] = 1;
+        pc += 1 + vm_is_two_words(opcode);
+    }
+
+    for (int pc = 0; pc < VM_CODE_SIZE; ++pc) {
+        v->function_at[pc] = -1;
+    }
+
+    check(add_function(v, 0, 1) == 0, "Cannot add the program");
+
+    // Calls add the functions they enter
+    for (int f = 0; f < v->nfunctions; ++f) {
+        check_debug(check_function(v, f) == 0, "In the function at %d",
+                    v->functions[f].entry);
+    }
+
+    for (int i = 0; i < v->ncalls; ++i) {
+        const struct call *c = &v->calls[i];
+
+        check_debug(v->functions[c->callee].args <= c->height,
+                    "Too few arguments for %d",
+                    v->functions[c->callee].entry);
+
+        if (v->functions[c->caller].top && c->height < lowest) {
+            lowest = c->height;
+        }
+    }
+
+    // Functions only run while the program waits at one of its calls
+    check_debug(v->globals <= lowest, "Write to global %d", v->globals);
+    ret = 0;
+
+error:
+    if (v != NULL) {
+        free(v->functions);
+        free(v->calls);
+        free(v);
+    }
+
+    return ret;
+}
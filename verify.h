@@ -0,0 +1,63 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Load-time verifier
+ *
+ * Proves that an image cannot make the machine do anything illegal, other
+ * than running out of input or out of stack, so that it can run without the
+ * checks of vm_run(). The image must decode from its first word to its
+ * last, as the disassembler would, and then, following the code from
+ * address 0 and from each target of a Jsr:
+ *
+ *  - every jump lands on an instruction and no path runs off the image;
+ *  - each function, and the program itself, never pops below its frame,
+ *    going by the least height of the stack at each instruction;
+ *  - the program has no Rts, and only addresses its own words;
+ *  - a function never writes the return address or FP of its frame, and
+ *    only reaches below it into the words its callers have pushed;
+ *  - a function only writes the globals pushed before the program calls
+ *    it.
+ *
+ * As Rts puts SP back at FP - 2, a call leaves the height of its caller as
+ * it was, so each function is checked on its own. The stack may still grow
+ * without end, e.g., by recursion, or by a loop that leaves the result of a
+ * call on it. vm_run() goes back to its checks before the stack is full,
+ * and since every access is next to SP, or within 128 words of FP or GP,
+ * the guard page of vm_new() catches whatever gets past that.
+ */
+
+#ifndef VERIFY_H_
+#define VERIFY_H_
+
+#include "vm.h"
+
+/**
+ * @returns 0 if @image is safe to run unchecked, -1 otherwise
+ */
+int             verify_image(const struct vm_image *image);
+
+#endif /* end of include guard: VERIFY_H_ */
@@ -0,0 +1,839 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "vm.h"
+#include "profile.h"
+#include "trace.h"
+#include "verify.h"
+
+/**
+ * Bytes mapped for a machine by vm_new(), without its guard page
+ */
+#define MAPPED_SIZE ((sizeof(struct vm) + VM_GUARD_SIZE - 1) / \
+                     VM_GUARD_SIZE * VM_GUARD_SIZE)
+
+/**
+ * The machine running unchecked on this thread, if any, and where to go back
+ * to once it faults in its guard page
+ */
+static __thread struct vm *unchecked;
+static __thread sigjmp_buf overflow;
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+
+struct vm_image *
+vm_load_image(const char *path)
+{
+    struct vm_image *image = NULL;
+    FILE           *f = fopen(path, "r");
+    long            w;
+    check(f, "Cannot open the file %s", path);
+    image = calloc(1, sizeof(*image));
+    check_mem(image);
+
+    while (fscanf(f, "%ld", &w) == 1) {
+        check(image->size < VM_CODE_SIZE, "%s is too large", path);
+        check(w >= -0x8000 && w <= 0xFFFF, "%ld is not a word", w);
+        image->code[image->size++] = (uint16_t) w;
+    }
+
+    check(feof(f), "%s is not a binary image", path);
+    fclose(f);
+    image->verified = verify_image(image) == 0;
+    return image;
+
+error:
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    free(image);
+    return NULL;
+}
+
+static void
+on_fault(int sig, siginfo_t *info, void *context)
+{
+    const char     *addr = info->si_addr;
+    const char     *guard;
+
+    (void) context;
+
+    if (unchecked != NULL) {
+        guard = (const char *) (unchecked->stack + VM_STACK_SIZE);
+
+        if (addr >= guard && addr < guard + VM_GUARD_SIZE) {
+            siglongjmp(overflow, 1);
+        }
+    }
+
+    // Not ours: faults again once returned, and dies of it
+    signal(sig, SIG_DFL);
+}
+
+static void
+install_handler(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_fault;
+    // Left with siglongjmp(), which would leave SIGSEGV blocked otherwise
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+}
+
+struct vm      *
+vm_new(void)
+{
+    char           *base = mmap(NULL, MAPPED_SIZE + VM_GUARD_SIZE,
+                                PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    struct vm      *vm;
+
+    check(base != MAP_FAILED, "Cannot map a machine");
+    check(mprotect(base + MAPPED_SIZE, VM_GUARD_SIZE, PROT_NONE) == 0,
+          "Cannot map the guard page of a machine");
+    // The stack is last, so it ends where the guard page starts
+    vm = (struct vm *) (base + MAPPED_SIZE - sizeof(*vm));
+    vm->guarded = 1;
+    pthread_once(&handler_once, install_handler);
+    return vm;
+
+error:
+    if (base != MAP_FAILED) {
+        munmap(base, MAPPED_SIZE + VM_GUARD_SIZE);
+    }
+
+    return NULL;
+}
+
+void
+vm_free(struct vm *vm)
+{
+    if (vm != NULL) {
+        munmap((char *) (vm + 1) - MAPPED_SIZE, MAPPED_SIZE + VM_GUARD_SIZE);
+    }
+}
+
+const char     *
+vm_opcode_name(int opcode)
+{
+    switch (opcode) {
+    case VM_Halt:
+        return "Halt";
+
+    case VM_Read:
+        return "Read";
+
+    case VM_Store:
+        return "Store";
+
+    case VM_Load:
+        return "Load";
+
+    case VM_Up:
+        return "Up";
+
+    case VM_Down:
+        return "Down";
+
+    case VM_Move:
+        return "Move";
+
+    case VM_Add:
+        return "Add";
+
+    case VM_Sub:
+        return "Sub";
+
+    case VM_Mul:
+        return "Mul";
+
+    case VM_Test:
+        return "Test";
+
+    case VM_Neg:
+        return "Neg";
+
+    case VM_Rts:
+        return "Rts";
+
+    case VM_Loadi:
+        return "Loadi";
+
+    case VM_Pop:
+        return "Pop";
+
+    case VM_Jsr:
+        return "Jsr";
+
+    case VM_Jump:
+        return "Jump";
+
+    case VM_Jeq:
+        return "Jeq";
+
+    case VM_Jlt:
+        return "Jlt";
+    }
+
+    return NULL;
+}
+
+int
+vm_is_two_words(int opcode)
+{
+    switch (opcode) {
+    case VM_Loadi:
+    case VM_Pop:
+    case VM_Jsr:
+    case VM_Jump:
+    case VM_Jeq:
+    case VM_Jlt:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+void
+vm_reset(struct vm *vm, const struct vm_image *image)
+{
+    vm->image = image;
+    vm->pc = 0;
+    vm->sp = 0;
+    vm->fp = 0;
+    vm->gp = 0;
+    vm->zero = 0;
+    vm->negative = 0;
+    vm->pen_down = 0;
+    vm->pen_x = 0;
+    vm->pen_y = 0;
+    vm->steps = 0;
+    vm->input_used = 0;
+    vm->reached = 1;
+}
+
+void
+vm_write_pen(void *data, enum vm_pen_event event, int x, int y)
+{
+    FILE           *out = data;
+
+    switch (event) {
+    case vm_pen_up:
+        fprintf(out, "Up\n");
+        break;
+
+    case vm_pen_down:
+        fprintf(out, "Down\n");
+        break;
+
+    case vm_pen_move:
+        fprintf(out, "Move %d %d\n", x, y);
+        break;
+    }
+}
+
+/**
+ * The following macros are only used by run_checked(). They jump to `error'
+ * if the machine is about to do something illegal.
+ */
+#define PUSH(v) do { \
+                    check(vm->sp + 1 < VM_STACK_SIZE, \
+                          "Stack overflow at %d", pc); \
+                    vm->stack[++vm->sp] = (int16_t) (v); \
+                } while (0)
+
+#define POP(v)  do { \
+                    check(vm->sp > 0, "Stack underflow at %d", pc); \
+                    (v) = vm->stack[vm->sp--]; \
+                } while (0)
+
+#define ADDR(base, offset, a) do { \
+                                  (a) = (base) + (offset); \
+                                  check((a) > 0 && (a) < VM_STACK_SIZE, \
+                                        "Bad address %d at %d", (a), pc); \
+                              } while (0)
+
+/**
+ * Puts the registers of run_unchecked() back in @vm
+ */
+#define SYNC(vm) do { \
+                     (vm)->pc = pc; \
+                     (vm)->sp = sp; \
+                     (vm)->fp = fp; \
+                     (vm)->zero = zero; \
+                     (vm)->negative = negative; \
+                     (vm)->steps = steps; \
+                 } while (0)
+
+/**
+ * At a Jsr, Rts or jump taken, i.e., wherever the pc may go back, stops
+ * before it can run past the step limit, or push past the end of the stack.
+ * Between two of them, the pc only goes forward, so that no more than the
+ * size of the image steps are run, each pushing a word at most, but for the
+ * two of a Jsr.
+ */
+#define CHECK_LIMIT() do { \
+                          if (steps >= stop || sp > high) { \
+                              status = vm_running; \
+                              goto out; \
+                          } \
+                      } while (0)
+
+/**
+ * Cuts the trace block if full, with @vm at the next step
+ */
+#define TRACE_JUMP(vm) do { \
+                           if (tracing && trace_full(t)) { \
+                               SYNC(vm); \
+                               trace_cut(t, (vm)); \
+                           } \
+                       } while (0)
+
+/**
+ * vm_run() for a verified image from a state it reached, without the checks
+ * the verifier has done once for all. It records the trace if @tracing.
+ *
+ * It stops once within the size of the image of the step limit, or of the
+ * end of the stack, so that run_checked() runs the last steps and stops
+ * right at the limit, or at the instruction that overflows.
+ */
+static inline __attribute__ ((always_inline)) enum vm_status
+run_unchecked(struct vm *vm, const int tracing)
+{
+    const uint16_t *code = vm->image->code;
+    int16_t        *stack = vm->stack;
+    struct trace   *t = vm->trace;
+    // Where the guard page handler finds the last Jsr
+    volatile struct vm *last = vm;
+    int             pc = vm->pc;
+    int             sp = vm->sp;
+    int             fp = vm->fp;
+    int             zero = vm->zero;
+    int             negative = vm->negative;
+    long long       steps = vm->steps;
+    long long       stop = vm->step_limit ?
+                           vm->step_limit - vm->image->size : LLONG_MAX;
+    // Highest SP from which the stack cannot overflow before the next check
+    int             high = VM_STACK_SIZE - 3 - vm->image->size;
+    enum vm_status  status = vm_error;
+    int             a;
+
+    CHECK_LIMIT();
+
+    for (;;) {
+        uint16_t        w = code[pc];
+        int             opcode = (w >> 8) & 0x7E;
+        int             addr = ((w & 0x100) ? fp : 0) + (int8_t) (w & 0xFF);
+
+        ++steps;
+
+        switch (opcode) {
+        case VM_Halt:
+            status = vm_halted;
+            goto out;
+
+        case VM_Read:
+            if (vm->input != NULL) {
+                check(vm->input_used < vm->input_size,
+                      "No more input at %d", pc);
+                a = vm->input[vm->input_used++];
+            } else {
+                check(fscanf(vm->in, "%d", &a) == 1,
+                      "No more input at %d", pc);
+            }
+
+            stack[addr] = (int16_t) a;
+
+            if (tracing) {
+                trace_value(t, stack[addr]);
+            }
+
+            ++pc;
+            break;
+
+        case VM_Store:
+            if (tracing) {
+                trace_value(t, stack[sp]);
+            }
+
+            stack[addr] = stack[sp--];
+            ++pc;
+            break;
+
+        case VM_Load:
+            stack[++sp] = stack[addr];
+            ++pc;
+            break;
+
+        case VM_Up:
+            vm->pen_down = 0;
+
+            if (vm->pen != NULL) {
+                vm->pen(vm->pen_data, vm_pen_up, vm->pen_x, vm->pen_y);
+            }
+
+            ++pc;
+            break;
+
+        case VM_Down:
+            vm->pen_down = 1;
+
+            if (vm->pen != NULL) {
+                vm->pen(vm->pen_data, vm_pen_down, vm->pen_x, vm->pen_y);
+            }
+
+            ++pc;
+            break;
+
+        case VM_Move:
+            if (tracing) {
+                trace_move(t, stack[sp - 1] - vm->pen_x,
+                           stack[sp] - vm->pen_y);
+            }
+
+            vm->pen_x = stack[sp - 1];
+            vm->pen_y = stack[sp];
+            sp -= 2;
+
+            if (vm->pen != NULL) {
+                vm->pen(vm->pen_data, vm_pen_move, vm->pen_x, vm->pen_y);
+            }
+
+            ++pc;
+            break;
+
+        case VM_Add:
+            --sp;
+            stack[sp] = (int16_t) (stack[sp] + stack[sp + 1]);
+            ++pc;
+            break;
+
+        case VM_Sub:
+            --sp;
+            stack[sp] = (int16_t) (stack[sp] - stack[sp + 1]);
+            ++pc;
+            break;
+
+        case VM_Mul:
+            --sp;
+            stack[sp] = (int16_t) (stack[sp] * stack[sp + 1]);
+            ++pc;
+            break;
+
+        case VM_Neg:
+            stack[sp] = (int16_t) -stack[sp];
+            ++pc;
+            break;
+
+        case VM_Test:
+            zero = stack[sp] == 0;
+            negative = stack[sp] < 0;
+            ++pc;
+            break;
+
+        case VM_Loadi:
+            stack[++sp] = (int16_t) code[pc + 1];
+            pc += 2;
+            break;
+
+        case VM_Pop:
+            sp -= code[pc + 1];
+            pc += 2;
+            break;
+
+        case VM_Jsr:
+            last->pc = pc;
+            last->steps = steps;
+            stack[++sp] = (int16_t) (pc + 2);
+            stack[++sp] = (int16_t) fp;
+            fp = sp;
+            pc = code[pc + 1];
+            TRACE_JUMP(vm);
+            CHECK_LIMIT();
+            break;
+
+        case VM_Rts:
+            a = fp;
+            sp = fp - 2;
+            fp = (uint16_t) stack[a];
+
+            if (tracing) {
+                trace_return(t, pc, a, (uint16_t) stack[a - 1], fp);
+            }
+
+            pc = (uint16_t) stack[a - 1];
+            TRACE_JUMP(vm);
+            CHECK_LIMIT();
+            break;
+
+        case VM_Jump:
+            pc = code[pc + 1];
+            TRACE_JUMP(vm);
+            CHECK_LIMIT();
+            break;
+
+        case VM_Jeq:
+            if (tracing) {
+                trace_branch(t, zero);
+            }
+
+            if (zero) {
+                pc = code[pc + 1];
+                TRACE_JUMP(vm);
+                CHECK_LIMIT();
+            } else {
+                pc += 2;
+                TRACE_JUMP(vm);
+            }
+
+            break;
+
+        case VM_Jlt:
+            if (tracing) {
+                trace_branch(t, negative);
+            }
+
+            if (negative) {
+                pc = code[pc + 1];
+                TRACE_JUMP(vm);
+                CHECK_LIMIT();
+            } else {
+                pc += 2;
+                TRACE_JUMP(vm);
+            }
+
+            break;
+        }
+    }
+
+error:
+out:
+    SYNC(vm);
+    return status;
+}
+
+static __attribute__ ((noinline)) enum vm_status
+run_plain(struct vm *vm)
+{
+    return run_unchecked(vm, 0);
+}
+
+static __attribute__ ((noinline)) enum vm_status
+run_traced(struct vm *vm)
+{
+    return run_unchecked(vm, 1);
+}
+
+/**
+ * vm_run() for anything else
+ */
+static enum vm_status
+run_checked(struct vm *vm)
+{
+    const uint16_t *code = vm->image->code;
+    int             size = vm->image->size;
+    int             pc = vm->pc;
+    long long       limit = vm->step_limit ? vm->step_limit : LLONG_MAX;
+
+    for (;;) {
+        check(pc >= 0 && pc < size, "Jump out of the program: %d", pc);
+
+        if (vm->steps >= limit) {
+            vm->pc = pc;
+            return vm_running;
+        }
+
+        uint16_t        w = code[pc];
+        int             opcode = (w >> 8) & 0x7E;
+        int             base = (w & 0x100) ? vm->fp : vm->gp;
+        int             offset = (int8_t) (w & 0xFF);
+        int             operand = 0;
+        int             a,
+                        b,
+                        addr;
+
+        if (vm->profile != NULL) {
+            profile_count(vm->profile, pc);
+        }
+
+        ++vm->steps;
+
+        if (vm_is_two_words(opcode)) {
+            check(pc + 1 < size, "Missing operand at %d", pc);
+            operand = code[pc + 1];
+            vm->pc = pc + 2;
+        } else {
+            vm->pc = pc + 1;
+        }
+
+        switch (opcode) {
+        case VM_Halt:
+            vm->pc = pc;
+            return vm_halted;
+
+        case VM_Read:
+            ADDR(base, offset, addr);
+
+            if (vm->input_used == vm->input_size && vm->wait_for_input) {
+                // Runs the Read again when resumed
+                --vm->steps;
+                vm->pc = pc;
+                return vm_waiting;
+            }
+
+            if (vm->input != NULL) {
+                check(vm->input_used < vm->input_size,
+                      "No more input at %d", pc);
+                a = vm->input[vm->input_used++];
+            } else {
+                check(fscanf(vm->in, "%d", &a) == 1,
+                      "No more input at %d", pc);
+            }
+
+            vm->stack[addr] = (int16_t) a;
+
+            if (vm->trace != NULL) {
+                trace_value(vm->trace, vm->stack[addr]);
+            }
+
+            break;
+
+        case VM_Store:
+            ADDR(base, offset, addr);
+            POP(a);
+            vm->stack[addr] = (int16_t) a;
+
+            if (vm->trace != NULL) {
+                trace_value(vm->trace, a);
+            }
+
+            break;
+
+        case VM_Load:
+            ADDR(base, offset, addr);
+            PUSH(vm->stack[addr]);
+            break;
+
+        case VM_Up:
+            vm->pen_down = 0;
+
+            if (vm->pen != NULL) {
+                vm->pen(vm->pen_data, vm_pen_up, vm->pen_x, vm->pen_y);
+            }
+
+            break;
+
+        case VM_Down:
+            vm->pen_down = 1;
+
+            if (vm->pen != NULL) {
+                vm->pen(vm->pen_data, vm_pen_down, vm->pen_x, vm->pen_y);
+            }
+
+            break;
+
+        case VM_Move:
+            POP(b);
+            POP(a);
+
+            if (vm->trace != NULL) {
+                trace_move(vm->trace, a - vm->pen_x, b - vm->pen_y);
+            }
+
+            vm->pen_x = a;
+            vm->pen_y = b;
+
+            if (vm->pen != NULL) {
+                vm->pen(vm->pen_data, vm_pen_move, a, b);
+            }
+
+            break;
+
+        case VM_Add:
+            POP(b);
+            POP(a);
+            PUSH(a + b);
+            break;
+
+        case VM_Sub:
+            POP(b);
+            POP(a);
+            PUSH(a - b);
+            break;
+
+        case VM_Mul:
+            POP(b);
+            POP(a);
+            PUSH(a * b);
+            break;
+
+        case VM_Neg:
+            POP(a);
+            PUSH(-a);
+            break;
+
+        case VM_Test:
+            check(vm->sp > 0, "Stack underflow at %d", pc);
+            vm->zero = vm->stack[vm->sp] == 0;
+            vm->negative = vm->stack[vm->sp] < 0;
+            break;
+
+        case VM_Loadi:
+            PUSH(operand);
+            break;
+
+        case VM_Pop:
+            check(vm->sp - operand >= 0, "Stack underflow at %d", pc);
+            vm->sp -= operand;
+            break;
+
+        case VM_Jsr:
+            PUSH(vm->pc);
+            PUSH(vm->fp);
+            vm->fp = vm->sp;
+            vm->pc = operand;
+
+            if (vm->profile != NULL) {
+                profile_call(vm->profile, operand, vm->steps);
+            }
+
+            if (vm->trace != NULL) {
+                trace_jump(vm->trace, vm);
+            }
+
+            break;
+
+        case VM_Rts:
+            check(vm->fp > 1, "Return from the outmost scope at %d", pc);
+            vm->sp = vm->fp;
+            POP(a);
+            POP(b);
+            vm->fp = (uint16_t) a;
+            vm->pc = (uint16_t) b;
+
+            if (vm->profile != NULL) {
+                profile_return(vm->profile, vm->steps);
+            }
+
+            // SP was FP - 2 after the two pops
+            if (vm->trace != NULL) {
+                trace_return(vm->trace, pc, vm->sp + 2, vm->pc, vm->fp);
+                trace_jump(vm->trace, vm);
+            }
+
+            break;
+
+        case VM_Jump:
+            vm->pc = operand;
+
+            if (vm->trace != NULL) {
+                trace_jump(vm->trace, vm);
+            }
+
+            break;
+
+        case VM_Jeq:
+            if (vm->zero) {
+                vm->pc = operand;
+
+                if (vm->profile != NULL) {
+                    profile_taken(vm->profile, pc);
+                }
+            }
+
+            if (vm->trace != NULL) {
+                trace_branch(vm->trace, vm->zero);
+                trace_jump(vm->trace, vm);
+            }
+
+            break;
+
+        case VM_Jlt:
+            if (vm->negative) {
+                vm->pc = operand;
+
+                if (vm->profile != NULL) {
+                    profile_taken(vm->profile, pc);
+                }
+            }
+
+            if (vm->trace != NULL) {
+                trace_branch(vm->trace, vm->negative);
+                trace_jump(vm->trace, vm);
+            }
+
+            break;
+
+        default:
+            sentinel("%d is not an instruction (at %d)", w, pc);
+        }
+
+        pc = vm->pc;
+    }
+
+error:
+    vm->pc = pc;
+    return vm_error;
+}
+
+enum vm_status
+vm_run(struct vm *vm)
+{
+    enum vm_status  status;
+
+    if (vm->guarded && vm->image->verified && vm->reached &&
+            vm->profile == NULL && !vm->wait_for_input) {
+        unchecked = vm;
+
+        if (sigsetjmp(overflow, 0)) {
+            unchecked = NULL;
+            log_err("Stack overflow below the call at %d", vm->pc);
+            return vm_error;
+        }
+
+        status = vm->trace != NULL ? run_traced(vm) : run_plain(vm);
+        unchecked = NULL;
+
+        // Unless close to the step limit
+        if (status != vm_running) {
+            return status;
+        }
+    }
+
+    return run_checked(vm);
+}
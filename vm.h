@@ -0,0 +1,208 @@
+/*-
+ * Copyright (c) 2013, Meitian Huang <_@freeaddr.info>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * PDPlot-2 virtual machine
+ *
+ * Executes the binary images produced by `turtle -o FILE', i.e., one decimal
+ * word per line. Code and stack live in two separate arrays. The stack grows
+ * upwards, SP points to the top element and GP/FP are indices into the stack.
+ */
+
+#ifndef VM_H_
+#define VM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dbg.h"
+
+/**
+ * 16-bit target machine anyway...
+ */
+#define VM_CODE_SIZE 0x10000
+#define VM_STACK_SIZE 0x10000
+
+/**
+ * Inaccessible bytes after the stack of a machine made by vm_new(), a
+ * multiple of the page size
+ */
+#define VM_GUARD_SIZE 0x10000
+
+/**
+ * Opcodes, i.e., the high byte of an instruction word with the register bit
+ * (bit 0) masked out
+ */
+enum vm_opcode {
+    VM_Halt = 0x00,
+    VM_Read = 0x02,
+    VM_Store = 0x04,
+    VM_Load = 0x06,
+    VM_Up = 0x0A,
+    VM_Down = 0x0C,
+    VM_Move = 0x0E,
+    VM_Add = 0x10,
+    VM_Sub = 0x12,
+    VM_Mul = 0x14,
+    VM_Test = 0x16,
+    VM_Neg = 0x22,
+    VM_Rts = 0x28,
+    VM_Loadi = 0x56,
+    VM_Pop = 0x5E,
+    VM_Jsr = 0x68,
+    VM_Jump = 0x70,
+    VM_Jeq = 0x72,
+    VM_Jlt = 0x74,
+};
+
+enum vm_status {
+    // Stopped at vm.step_limit, can be run again
+    vm_running,
+    vm_halted,
+    vm_error,
+    // Stopped at a Read with no input left, can be run again once there is
+    // some in vm.input
+    vm_waiting,
+};
+
+enum vm_pen_event {
+    vm_pen_up,
+    vm_pen_down,
+    vm_pen_move,
+};
+
+/**
+ * A loaded program. It is never modified by the machine, so one image can be
+ * shared by many machines.
+ */
+struct vm_image {
+    uint16_t        code[VM_CODE_SIZE];
+    int             size;
+    // Set by vm_load_image() if verify_image() accepts it
+    int             verified;
+};
+
+struct profile;
+struct trace;
+
+struct vm {
+    const struct vm_image *image;
+    int             pc;
+    int             sp;
+    int             fp;
+    int             gp;
+    // Set by Test
+    int             zero;
+    int             negative;
+    // Pen state
+    int             pen_down;
+    int             pen_x;
+    int             pen_y;
+    // Number of instructions executed so far
+    long long       steps;
+    // Where Read gets its values from: input if not NULL, in otherwise
+    FILE           *in;
+    const int      *input;
+    int             input_size;
+    int             input_used;
+    // Wait rather than fail when Read runs out of input
+    int             wait_for_input;
+    // Stop when steps reaches it, unless 0
+    long long       step_limit;
+    // Called on every Up, Down and Move, unless NULL
+    void          (*pen)(void *data, enum vm_pen_event event, int x, int y);
+    void           *pen_data;
+    // NULL unless profiling
+    struct profile *profile;
+    // NULL unless recording a trace
+    struct trace   *trace;
+    // Set by vm_new()
+    int             guarded;
+    // Set by vm_reset(). Cleared when the registers are set from elsewhere,
+    // e.g., a checkpoint, as the image may not reach them.
+    int             reached;
+    // Last, so that the guard page of vm_new() comes right after it
+    int16_t         stack[VM_STACK_SIZE] __attribute__ ((aligned(8)));
+};
+
+/**
+ * @returns the image loaded from @path, or NULL if it cannot be loaded
+ */
+struct vm_image *vm_load_image(const char *path);
+
+/**
+ * @returns a new machine whose stack is followed by VM_GUARD_SIZE bytes that
+ * cannot be accessed, or NULL if it cannot be mapped
+ *
+ * Only such a machine runs verified images unchecked. Any other struct vm,
+ * e.g., from calloc(), runs everything with all the checks.
+ */
+struct vm      *vm_new(void);
+
+/**
+ * Frees @vm, made by vm_new()
+ */
+void            vm_free(struct vm *vm);
+
+/**
+ * @returns the mnemonic of @opcode, or NULL if it is not an instruction
+ */
+const char     *vm_opcode_name(int opcode);
+
+/**
+ * @returns 1 if the instruction with @opcode is followed by an operand word
+ */
+int             vm_is_two_words(int opcode);
+
+/**
+ * Puts the machine @vm in its initial state, ready to run @image
+ *
+ * The stack is left as it is, and so are the input and pen callback.
+ */
+void            vm_reset(struct vm *vm, const struct vm_image *image);
+
+/**
+ * Runs @vm until it halts or fails, or until it waits for input or reaches
+ * its step limit if asked to
+ *
+ * A machine from vm_new() with a verified image, in a state reached by
+ * running it from vm_reset(), and with neither profile nor waiting for input,
+ * runs with no checks, but for the last steps before the step limit, and
+ * for the rest of the run once its stack is close to full. It then fails
+ * when out of input, and when out of stack, at the same pc and step as with
+ * the checks. Were the stack still to run into the guard page, the pc and
+ * steps would be those of the last Jsr.
+ */
+enum vm_status  vm_run(struct vm *vm);
+
+/**
+ * Pen callback that writes the plot stream to the FILE * in @data
+ *
+ * One event per line: `Up', `Down' or `Move x y'.
+ */
+void            vm_write_pen(void *data, enum vm_pen_event event, int x, int y);
+
+#endif /* end of include guard: VM_H_ */